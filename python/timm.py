@@ -0,0 +1,316 @@
+"""
+Python bindings of the pupil center detector, over the C interface of libtimm (src/timm_c.h).
+
+    import numpy as np, timm
+    det = timm.Detector(n_threads=8)                              # simd_width: default_simd_width()
+    (x, y), (x_coarse, y_coarse) = det.pupil_center(frame)       # frame: (H, W) uint8
+    results = det.pupil_center_batch(frames)                      # frames: (N, H, W) uint8 -> (N, 4) float32
+
+    stage = timm.Stage()                                          # single stage (Timm), no windowed refinement
+    x, y = stage.pupil_center(frame)
+
+- frames are passed to the library as views, without copying, if their rows are contiguous (strides[-1] == 1).
+  anything else (other dtypes, negative or non-unit column strides) is converted with np.ascontiguousarray first.
+- the library is called through ctypes.CDLL, which releases the GIL for the duration of every call, so
+  other Python threads keep running while a frame is processed. a Detector or Stage may be shared between threads:
+  its calls are serialized by a lock of the object (the native detector must not be used by two threads at once),
+  so frames are only processed in parallel by separate objects (or by pupil_center_batch).
+- pupil_center_batch processes the frames on n_threads native threads.
+- the library (target timm of CMakeLists.txt) is loaded from the TIMM_LIBRARY environment variable, the directory of
+  this file or the system search path.
+"""
+
+import ctypes
+import os
+import sys
+import threading
+
+import numpy as np
+
+NO_VEC, VEC128, VEC256, VEC512 = 32, 128, 256, 512
+OPENCL, OPENCL_FULL, OPENCL_HYBRID = 4096, 8192, 16384
+
+ENGINE_AUTO, ENGINE_CENTER_MAJOR, ENGINE_GRADIENT_MAJOR = 0, 1, 2
+RSQRT_DEFAULT, RSQRT_ESTIMATE, RSQRT_NEWTON, RSQRT_EXACT = -1, 0, 1, 2
+SUBPIXEL_NONE, SUBPIXEL_QUADRATIC, SUBPIXEL_GAUSSIAN, SUBPIXEL_CENTROID = 0, 1, 2, 3
+
+ABI_VERSION = 1
+
+_OK = 0
+_NO_RESULT = 1
+
+
+class StageOptions(ctypes.Structure):
+    """see Timm::options"""
+    _fields_ = [
+        ("down_scaling_width", ctypes.c_int32),
+        ("blur", ctypes.c_int32),
+        ("sobel", ctypes.c_int32),
+        ("gradient_threshold", ctypes.c_float),
+        ("postprocess_threshold", ctypes.c_float),
+        ("candidate_fraction", ctypes.c_float),
+        ("candidate_min_weight", ctypes.c_int32),
+        ("engine", ctypes.c_int32),
+        ("gradient_major_ratio", ctypes.c_float),
+        ("rsqrt_precision", ctypes.c_int32),
+        ("subpixel", ctypes.c_int32),
+        ("subpixel_radius", ctypes.c_int32),
+    ]
+
+
+class Options(ctypes.Structure):
+    """see Timm_two_stage::options"""
+    _fields_ = [
+        ("blur", ctypes.c_int32),
+        ("window_width", ctypes.c_int32),
+        ("stage1", StageOptions),
+        ("stage2", StageOptions),
+    ]
+
+
+class _Image(ctypes.Structure):
+    _fields_ = [
+        ("data", ctypes.c_void_p),
+        ("width", ctypes.c_int32),
+        ("height", ctypes.c_int32),
+        ("stride", ctypes.c_ssize_t),
+    ]
+
+
+class _Result(ctypes.Structure):
+    _fields_ = [
+        ("x", ctypes.c_float),
+        ("y", ctypes.c_float),
+        ("x_coarse", ctypes.c_float),
+        ("y_coarse", ctypes.c_float),
+        ("frame_id", ctypes.c_uint64),
+        ("latency_ms", ctypes.c_float),
+        ("status", ctypes.c_int32),
+    ]
+
+
+class TimmError(RuntimeError):
+    pass
+
+
+def _load_library():
+    names = {"win32": ["timm.dll"], "darwin": ["libtimm.dylib"]}.get(sys.platform, ["libtimm.so"])
+    candidates = []
+    if os.environ.get("TIMM_LIBRARY"):
+        candidates.append(os.environ["TIMM_LIBRARY"])
+    here = os.path.dirname(os.path.abspath(__file__))
+    candidates += [os.path.join(here, n) for n in names] + names
+
+    errors = []
+    for c in candidates:
+        try:
+            return ctypes.CDLL(c)
+        except OSError as e:
+            errors.append("%s: %s" % (c, e))
+    raise OSError("libtimm not found, set TIMM_LIBRARY. tried:\n  " + "\n  ".join(errors))
+
+
+def _declare(lib):
+    p = ctypes.POINTER
+    c_int, c_size, c_ssize = ctypes.c_int32, ctypes.c_size_t, ctypes.c_ssize_t
+    image_args = [ctypes.c_void_p, c_int, c_int, c_ssize]
+    signatures = {
+        "timm_abi_version": (ctypes.c_uint32, []),
+        "timm_last_error": (ctypes.c_char_p, []),
+        "timm_default_options": (None, [p(Options)]),
+        "timm_simd_width_supported": (c_int, [c_int]),
+        "timm_create": (c_int, [c_int, c_int, p(ctypes.c_void_p)]),
+        "timm_destroy": (None, [ctypes.c_void_p]),
+        "timm_set_options": (c_int, [ctypes.c_void_p, p(Options)]),
+        "timm_get_options": (c_int, [ctypes.c_void_p, p(Options)]),
+        "timm_process": (c_int, [ctypes.c_void_p] + image_args + [p(_Result)]),
+        "timm_process_batch": (c_int, [ctypes.c_void_p, p(_Image), c_size, p(_Result)]),
+        "timm_stage_create": (c_int, [c_int, c_int, p(ctypes.c_void_p)]),
+        "timm_stage_destroy": (None, [ctypes.c_void_p]),
+        "timm_stage_set_options": (c_int, [ctypes.c_void_p, p(StageOptions)]),
+        "timm_stage_get_options": (c_int, [ctypes.c_void_p, p(StageOptions)]),
+        "timm_stage_process": (c_int, [ctypes.c_void_p] + image_args + [p(_Result)]),
+    }
+    for name, (restype, argtypes) in signatures.items():
+        f = getattr(lib, name)
+        f.restype = restype
+        f.argtypes = argtypes
+
+    if lib.timm_abi_version() != ABI_VERSION:
+        raise OSError("libtimm has ABI version %d, these bindings need %d" % (lib.timm_abi_version(), ABI_VERSION))
+    return lib
+
+
+_lib = None
+
+
+def _library():
+    global _lib
+    if _lib is None:
+        _lib = _declare(_load_library())
+    return _lib
+
+
+def _check(status):
+    if status < 0:
+        raise TimmError(_library().timm_last_error().decode(errors="replace"))
+    return status
+
+
+def _as_frames(a, ndim):
+    """uint8 array with contiguous rows, as a view if possible"""
+    a = np.asarray(a)
+    if a.ndim != ndim:
+        raise ValueError("expected a %d dimensional array, got shape %s" % (ndim, a.shape))
+    if a.dtype != np.uint8 or a.strides[-1] != 1 or any(s <= 0 for s in a.strides[:-1]):
+        a = np.ascontiguousarray(a, dtype=np.uint8)
+    return a
+
+
+def simd_width_supported(simd_width):
+    """True if the library has the kernels of this simd width (x86 widths depend on its build flags)"""
+    return _library().timm_simd_width_supported(simd_width) != 0
+
+
+def default_simd_width():
+    """the widest supported CPU width up to VEC256, like Timm::default_simd_width"""
+    for w in (VEC256, VEC128):
+        if simd_width_supported(w):
+            return w
+    return NO_VEC
+
+
+def default_options():
+    o = Options()
+    _library().timm_default_options(ctypes.byref(o))
+    return o
+
+
+class Detector:
+    """two stage detector (Timm_two_stage). n_threads is the number of frames pupil_center_batch processes in parallel.
+    thread safe: calls from several threads are serialized, use one Detector per thread to process frames in parallel"""
+
+    def __init__(self, simd_width=None, n_threads=1, options=None):
+        self._lib = _library()
+        self._handle = ctypes.c_void_p()
+        self._lock = threading.Lock()  # the handle and the result buffers are used by one thread at a time
+        if simd_width is None:
+            simd_width = default_simd_width()
+        _check(self._lib.timm_create(simd_width, n_threads, ctypes.byref(self._handle)))
+        self._result = _Result()
+        self._batch_images = None
+        self._batch_results = None
+        if options is not None:
+            self.options = options
+
+    def close(self):
+        with self._lock:
+            if self._handle:
+                self._lib.timm_destroy(self._handle)
+                self._handle = ctypes.c_void_p()
+
+    def __del__(self):
+        self.close()
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, *args):
+        self.close()
+
+    @property
+    def options(self):
+        o = Options()
+        with self._lock:
+            _check(self._lib.timm_get_options(self._handle, ctypes.byref(o)))
+        return o
+
+    @options.setter
+    def options(self, o):
+        with self._lock:
+            _check(self._lib.timm_set_options(self._handle, ctypes.byref(o)))
+
+    def pupil_center(self, frame):
+        """returns ((x, y), (x_coarse, y_coarse)) in pixels of frame"""
+        a = _as_frames(frame, 2)
+        with self._lock:
+            r = self._result
+            _check(self._lib.timm_process(self._handle, a.ctypes.data, a.shape[1], a.shape[0], a.strides[0], ctypes.byref(r)))
+            return (r.x, r.y), (r.x_coarse, r.y_coarse)
+
+    def pupil_center_batch(self, frames):
+        """frames: (N, H, W). returns an (N, 4) float32 array of x, y, x_coarse, y_coarse"""
+        a = _as_frames(frames, 3)
+        n, h, w = a.shape
+        if n == 0:
+            return np.zeros((0, 4), np.float32)
+
+        with self._lock:
+            # the descriptor arrays are kept for the next call of the same batch size
+            if self._batch_images is None or len(self._batch_images) != n:
+                self._batch_images = (_Image * n)()
+                self._batch_results = (_Result * n)()
+            images = self._batch_images
+            base = a.ctypes.data
+            for i in range(n):
+                images[i].data = base + i * a.strides[0]
+                images[i].width = w
+                images[i].height = h
+                images[i].stride = a.strides[1]
+
+            _check(self._lib.timm_process_batch(self._handle, images, n, self._batch_results))
+
+            # x, y, x_coarse, y_coarse are the first four floats of every result
+            raw = np.frombuffer(self._batch_results, dtype=np.uint8).reshape(n, ctypes.sizeof(_Result))
+            return raw[:, :16].copy().view(np.float32)
+
+
+class Stage:
+    """single stage detector (Timm). n_threads is the number of threads per frame.
+    thread safe: calls from several threads are serialized, use one Stage per thread to process frames in parallel"""
+
+    def __init__(self, simd_width=None, n_threads=1, options=None):
+        self._lib = _library()
+        self._handle = ctypes.c_void_p()
+        self._lock = threading.Lock()  # see Detector
+        if simd_width is None:
+            simd_width = default_simd_width()
+        _check(self._lib.timm_stage_create(simd_width, n_threads, ctypes.byref(self._handle)))
+        self._result = _Result()
+        if options is not None:
+            self.options = options
+
+    def close(self):
+        with self._lock:
+            if self._handle:
+                self._lib.timm_stage_destroy(self._handle)
+                self._handle = ctypes.c_void_p()
+
+    def __del__(self):
+        self.close()
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, *args):
+        self.close()
+
+    @property
+    def options(self):
+        o = StageOptions()
+        with self._lock:
+            _check(self._lib.timm_stage_get_options(self._handle, ctypes.byref(o)))
+        return o
+
+    @options.setter
+    def options(self, o):
+        with self._lock:
+            _check(self._lib.timm_stage_set_options(self._handle, ctypes.byref(o)))
+
+    def pupil_center(self, frame):
+        """returns (x, y) in pixels of frame"""
+        a = _as_frames(frame, 2)
+        with self._lock:
+            r = self._result
+            _check(self._lib.timm_stage_process(self._handle, a.ctypes.data, a.shape[1], a.shape[0], a.strides[0], ctypes.byref(r)))
+            return r.x, r.y
@@ -0,0 +1,95 @@
+// platform part of affinity.h
+
+#include "affinity.h"
+
+#include <cctype>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <filesystem>
+#endif
+
+std::vector<int> available_cpus()
+{
+	std::vector<int> cpus;
+	#ifdef _WIN32
+	DWORD_PTR process_mask = 0, system_mask = 0;
+	GetProcessAffinityMask(GetCurrentProcess(), &process_mask, &system_mask);
+	for (int c = 0; c < int(8 * sizeof(DWORD_PTR)); c++) { if (process_mask & (DWORD_PTR(1) << c)) { cpus.push_back(c); } }
+	#else
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	if (sched_getaffinity(0, sizeof(set), &set) == 0)
+	{
+		for (int c = 0; c < CPU_SETSIZE; c++) { if (CPU_ISSET(c, &set)) { cpus.push_back(c); } }
+	}
+	#endif
+	return cpus;
+}
+
+bool pin_current_thread(const std::vector<int>& cpus)
+{
+	const std::vector<int> all = cpus.empty() ? available_cpus() : cpus;
+	#ifdef _WIN32
+	DWORD_PTR mask = 0;
+	for (int c : all) { if (c < int(8 * sizeof(DWORD_PTR))) { mask |= DWORD_PTR(1) << c; } }
+	return mask != 0 && SetThreadAffinityMask(GetCurrentThread(), mask) != 0;
+	#else
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	for (int c : all) { if (c < CPU_SETSIZE) { CPU_SET(c, &set); } }
+	return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+	#endif
+}
+
+bool set_realtime_priority(int priority)
+{
+	#ifdef _WIN32
+	return SetThreadPriority(GetCurrentThread(), priority > 0 ? THREAD_PRIORITY_TIME_CRITICAL : THREAD_PRIORITY_NORMAL) != 0;
+	#else
+	sched_param p;
+	p.sched_priority = priority > 0 ? std::min(priority, sched_get_priority_max(SCHED_FIFO)) : 0;
+	return pthread_setschedparam(pthread_self(), priority > 0 ? SCHED_FIFO : SCHED_OTHER, &p) == 0;
+	#endif
+}
+
+int numa_node_of_cpu(int cpu)
+{
+	#ifdef _WIN32
+	UCHAR node = 0;
+	if (cpu < 256 && GetNumaProcessorNode(UCHAR(cpu), &node)) { return node; }
+	return 0;
+	#else
+	// the cpu directory in sysfs links its node as nodeN
+	namespace fs = std::filesystem;
+	std::error_code ec;
+	for (auto& e : fs::directory_iterator("/sys/devices/system/cpu/cpu" + std::to_string(cpu), ec))
+	{
+		const std::string name = e.path().filename().string();
+		if (name.size() > 4 && name.compare(0, 4, "node") == 0 && std::all_of(name.begin() + 4, name.end(), [](char c) { return std::isdigit(static_cast<unsigned char>(c)) != 0; })) { return std::stoi(name.substr(4)); }
+	}
+	return 0;
+	#endif
+}
+
+std::vector<std::vector<int>> cpus_by_numa_node(const std::vector<int>& cpus)
+{
+	std::vector<std::pair<int, int>> node_cpu;
+	for (int c : cpus) { node_cpu.emplace_back(numa_node_of_cpu(c), c); }
+	std::sort(node_cpu.begin(), node_cpu.end());
+
+	std::vector<std::vector<int>> groups;
+	for (size_t i = 0; i < node_cpu.size(); i++)
+	{
+		if (i == 0 || node_cpu[i].first != node_cpu[i - 1].first) { groups.emplace_back(); }
+		groups.back().push_back(node_cpu[i].second);
+	}
+	return groups;
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+// cpu pinning, NUMA nodes and real-time priority of threads, for Linux and Windows.
+// all functions return false / a neutral value if the platform or the permissions do not allow it, nothing throws.
+// the platform calls are in affinity.cpp, so that including this header does not pull in <windows.h> or pthread.
+
+#include <vector>
+#include <string>
+#include <sstream>
+#include <algorithm>
+
+// "0-3,8,10-11" -> 0 1 2 3 8 10 11. invalid parts are ignored
+inline std::vector<int> parse_cpu_list(const std::string& s)
+{
+	std::vector<int> cpus;
+	std::stringstream ss(s);
+	std::string part;
+	while (std::getline(ss, part, ','))
+	{
+		int a = -1, b = -1;
+		char dash = 0;
+		std::stringstream ps(part);
+		if (!(ps >> a) || a < 0) { continue; }
+		if (ps >> dash >> b && dash == '-' && b >= a) { for (int c = a; c <= b; c++) { cpus.push_back(c); } }
+		else { cpus.push_back(a); }
+	}
+	std::sort(cpus.begin(), cpus.end());
+	cpus.erase(std::unique(cpus.begin(), cpus.end()), cpus.end());
+	return cpus;
+}
+
+// cpus the calling thread may run on
+std::vector<int> available_cpus();
+
+// pins the calling thread to the given cpus (an empty list removes the pinning)
+bool pin_current_thread(const std::vector<int>& cpus);
+
+inline bool pin_current_thread(int cpu) { return pin_current_thread(std::vector<int>{ cpu }); }
+
+// priority > 0: real-time scheduling of the calling thread. on Linux SCHED_FIFO with this priority (1..99,
+// needs CAP_SYS_NICE or an rtprio limit), on Windows THREAD_PRIORITY_TIME_CRITICAL. priority 0: normal scheduling.
+// a SCHED_FIFO thread that never blocks starves everything else on its cpu, so use it on isolated cores only
+bool set_realtime_priority(int priority);
+
+// NUMA node of a cpu, 0 if unknown
+int numa_node_of_cpu(int cpu);
+
+// the cpus grouped by NUMA node, in ascending node order. nodes without any of the cpus are left out
+std::vector<std::vector<int>> cpus_by_numa_node(const std::vector<int>& cpus);
+
+// pinning and priority of worker threads. worker i runs on cpus[i % cpus.size()], nothing is changed if cpus is empty
+struct worker_affinity
+{
+	std::vector<int> cpus;
+	int realtime_priority = 0; // see set_realtime_priority
+
+	bool enabled() const { return !cpus.empty() || realtime_priority > 0; }
+
+	// called by worker i itself
+	void apply(int i) const
+	{
+		if (!cpus.empty()) { pin_current_thread(cpus[i % cpus.size()]); }
+		if (realtime_priority > 0) { set_realtime_priority(realtime_priority); }
+	}
+};
@@ -0,0 +1,232 @@
+// latency of handing pupil results from the detector thread to several consumer threads:
+// Result_stream with polling readers, Result_stream with blocking readers, and the mutex protected queue per consumer it replaces.
+//   bench_result_stream [-readers n] [-producers n] [-results n] [-rate hz] [-load n]
+//     -readers   consumer threads (default 3)
+//     -producers threads that publish the results together, e.g. one per camera (default 1)
+//     -results   results published per variant (default 20000)
+//     -rate      results per second of all producers, 0 = as fast as possible (default 1000, a fast eye camera)
+//     -load      additional threads that keep cores busy, to see the effect of contention and preemption (default 0)
+// reports the producer side cost per result and the latency from publish to receive per reader.
+// every reader checks that the results it receives are intact (not mixed from two results), see "corrupt".
+
+#include <iostream>
+#include <iomanip>
+#include <thread>
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <string>
+
+#include "result_stream.h"
+#include "helpers.h"
+
+using clock_type = std::chrono::steady_clock;
+
+inline uint64_t now_ns()
+{
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(clock_type::now().time_since_epoch()).count();
+}
+
+// the baseline: every consumer has its own queue
+class Mutex_queue
+{
+	std::mutex mtx;
+	std::condition_variable cv;
+	std::deque<pupil_result> q;
+
+public:
+	void push(const pupil_result& r)
+	{
+		{
+			std::lock_guard<std::mutex> lock(mtx);
+			q.push_back(r);
+		}
+		cv.notify_one();
+	}
+
+	bool pop(pupil_result& r, std::chrono::milliseconds timeout)
+	{
+		std::unique_lock<std::mutex> lock(mtx);
+		if (!cv.wait_for(lock, timeout, [this]() { return !q.empty(); })) { return false; }
+		r = q.front();
+		q.pop_front();
+		return true;
+	}
+};
+
+struct reader_stats
+{
+	std::vector<float> latencies_us;
+	uint64_t n_lost = 0;
+	uint64_t n_corrupt = 0;
+
+	void received(const pupil_result& r)
+	{
+		latencies_us.push_back((now_ns() - r.publish_timestamp_ns) * 1e-3f);
+		n_corrupt += r.x != float(r.frame_id) || r.y != -float(r.frame_id);
+	}
+};
+
+struct run_stats
+{
+	std::vector<float> publish_ns;
+	std::vector<reader_stats> readers;
+};
+
+// publishes n results at rate (0 = flat out) from n_producers threads through publish, while the readers consume them
+run_stats run(int n_readers, int n_producers, int n, float rate, std::function<void(const pupil_result&)> publish,
+	std::function<void(int reader, std::atomic<bool>& done, reader_stats& st)> consume)
+{
+	run_stats rs;
+	rs.readers.resize(n_readers);
+	rs.publish_ns.reserve(n);
+	std::atomic<bool> done{ false };
+	std::vector<std::thread> readers;
+	for (int i = 0; i < n_readers; i++)
+	{
+		rs.readers[i].latencies_us.reserve(n);
+		readers.emplace_back([&, i]() { consume(i, done, rs.readers[i]); });
+	}
+	std::this_thread::sleep_for(std::chrono::milliseconds(50)); // readers are ready
+
+	// producer k publishes the results k, k + n_producers, ...
+	const auto period = std::chrono::nanoseconds(rate > 0 ? int64_t(1e9 * n_producers / rate) : 0);
+	std::vector<std::vector<float>> publish_ns(n_producers);
+	std::vector<std::thread> producers;
+	for (int k = 0; k < n_producers; k++)
+	{
+		producers.emplace_back([&, k]()
+		{
+			auto t_next = clock_type::now();
+			pupil_result r;
+			publish_ns[k].reserve(n / n_producers + 1);
+			for (int i = k; i < n; i += n_producers)
+			{
+				if (rate > 0)
+				{
+					while (clock_type::now() < t_next) {} // spin, sleeping is too coarse at high rates
+					t_next += period;
+				}
+				r.frame_id = i;
+				r.x = float(i);
+				r.y = -float(i);
+				const uint64_t t0 = now_ns();
+				r.publish_timestamp_ns = t0;
+				publish(r);
+				publish_ns[k].push_back(float(now_ns() - t0));
+			}
+		});
+	}
+	for (int k = 0; k < n_producers; k++)
+	{
+		producers[k].join();
+		rs.publish_ns.insert(rs.publish_ns.end(), publish_ns[k].begin(), publish_ns[k].end());
+	}
+	std::this_thread::sleep_for(std::chrono::milliseconds(100)); // readers catch up
+	done = true;
+	for (auto& t : readers) { t.join(); }
+	return rs;
+}
+
+void print(const std::string& name, run_stats& rs, int n)
+{
+	using namespace std;
+	double publish_sum = 0.0;
+	for (float t : rs.publish_ns) { publish_sum += t; }
+	cout << name << "\n  producer: mean " << publish_sum / rs.publish_ns.size() << " ns, 99% " << percentile(rs.publish_ns, 0.99f)
+		<< " ns, max " << percentile(rs.publish_ns, 1.0f) << " ns per result\n";
+	for (size_t i = 0; i < rs.readers.size(); i++)
+	{
+		auto& st = rs.readers[i];
+		cout << "  reader " << i << ": received " << st.latencies_us.size() << " / " << n << ", lost " << st.n_lost << ", corrupt " << st.n_corrupt
+			<< ", latency median " << percentile(st.latencies_us, 0.5f) << " us, 99% " << percentile(st.latencies_us, 0.99f)
+			<< " us, max " << percentile(st.latencies_us, 1.0f) << " us\n";
+	}
+}
+
+int main(int argc, char* argv[])
+{
+	using namespace std;
+
+	int n_readers = 3, n_producers = 1, n = 20000, n_load = 0;
+	float rate = 1000.0f;
+	for (int i = 1; i < argc; i++)
+	{
+		string a = argv[i];
+		if (a == "-readers" && i + 1 < argc) { n_readers = max(1, atoi(argv[++i])); }
+		else if (a == "-producers" && i + 1 < argc) { n_producers = max(1, atoi(argv[++i])); }
+		else if (a == "-results" && i + 1 < argc) { n = max(1, atoi(argv[++i])); }
+		else if (a == "-rate" && i + 1 < argc) { rate = float(atof(argv[++i])); }
+		else if (a == "-load" && i + 1 < argc) { n_load = atoi(argv[++i]); }
+		else { cerr << "unknown argument " << a << "\n"; return 1; }
+	}
+
+	atomic<bool> stop_load{ false };
+	vector<thread> load;
+	for (int i = 0; i < n_load; i++)
+	{
+		load.emplace_back([&]()
+		{
+			volatile double x = 1.0;
+			while (!stop_load) { for (int k = 0; k < 10000; k++) { x = x * 1.0000001 + 1e-9; } }
+		});
+	}
+
+	cout << n_readers << " readers, " << n_producers << " producers, " << n << " results at " << (rate > 0 ? to_string(int(rate)) + " Hz" : string("full speed"))
+		<< ", " << n_load << " load threads\n";
+
+	{
+		auto stream = make_unique<Result_stream<pupil_result>>();
+		auto rs = run(n_readers, n_producers, n, rate, [&](const pupil_result& r) { stream->publish(r); },
+			[&](int, atomic<bool>& done, reader_stats& st)
+		{
+			Result_stream<pupil_result>::reader reader(*stream);
+			pupil_result r;
+			while (!done)
+			{
+				if (reader.poll(r)) { st.received(r); }
+				else { this_thread::yield(); }
+			}
+			st.n_lost = reader.n_lost();
+		});
+		print("Result_stream, polling readers", rs, n);
+	}
+
+	{
+		auto stream = make_unique<Result_stream<pupil_result>>();
+		auto rs = run(n_readers, n_producers, n, rate, [&](const pupil_result& r) { stream->publish(r); },
+			[&](int, atomic<bool>& done, reader_stats& st)
+		{
+			Result_stream<pupil_result>::reader reader(*stream);
+			pupil_result r;
+			while (!done)
+			{
+				if (reader.wait(r, chrono::milliseconds(10))) { st.received(r); }
+			}
+			st.n_lost = reader.n_lost();
+		});
+		print("Result_stream, blocking readers", rs, n);
+	}
+
+	{
+		vector<Mutex_queue> queues(n_readers);
+		auto rs = run(n_readers, n_producers, n, rate, [&](const pupil_result& r) { for (auto& q : queues) { q.push(r); } },
+			[&](int i, atomic<bool>& done, reader_stats& st)
+		{
+			pupil_result r;
+			while (!done)
+			{
+				if (queues[i].pop(r, chrono::milliseconds(10))) { st.received(r); }
+			}
+		});
+		print("mutex protected queue per reader", rs, n);
+	}
+
+	stop_load = true;
+	for (auto& t : load) { t.join(); }
+	return 0;
+}
@@ -0,0 +1,153 @@
+#pragma once
+
+#include "timm.h"
+
+#include <vector>
+#include <string>
+#include <limits>
+
+// coarse pupil center detectors for stage 1 of Timm_two_stage.
+// the coarse estimate only places the window of stage 2, so it just has to be within window_width of the pupil.
+// all detectors take the (already blurred) gray frame and return the estimate in frame pixels.
+class Coarse_detector
+{
+public:
+	virtual ~Coarse_detector() {}
+	virtual cv::Point2f pupil_center(const cv::Mat& frame_gray) = 0;
+	virtual std::string name() const = 0;
+};
+
+
+// the Timm objective function, like the default stage 1. with a down_scaling_width of 24-32 ("tiny Timm"),
+// the quadratic cost is ~10x lower than with the default 85
+class Coarse_timm : public Coarse_detector
+{
+public:
+	Timm timm;
+
+	Coarse_timm(int down_scaling_width = 85, enum_simd_variant simd_width = Timm::default_simd_width())
+	{
+		timm.setup(simd_width);
+		timm.opt.down_scaling_width = down_scaling_width;
+	}
+
+	cv::Point2f pupil_center(const cv::Mat& frame_gray) override
+	{
+		return timm.pupil_center(frame_gray);
+	}
+
+	std::string name() const override { return "timm " + std::to_string(timm.opt.down_scaling_width); }
+};
+
+
+// center of the darkest square window, found with an integral image of the down scaled frame.
+// cost is linear in the number of pixels
+class Coarse_darkest_blob : public Coarse_detector
+{
+private:
+	cv::Mat img_scaled, integral;
+public:
+	struct options
+	{
+		int down_scaling_width = 64;
+		float box_fraction = 0.12f; // side length of the window as fraction of the width, roughly the pupil diameter
+	} opt;
+
+	cv::Point2f pupil_center(const cv::Mat& frame_gray) override
+	{
+		const float s = float(frame_gray.cols) / opt.down_scaling_width;
+		cv::resize(frame_gray, img_scaled, cv::Size(opt.down_scaling_width, std::max(1, int(round(frame_gray.rows / s)))), 0, 0, cv::INTER_AREA);
+		cv::integral(img_scaled, integral, CV_32S);
+
+		const int b = std::max(1, std::min(std::min(img_scaled.cols, img_scaled.rows), int(round(opt.box_fraction * opt.down_scaling_width))));
+		int best = std::numeric_limits<int>::max();
+		cv::Point best_pos(0, 0);
+		for (int y = 0; y + b <= img_scaled.rows; y++)
+		{
+			auto top = integral.ptr<int>(y);
+			auto bottom = integral.ptr<int>(y + b);
+			for (int x = 0; x + b <= img_scaled.cols; x++)
+			{
+				const int sum = bottom[x + b] - bottom[x] - top[x + b] + top[x];
+				if (sum < best) { best = sum; best_pos = cv::Point(x, y); }
+			}
+		}
+
+		// center of the window, in frame pixels
+		const float c = 0.5f * (b - 1);
+		return cv::Point2f(s * (best_pos.x + c + 0.5f) - 0.5f, s * (best_pos.y + c + 0.5f) - 0.5f);
+	}
+
+	std::string name() const override { return "darkest blob"; }
+};
+
+
+// fast radial symmetry transform (Loy and Zelinsky, 2003), dark symmetry only:
+// every strong gradient votes for the pixels at distance n against its direction, for all radii n.
+// the pupil is a dark disc, so these votes accumulate at its center
+class Coarse_radial_symmetry : public Coarse_detector
+{
+private:
+	cv::Mat img_scaled, gx, gy, mag, orientation, magnitude, symmetry, s_n;
+public:
+	struct options
+	{
+		int down_scaling_width = 64;
+		std::vector<int> radii = { 3, 5, 7, 9 }; // in pixels of the down scaled image
+		float alpha = 2.0f;                     // radial strictness
+		float gradient_threshold = 0.1f;        // gradients below this fraction of the maximum do not vote
+	} opt;
+
+	cv::Point2f pupil_center(const cv::Mat& frame_gray) override
+	{
+		const float s = float(frame_gray.cols) / opt.down_scaling_width;
+		cv::resize(frame_gray, img_scaled, cv::Size(opt.down_scaling_width, std::max(1, int(round(frame_gray.rows / s)))), 0, 0, cv::INTER_AREA);
+		cv::Sobel(img_scaled, gx, CV_32F, 1, 0, 3);
+		cv::Sobel(img_scaled, gy, CV_32F, 0, 1, 3);
+		cv::magnitude(gx, gy, mag);
+
+		double mag_max = 0.0;
+		cv::minMaxLoc(mag, NULL, &mag_max);
+		const float threshold = opt.gradient_threshold * mag_max;
+
+		const int rows = img_scaled.rows;
+		const int cols = img_scaled.cols;
+		symmetry = cv::Mat::zeros(rows, cols, CV_32F);
+		for (int n : opt.radii)
+		{
+			orientation = cv::Mat::zeros(rows, cols, CV_32F);
+			magnitude = cv::Mat::zeros(rows, cols, CV_32F);
+			for (int y = 0; y < rows; y++)
+			{
+				auto gx_p = gx.ptr<float>(y);
+				auto gy_p = gy.ptr<float>(y);
+				auto m_p = mag.ptr<float>(y);
+				for (int x = 0; x < cols; x++)
+				{
+					const float m = m_p[x];
+					if (m <= threshold) { continue; }
+					// gradients point from dark to bright, the dark center is behind them
+					const int px = x - int(round(n * gx_p[x] / m));
+					const int py = y - int(round(n * gy_p[x] / m));
+					if (px < 0 || py < 0 || px >= cols || py >= rows) { continue; }
+					orientation.at<float>(py, px) += 1.0f;
+					magnitude.at<float>(py, px) += m;
+				}
+			}
+
+			// normalization constants of the paper
+			const float k = n == 1 ? 8.0f : 9.9f;
+			cv::min(orientation, k, orientation);
+			cv::pow(orientation / k, opt.alpha, orientation);
+			cv::multiply(orientation, magnitude / k, s_n);
+			cv::GaussianBlur(s_n, s_n, cv::Size(0, 0), std::max(0.5f, 0.25f * n));
+			symmetry += s_n;
+		}
+
+		cv::Point max_point;
+		cv::minMaxLoc(symmetry, NULL, NULL, NULL, &max_point);
+		return cv::Point2f(s * (max_point.x + 0.5f) - 0.5f, s * (max_point.y + 0.5f) - 0.5f);
+	}
+
+	std::string name() const override { return "radial symmetry"; }
+};
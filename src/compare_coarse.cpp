@@ -0,0 +1,94 @@
+// compares the coarse detectors of coarse_detectors.h with the default stage 1 of Timm_two_stage:
+// time per frame, distance of the coarse estimate to the pupil, how often the pupil is still inside the
+// stage 2 window, and the final two stage error.
+//   compare_coarse [eye images..]
+// with images, the reference is the default two stage result. without arguments, synthetic eye images
+// with known pupil centers are used.
+
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <memory>
+
+#include "timm_two_stage.h"
+#include "helpers.h"
+
+#include <opencv2/imgcodecs.hpp>
+
+int main(int argc, char* argv[])
+{
+	using namespace std;
+	using clock = chrono::steady_clock;
+
+	vector<cv::Mat> images;
+	vector<cv::Point2f> reference;
+	for (int i = 1; i < argc; i++)
+	{
+		auto img = cv::imread(argv[i], cv::IMREAD_GRAYSCALE);
+		if (img.empty()) { cerr << "could not read " << argv[i] << "\n"; return 1; }
+		images.push_back(img);
+	}
+	const bool synthetic = images.empty();
+	if (synthetic)
+	{
+		mt19937 rng(42);
+		cv::Point c;
+		for (int i = 0; i < 200; i++)
+		{
+			images.push_back(synthetic_eye(rng, 640, 480, c));
+			reference.push_back(c);
+		}
+	}
+
+	Timm_two_stage timm;
+	timm.setup(Timm::default_simd_width());
+	timm.set_options(timm.opt);
+	const int window_width = timm.opt.window_width;
+
+	if (!synthetic)
+	{
+		for (auto& img : images)
+		{
+			cv::Mat frame = img.clone();
+			reference.push_back(get<0>(timm.pupil_center(frame)));
+		}
+	}
+
+	// nullptr = the default stage 1
+	vector<shared_ptr<Coarse_detector>> detectors = {
+		nullptr,
+		make_shared<Coarse_timm>(32),
+		make_shared<Coarse_timm>(24),
+		make_shared<Coarse_darkest_blob>(),
+		make_shared<Coarse_radial_symmetry>()
+	};
+
+	cout << setw(18) << "coarse detector" << setw(12) << "ms/frame" << setw(16) << "coarse err px" << setw(14) << "in window %" << setw(14) << "final err px" << "\n";
+	for (auto& d : detectors)
+	{
+		timm.coarse_detector = d;
+		double t_coarse = 0.0, err_coarse = 0.0, err_final = 0.0;
+		int n_inside = 0;
+		for (size_t i = 0; i < images.size(); i++)
+		{
+			cv::Mat frame = images[i].clone();
+
+			// the coarse stage alone
+			auto t0 = clock::now();
+			cv::Point2f coarse = d ? d->pupil_center(frame) : timm.stage1.pupil_center(frame);
+			t_coarse += chrono::duration<double, milli>(clock::now() - t0).count();
+
+			const float e = cv::norm(coarse - reference[i]);
+			err_coarse += e;
+			if (fabs(coarse.x - reference[i].x) < window_width && fabs(coarse.y - reference[i].y) < window_width) { n_inside++; }
+
+			cv::Point2f pos = get<0>(timm.pupil_center(frame));
+			err_final += cv::norm(pos - reference[i]);
+		}
+
+		const double n = images.size();
+		cout << setw(18) << (d ? d->name() : string("stage 1 (default)")) << setw(12) << t_coarse / n << setw(16) << err_coarse / n
+			<< setw(14) << 100.0 * n_inside / n << setw(14) << err_final / n << "\n";
+	}
+	return 0;
+}
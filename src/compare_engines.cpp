@@ -0,0 +1,252 @@
+// runs all implementations of the objective function on the same gradients and compares them with the
+// reference testPossibleCentersFormula (double precision): max and mean deviation of out_sum (relative to the
+// maximum of the reference), how often the argmax of the weighted objective agrees, and the speedup.
+//   compare_engines [-w max_simd_width] [eye images..]
+// without images, synthetic eye images of random sizes are used. max_simd_width (default 256) limits the x86
+// variants to what the CPU supports, e.g. -w 512 for AVX512.
+// compile with OPENCL_ENABLED to include the OpenCL kernel.
+// every engine has a tolerance for the max deviation and the argmax agreement (depending on its rsqrt precision) and
+// gets PASS or FAIL. returns 1 if an engine fails, so that changes of the engines can be gated on it.
+
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <functional>
+#include <map>
+#include <string>
+
+#ifdef OPENCL_ENABLED
+#include "timm_opencl.h"
+#else
+#include "timm.h"
+#endif
+#include "helpers.h"
+
+#include <opencv2/imgcodecs.hpp>
+
+// Timm with the steps of the objective function made accessible to the harness
+class Timm_engine_access : public Timm
+{
+public:
+	using Timm::gradient_x;
+	using Timm::gradient_y;
+	using Timm::weight_float;
+	using Timm::out_sum;
+	using Timm::pre_process;
+	using Timm::prepare_data;
+	using Timm::select_candidates;
+	using Timm::objective_center_major;
+	using Timm::objective_gradient_major;
+	using Timm::kernel_orig;
+	using Timm::testPossibleCentersFormula;
+};
+
+class Timm_engine_harness
+{
+public:
+	struct engine
+	{
+		std::string name;
+		std::function<void(Timm_engine_access&)> run; // fills timm.out_sum from the gradients of pre_process
+		double max_dev = 1e-3;                        // tolerance of the max deviation, relative to the reference maximum
+		double min_argmax_agree = 0.95;               // tolerance of the fraction of images with the same argmax
+	};
+
+	struct stats
+	{
+		double max_dev = 0.0;
+		double mean_dev = 0.0;
+		int n_argmax_agree = 0;
+		double ms = 0.0;
+	};
+
+	std::vector<engine> engines;
+	std::map<std::string, stats> results;
+	stats reference_stats;
+	int n_images = 0;
+
+	Timm_engine_access timm;
+	cv::Mat out_ref, ones;
+
+	Timm_engine_harness(int max_simd_width)
+	{
+		timm.n_threads = 1;
+		timm.opt.candidate_fraction = 1.0f;
+		timm.opt.candidate_min_weight = 0;
+
+		engines.push_back({ "kernel_orig", [](Timm_engine_access& t)
+		{
+			auto data = t.out_sum.ptr<float>(0);
+			for (int y = 0; y < t.out_sum.rows; y++)
+			{
+				for (int x = 0; x < t.out_sum.cols; x++) { data[y * t.out_sum.cols + x] = t.kernel_orig(x, y, t.gradient_x, t.gradient_y); }
+			}
+		} });
+
+		std::vector<enum_simd_variant> widths = { USE_NO_VEC };
+		for (auto w : { USE_VEC128, USE_VEC256, USE_VEC512 }) { if (w <= max_simd_width && Timm::simd_width_supported(w)) { widths.push_back(w); } }
+
+		const char* precision_names[] = { "estimate", "newton", "exact" };
+		for (auto w : widths)
+		{
+			for (int p : { RSQRT_ESTIMATE, RSQRT_NEWTON, RSQRT_EXACT })
+			{
+				for (int e : { ENGINE_CENTER_MAJOR, ENGINE_GRADIENT_MAJOR })
+				{
+					std::string name = std::string(e == ENGINE_CENTER_MAJOR ? "center " : "scatter ") + std::to_string(int(w)) + " " + precision_names[p];
+					engines.push_back({ name, [w, p, e](Timm_engine_access& t)
+					{
+						t.setup(w);
+						t.opt.rsqrt_precision = p;
+						t.prepare_data();
+						t.select_candidates();
+						if (e == ENGINE_CENTER_MAJOR) { t.objective_center_major(); }
+						else { t.objective_gradient_major(); }
+					} });
+					// the estimates have relative errors up to 3.9e-3 (see fast_sqrt.h), which enter the objective squared.
+					// the other precisions are close to float
+					if (p == RSQRT_ESTIMATE)
+					{
+						engines.back().max_dev = 2e-2;
+						engines.back().min_argmax_agree = 0.9;
+					}
+				}
+			}
+		}
+
+		#ifdef __TIMM_OPENCL__
+		kernel.opt.verbose = false;
+		kernel.setup();
+		engines.push_back({ "opencl", [this](Timm_engine_access& t)
+		{
+			kernel.compute(t.gradient_x, t.gradient_y, t.out_sum);
+		}, 1e-2, 0.9 }); // native_rsqrt
+		#endif
+	}
+
+	// down_scaling_width is the size of the center grid. widths that are not a multiple of the SIMD width test the tail handling
+	void run(const cv::Mat& img, int down_scaling_width)
+	{
+		using clock = std::chrono::steady_clock;
+		n_images++;
+
+		timm.setup(USE_NO_VEC);
+		timm.opt.down_scaling_width = down_scaling_width;
+		timm.pre_process(img);
+
+		// reference, unweighted like out_sum
+		out_ref = cv::Mat::zeros(timm.out_sum.rows, timm.out_sum.cols, CV_32F);
+		ones = cv::Mat(timm.out_sum.rows, timm.out_sum.cols, CV_8U, cv::Scalar(1));
+		auto t0 = clock::now();
+		for (int y = 0; y < timm.gradient_x.rows; y++)
+		{
+			auto gx_p = timm.gradient_x.ptr<float>(y);
+			auto gy_p = timm.gradient_y.ptr<float>(y);
+			for (int x = 0; x < timm.gradient_x.cols; x++)
+			{
+				if (gx_p[x] != 0.0f || gy_p[x] != 0.0f) { timm.testPossibleCentersFormula(x, y, ones, gx_p[x], gy_p[x], out_ref); }
+			}
+		}
+		reference_stats.ms += std::chrono::duration<double, std::milli>(clock::now() - t0).count();
+
+		double ref_max = 0.0;
+		cv::Point ref_argmax;
+		cv::minMaxLoc(out_ref, NULL, &ref_max);
+		cv::Mat weighted;
+		cv::multiply(out_ref, timm.weight_float, weighted);
+		cv::minMaxLoc(weighted, NULL, NULL, NULL, &ref_argmax);
+		ref_max = std::max(ref_max, 1e-20);
+
+		for (auto& e : engines)
+		{
+			timm.out_sum = 0.0f;
+			t0 = clock::now();
+			e.run(timm);
+			const double ms = std::chrono::duration<double, std::milli>(clock::now() - t0).count();
+
+			auto& st = results[e.name];
+			st.ms += ms;
+			cv::Mat diff = cv::abs(timm.out_sum - out_ref);
+			double max_diff = 0.0;
+			cv::minMaxLoc(diff, NULL, &max_diff);
+			st.max_dev = std::max(st.max_dev, max_diff / ref_max);
+			st.mean_dev += cv::mean(diff)[0] / ref_max;
+
+			cv::Point argmax;
+			cv::multiply(timm.out_sum, timm.weight_float, weighted);
+			cv::minMaxLoc(weighted, NULL, NULL, NULL, &argmax);
+			if (argmax == ref_argmax) { st.n_argmax_agree++; }
+		}
+	}
+
+	bool passed(const engine& e)
+	{
+		auto& st = results[e.name];
+		return st.max_dev <= e.max_dev && st.n_argmax_agree >= e.min_argmax_agree * n_images;
+	}
+
+	// returns the number of engines outside of their tolerances
+	int print(std::ostream& os = std::cout)
+	{
+		using namespace std;
+		os << "images: " << n_images << ", reference testPossibleCentersFormula: " << reference_stats.ms / n_images << " ms per image\n";
+		os << setw(26) << "engine" << setw(14) << "max dev" << setw(14) << "mean dev" << setw(14) << "argmax %" << setw(12) << "ms/image" << setw(10) << "speedup"
+			<< setw(24) << "limits (dev, argmax %)" << "\n";
+		int n_failed = 0;
+		for (auto& e : engines)
+		{
+			auto& st = results[e.name];
+			const bool ok = passed(e);
+			n_failed += !ok;
+			os << setw(26) << e.name << setw(14) << st.max_dev << setw(14) << st.mean_dev / n_images
+				<< setw(14) << 100.0 * st.n_argmax_agree / n_images << setw(12) << st.ms / n_images
+				<< setw(10) << reference_stats.ms / std::max(st.ms, 1e-9)
+				<< setw(12) << e.max_dev << setw(6) << 100.0 * e.min_argmax_agree << (ok ? "  PASS" : "  FAIL") << "\n";
+		}
+		return n_failed;
+	}
+
+private:
+	#ifdef __TIMM_OPENCL__
+	Opencl_kernel kernel;
+	#endif
+};
+
+int main(int argc, char* argv[])
+{
+	using namespace std;
+
+	int max_simd_width = USE_VEC256;
+	vector<cv::Mat> images;
+	for (int i = 1; i < argc; i++)
+	{
+		if (string(argv[i]) == "-w" && i + 1 < argc) { max_simd_width = atoi(argv[++i]); continue; }
+		auto img = cv::imread(argv[i], cv::IMREAD_GRAYSCALE);
+		if (img.empty()) { cerr << "could not read " << argv[i] << "\n"; return 1; }
+		images.push_back(img);
+	}
+	// recorded images run at the default width, synthetic ones at random widths
+	vector<int> widths(images.size(), Timm().opt.down_scaling_width);
+	if (images.empty())
+	{
+		mt19937 rng(7);
+		uniform_int_distribution<int> uw(60, 400), ud(30, 120);
+		cv::Point c;
+		for (int i = 0; i < 30; i++)
+		{
+			const int w = uw(rng);
+			images.push_back(synthetic_eye(rng, w, w * 3 / 4, c));
+			widths.push_back(ud(rng));
+		}
+	}
+
+	Timm_engine_harness harness(max_simd_width);
+	for (size_t i = 0; i < images.size(); i++) { harness.run(images[i], widths[i]); }
+	const int n_failed = harness.print();
+	cout << (n_failed ? to_string(n_failed) + " engines FAILED\n" : string("all engines passed\n"));
+	return n_failed ? 1 : 0;
+}
+
+#ifdef OPENCL_ENABLED
+#include "opencl_kernel.cpp"
+#endif
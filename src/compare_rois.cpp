@@ -0,0 +1,114 @@
+// compares Timm_two_stage::pupil_centers (shared stage 1 gradients, rois in parallel) with pupil_center on every crop,
+// on synthetic binocular frames: two eye images side by side, like the eyes cropped from a face camera.
+//   compare_rois [-frames n] [-size w h] [-size2 w h] [-gap px] [-simd n]
+//     -size   size of the first eye roi (default 320 x 240)
+//     -size2  size of the second eye roi in the second run (default 3/4 of -size)
+//     -gap    pixels between the two rois, negative values overlap them (default 0)
+//     -simd   default: the widest CPU variant of this build up to 256
+// runs twice: with two rois of the same size (one shared gradient field), and with rois of different widths
+// (one field per width). reports the time per frame of both paths and the pixel error against the known pupil centers.
+
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <random>
+
+#include "timm_two_stage.h"
+#include "helpers.h"
+
+// one run over n_frames frames with the rois w x h and w2 x h2
+void compare(Timm_two_stage& timm, int n_frames, int w, int h, int w2, int h2, int gap)
+{
+	using namespace std;
+	using clock = chrono::steady_clock;
+
+	gap = max(gap, -min(w, w2) / 2);
+
+	// the frame has a margin around both rois
+	const int margin = 20;
+	const vector<cv::Rect> rois = { cv::Rect(margin, margin, w, h), cv::Rect(margin + w + gap, margin, w2, h2) };
+	mt19937 rng(7);
+	vector<cv::Mat> frames;
+	vector<array<cv::Point2f, 2>> truth;
+	for (int i = 0; i < n_frames; i++)
+	{
+		cv::Mat frame(max(h, h2) + 2 * margin, w + w2 + gap + 2 * margin, CV_8U, cv::Scalar(180));
+		array<cv::Point2f, 2> t;
+		// the second eye is drawn last, so with overlapping rois the first one loses a part of its image
+		for (int e = 0; e < 2; e++)
+		{
+			cv::Point c;
+			cv::Mat dst = frame(rois[e]);
+			synthetic_eye(rng, rois[e].width, rois[e].height, c).copyTo(dst);
+			t[e] = cv::Point2f(c + rois[e].tl());
+		}
+		frames.push_back(frame);
+		truth.push_back(t);
+	}
+
+	vector<float> time_crops, time_shared, error_crops, error_shared;
+	vector<Timm_two_stage::roi_result> results;
+	for (int i = 0; i < n_frames; i++)
+	{
+		// both paths blur in place, so each gets its own copy
+		cv::Mat frame = frames[i].clone();
+		auto t0 = clock::now();
+		for (int e = 0; e < 2; e++)
+		{
+			cv::Mat crop = frame(rois[e]);
+			cv::Point2f p = get<0>(timm.pupil_center(crop)) + cv::Point2f(rois[e].tl());
+			error_crops.push_back(cv::norm(p - truth[i][e]));
+		}
+		auto t1 = clock::now();
+
+		frame = frames[i].clone();
+		auto t2 = clock::now();
+		timm.pupil_centers(frame, rois, results);
+		auto t3 = clock::now();
+		for (int e = 0; e < 2; e++) { error_shared.push_back(cv::norm(results[e].pupil_pos - truth[i][e])); }
+
+		time_crops.push_back(chrono::duration<float, milli>(t1 - t0).count());
+		time_shared.push_back(chrono::duration<float, milli>(t3 - t2).count());
+	}
+
+	auto print = [&](const string& name, vector<float>& t, vector<float>& e)
+	{
+		cout << left << setw(28) << name << right << fixed << setprecision(3) << "time median " << percentile(t, 0.5f) << " ms, 95% "
+			<< percentile(t, 0.95f) << " ms | error median " << percentile(e, 0.5f) << " px, 95% " << percentile(e, 0.95f) << " px\n";
+	};
+	cout << n_frames << " frames, rois of " << w << " x " << h << " and " << w2 << " x " << h2 << ", gap " << gap << " px, "
+		<< thread::hardware_concurrency() << " hardware threads\n";
+	print("pupil_center per crop", time_crops, error_crops);
+	print("pupil_centers (shared)", time_shared, error_shared);
+}
+
+int main(int argc, char* argv[])
+{
+	using namespace std;
+
+	int n_frames = 200, w = 320, h = 240, w2 = 0, h2 = 0, gap = 0, simd = Timm::default_simd_width();
+	for (int i = 1; i < argc; i++)
+	{
+		string a = argv[i];
+		if (a == "-frames" && i + 1 < argc) { n_frames = max(1, atoi(argv[++i])); }
+		else if (a == "-size" && i + 2 < argc) { w = atoi(argv[i + 1]); h = atoi(argv[i + 2]); i += 2; }
+		else if (a == "-size2" && i + 2 < argc) { w2 = atoi(argv[i + 1]); h2 = atoi(argv[i + 2]); i += 2; }
+		else if (a == "-gap" && i + 1 < argc) { gap = atoi(argv[++i]); }
+		else if (a == "-simd" && i + 1 < argc) { simd = atoi(argv[++i]); }
+		else { cerr << "unknown argument " << a << "\n"; return 1; }
+	}
+	if (w2 <= 0 || h2 <= 0) { w2 = 3 * w / 4; h2 = 3 * h / 4; }
+
+	Timm_two_stage timm;
+	timm.setup(enum_simd_variant(simd));
+	timm.set_options(timm.opt);
+
+	compare(timm, n_frames, w, h, w, h, gap);
+	cout << "\n";
+	compare(timm, n_frames, w, h, w2, h2, gap);
+	return 0;
+}
+
+#ifdef OPENCL_ENABLED
+#include "opencl_kernel.cpp"
+#endif
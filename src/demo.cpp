@@ -5,6 +5,7 @@
 // #define OPENCL_ENABLED
 
 #include "timm_two_stage.h"
+#include "load_shedder.h"
 
 void main()
 {
@@ -16,9 +17,13 @@ void main()
 	PRINT_MENU:
 	cout << "\n=== Menu Vectorization Level ===\n";
 	cout << "[0] no vectorization\n";
-	#ifdef _WIN32
+	#ifdef TIMM_X86_VEC128
 	cout << "[1] 128bit SSE OR ARM NEON\n";
+	#endif
+	#ifdef TIMM_X86_VEC256
 	cout << "[2] 256bit AVX2 (default - works on most modern CPUs)\n";
+	#endif
+	#ifdef TIMM_X86_VEC512
 	cout << "[3] 512bit AVX512 (Xeon, Core-X CPUs)\n";
 	#endif
 	#ifdef __arm__
@@ -26,20 +31,33 @@ void main()
 	#endif
 	#ifdef OPENCL_ENABLED
 	cout << "[4] OpenCL\n";
+	cout << "[5] OpenCL, including pre- and post-processing\n";
+	cout << "[6] OpenCL and AVX2 combined\n";
 	#endif
 	cout << "enter selection:\n";
 		
 	int sel = 0; cin >> sel;
+	enum_simd_variant simd = USE_NO_VEC;
 	switch (sel)
 	{
-	case 0: timm.setup(USE_NO_VEC); break;
-	case 1: timm.setup(USE_VEC128); break;
-	case 2: timm.setup(USE_VEC256); break;
-	case 3: timm.setup(USE_VEC512); break;
-	case 4: timm.setup(USE_OPENCL); break;
+	case 0: simd = USE_NO_VEC; break;
+	case 1: simd = USE_VEC128; break;
+	case 2: simd = USE_VEC256; break;
+	case 3: simd = USE_VEC512; break;
+	case 4: simd = USE_OPENCL; break;
+	case 5: simd = USE_OPENCL_FULL; break;
+	case 6: simd = USE_OPENCL_HYBRID; break;
 	default: cerr << "wrong input. please try again:" << endl; goto PRINT_MENU;
 	}
 
+	// the menu only lists the variants of this build, but any number can be typed
+	#ifndef OPENCL_ENABLED
+	if (simd >= USE_OPENCL) { cerr << "this build has no OpenCL support. please try again:" << endl; goto PRINT_MENU; }
+	#endif
+	if (simd < USE_OPENCL && !Timm::simd_width_supported(simd)) { cerr << "this build has no kernels for this variant. please try again:" << endl; goto PRINT_MENU; }
+	try { timm.setup(simd); }
+	catch (const std::exception& e) { cerr << e.what() << ". please try again:" << endl; goto PRINT_MENU; }
+
 	// select camera
 	shared_ptr<cv::VideoCapture> capture;
 	while (true)
@@ -52,6 +70,22 @@ void main()
 		cerr << "\ncould not open and initialize camera nr. " << cam_nr << ". please try again!\n";
 	}
 
+	// optional: Load_shedder holds a frame rate when the host is busy, by lowering the resolution and window, skipping
+	// stage 1 and dropping frames (level changes are printed). off by default, so that the demo shows the real output
+	// and speed of the detector
+	const float camera_fps = capture->get(cv::CAP_PROP_FPS) > 0 ? float(capture->get(cv::CAP_PROP_FPS)) : 30.0f;
+	cout << "\ntarget frame rate for load shedding (0 = off, camera: " << camera_fps << " fps):";
+	float target_fps = 0.0f;
+	if (!(cin >> target_fps)) { target_fps = 0.0f; }
+	unique_ptr<Load_shedder> shedder;
+	if (target_fps > 0.0f)
+	{
+		Load_shedder::options shed_opt;
+		shed_opt.target_fps = target_fps;
+		shedder = make_unique<Load_shedder>(timm, shed_opt);
+		shedder->log = &cout;
+	}
+
 	cv::Mat frame, frame_gray;
 	cv::Point2f pupil_pos, pupil_pos_coarse;
 	while (true)
@@ -63,7 +97,13 @@ void main()
 			// calc pupil center
 			cv::cvtColor(frame, frame_gray, cv::COLOR_BGR2GRAY);
 
-			std::tie(pupil_pos, pupil_pos_coarse) = timm.pupil_center(frame_gray);
+			if (shedder)
+			{
+				auto r = shedder->process(frame_gray);
+				pupil_pos = r.pupil_pos;
+				pupil_pos_coarse = r.pupil_pos_coarse;
+			}
+			else { std::tie(pupil_pos, pupil_pos_coarse) = timm.pupil_center(frame_gray); }
 
 			timm.visualize_frame(frame, pupil_pos, pupil_pos_coarse);
 			cv::imshow("eye_cam", frame);
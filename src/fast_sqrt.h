@@ -1,5 +1,33 @@
 #pragma once
 
+#include <cstdint>
+#include <cmath>
+
+#ifdef _WIN32
+#include <immintrin.h>
+#else
+	#if defined(__arm__) || defined(__aarch64__)
+	#include <arm_neon.h>
+	#else
+	#include <x86intrin.h>
+	#endif
+#endif
+
+// instruction sets available for the vectorized versions below. MSVC has no feature macros, there all x86 variants are compiled
+// (like the SIMD kernels of Timm), the CPU check is left to the caller
+#if defined(_WIN32) || defined(__SSE__)
+#define FAST_SQRT_SSE
+#endif
+#if defined(_WIN32) || defined(__AVX__)
+#define FAST_SQRT_AVX
+#endif
+#if defined(_WIN32) || defined(__AVX512F__)
+#define FAST_SQRT_AVX512
+#endif
+#if defined(__arm__) || defined(__aarch64__)
+#define FAST_SQRT_NEON
+#endif
+
 // https://en.wikipedia.org/wiki/Fast_inverse_square_root
 // but slower than using dedicated SSE instructions
 inline float fast_inverse_sqrt_quake(float number)
@@ -19,7 +47,7 @@ inline float fast_inverse_sqrt_quake(float number)
 	return conv.f;
 }
 
-// this might be even faster if the value to be normalizes is close to one 
+// this might be even faster if the value to be normalizes is close to one
 // http://allenchou.net/2014/02/game-math-fast-re-normalization-of-unit-vectors/
 inline float fast_inverse_sqrt_around_one(float x)
 {
@@ -30,29 +58,115 @@ inline float fast_inverse_sqrt_around_one(float x)
 	return a0 + a1 * x + a2 * x * x;
 }
 
-#ifdef _WIN32
-#include <immintrin.h>
-// this is the fastest way, using SSE instructions !
-// this incorporates also the necessary multiplication for vector normalization 
-inline void fast_inverse_sqrt(float*  pOut, float* pIn)
+
+/////////////////////// reciprocal square root with selectable precision ///////////////////////
+// fast_rsqrt<precision>(x) for float, __m128 (SSE), __m256 (AVX), __m512 (AVX512) and float32x4_t (NEON).
+//
+// maximum relative error over [1, 4) (one period of the mantissa, so this holds for all positive normal floats).
+// x86 values measured on an AVX512 CPU, the intel bound for rsqrtps is 1.5 * 2^-12 = 3.7e-4. NEON values from the ARM documentation:
+//                      RSQRT_ESTIMATE   RSQRT_NEWTON    RSQRT_EXACT
+//   SSE / AVX          3.3e-4           2.7e-7          9e-8
+//   AVX512 (rsqrt14)   6.0e-5           1.3e-7          9e-8
+//   NEON (vrsqrte)     3.9e-3 (2^-8)    2.3e-5          ARMv8: 9e-8, ARMv7 (two Newton steps): 3e-7
+//   scalar             like SSE or NEON. without either: 1.75e-3 (quake, includes one Newton step)
+//
+// for x = 0, RSQRT_ESTIMATE and RSQRT_EXACT return +inf, RSQRT_NEWTON (and RSQRT_EXACT on ARMv7) returns NaN. the quake
+// fallback of the scalar version is the exception: RSQRT_ESTIMATE and RSQRT_NEWTON return a large finite value (3e19, 4.5e19).
+// callers that multiply with a zero vector afterwards get NaN (quake: 0) and have to clamp x (like the scatter kernels) or the
+// result (like the max(0, ..) of the center-major kernels).
+enum enum_rsqrt_precision
+{
+	RSQRT_DEFAULT = -1, // per kernel: RSQRT_EXACT for the scalar kernels (USE_NO_VEC), RSQRT_ESTIMATE for the vectorized ones
+	RSQRT_ESTIMATE = 0, // hardware estimate only
+	RSQRT_NEWTON = 1,   // estimate and one Newton-Raphson step y' = y * (1.5 - 0.5 * x * y * y)
+	RSQRT_EXACT = 2     // square root and division
+};
+
+template<int precision> inline float fast_rsqrt(float x)
+{
+	if (precision == RSQRT_EXACT) { return 1.0f / std::sqrt(x); }
+
+	float y;
+	#if defined(FAST_SQRT_SSE)
+	y = _mm_cvtss_f32(_mm_rsqrt_ss(_mm_set_ss(x)));
+	#elif defined(FAST_SQRT_NEON)
+	y = vget_lane_f32(vrsqrte_f32(vdup_n_f32(x)), 0);
+	#else
+	// the quake variant already includes one Newton step
+	y = fast_inverse_sqrt_quake(x);
+	if (precision == RSQRT_ESTIMATE) { return y; }
+	#endif
+
+	if (precision == RSQRT_NEWTON) { y = y * (1.5f - 0.5f * x * y * y); }
+	return y;
+}
+
+#ifdef FAST_SQRT_SSE
+template<int precision> inline __m128 fast_rsqrt(__m128 x)
 {
-	__m128 in = _mm_load_ss(pIn);
-	_mm_store_ss(pOut, _mm_rsqrt_ss(in));
+	if (precision == RSQRT_EXACT) { return _mm_div_ps(_mm_set1_ps(1.0f), _mm_sqrt_ps(x)); }
+
+	__m128 y = _mm_rsqrt_ps(x);
+	if (precision == RSQRT_NEWTON)
+	{
+		// y * 0.5 * (3 - x * y * y)
+		const __m128 xyy = _mm_mul_ps(_mm_mul_ps(x, y), y);
+		y = _mm_mul_ps(_mm_mul_ps(_mm_set1_ps(0.5f), y), _mm_sub_ps(_mm_set1_ps(3.0f), xyy));
+	}
+	return y;
 }
 #endif
 
-#ifdef __arm__
-inline void fast_inverse_sqrt(float*  pOut, float* pIn)
+#ifdef FAST_SQRT_AVX
+template<int precision> inline __m256 fast_rsqrt(__m256 x)
+{
+	if (precision == RSQRT_EXACT) { return _mm256_div_ps(_mm256_set1_ps(1.0f), _mm256_sqrt_ps(x)); }
+
+	__m256 y = _mm256_rsqrt_ps(x);
+	if (precision == RSQRT_NEWTON)
+	{
+		const __m256 xyy = _mm256_mul_ps(_mm256_mul_ps(x, y), y);
+		y = _mm256_mul_ps(_mm256_mul_ps(_mm256_set1_ps(0.5f), y), _mm256_sub_ps(_mm256_set1_ps(3.0f), xyy));
+	}
+	return y;
+}
+#endif
+
+#ifdef FAST_SQRT_AVX512
+template<int precision> inline __m512 fast_rsqrt(__m512 x)
+{
+	if (precision == RSQRT_EXACT) { return _mm512_div_ps(_mm512_set1_ps(1.0f), _mm512_sqrt_ps(x)); }
+
+	__m512 y = _mm512_rsqrt14_ps(x);
+	if (precision == RSQRT_NEWTON)
+	{
+		const __m512 xyy = _mm512_mul_ps(_mm512_mul_ps(x, y), y);
+		y = _mm512_mul_ps(_mm512_mul_ps(_mm512_set1_ps(0.5f), y), _mm512_sub_ps(_mm512_set1_ps(3.0f), xyy));
+	}
+	return y;
+}
+#endif
+
+#ifdef FAST_SQRT_NEON
+template<int precision> inline float32x4_t fast_rsqrt(float32x4_t x)
 {
-	//__m128 in = _mm_load_ss(pIn);
-	//_mm_store_ss(pOut, _mm_rsqrt_ss(in));
-	*pOut = sqrt(*pIn);
-/* todo !
-float32x2_t vrecps_f32(float32x2_t a, float32x2_t b);   // VRECPS.F32 d0, d0, d0 
-float32x4_t vrecpsq_f32(float32x4_t a, float32x4_t b);  // VRECPS.F32 q0, q0, q0 
-float32x2_t vrsqrts_f32(float32x2_t a, float32x2_t b);  // VRSQRTS.F32 d0, d0, d0
-float32x4_t vrsqrtsq_f32(float32x4_t a, float32x4_t b); // VRSQRTS.F32 q0, q0, q0
-*/
+	float32x4_t y = vrsqrteq_f32(x);
+	#ifdef __aarch64__
+	if (precision == RSQRT_EXACT) { return vdivq_f32(vdupq_n_f32(1.0f), vsqrtq_f32(x)); }
+	#else
+	// ARMv7 NEON has no vector square root and division
+	if (precision == RSQRT_EXACT) { y = vmulq_f32(y, vrsqrtsq_f32(vmulq_f32(x, y), y)); }
+	#endif
+
+	// vrsqrts(a, b) = (3 - a * b) / 2
+	if (precision != RSQRT_ESTIMATE) { y = vmulq_f32(y, vrsqrtsq_f32(vmulq_f32(x, y), y)); }
+	return y;
 }
+#endif
 
-#endif
\ No newline at end of file
+// this is the fastest way, using SSE instructions !
+// this incorporates also the necessary multiplication for vector normalization
+inline void fast_inverse_sqrt(float*  pOut, float* pIn)
+{
+	*pOut = fast_rsqrt<RSQRT_ESTIMATE>(*pIn);
+}
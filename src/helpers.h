@@ -0,0 +1,55 @@
+#pragma once
+
+#include <opencv2/imgproc.hpp>
+
+#include <random>
+#include <vector>
+#include <algorithm>
+
+// clip value x to range min..max
+template<class T> inline T clip(T x, const T& min, const T& max)
+{
+	if (x < min)x = min;
+	if (x > max)x = max;
+	return x;
+}
+
+// p-th percentile (0..1) of values. reorders values
+inline float percentile(std::vector<float>& values, float p)
+{
+	if (values.empty()) { return 0.0f; }
+	const size_t i = std::min(values.size() - 1, size_t(p * values.size()));
+	std::nth_element(values.begin(), values.begin() + i, values.end());
+	return values[i];
+}
+
+// fit a rectangle with center c and half-width w into a given image
+inline cv::Rect fit_rectangle(const cv::Mat& frame, cv::Point2f c, int w)
+{
+	int w2 = w; // half width of windows
+	w2 = clip<int>(w2, 0, round(0.5f*frame.cols));
+	w2 = clip<int>(w2, 0, round(0.5f*frame.rows));
+
+	int x = c.x; x = clip<int>(x, w2, frame.cols - w2);
+	int y = c.y; y = clip<int>(y, w2, frame.rows - w2);
+	return cv::Rect(x - w2, y - w2, 2 * w2, 2 * w2);
+}
+
+// synthetic eye image for tests and benchmarks: dark pupil in a darker iris on a noisy, bright background
+inline cv::Mat synthetic_eye(std::mt19937& rng, int w, int h, cv::Point& center)
+{
+	std::uniform_int_distribution<int> ux(w / 4, 3 * w / 4), uy(h / 4, 3 * h / 4), ur(w / 20, w / 8);
+	cv::Mat img(h, w, CV_8U, cv::Scalar(180));
+	center = cv::Point(ux(rng), uy(rng));
+	const int r = ur(rng);
+	cv::circle(img, center, 3 * r, cv::Scalar(120), -1); // iris
+	cv::circle(img, center, r, cv::Scalar(20), -1);      // pupil
+
+	std::normal_distribution<float> noise(0.0f, 6.0f);
+	for (int y = 0; y < h; y++)
+	{
+		auto p = img.ptr<uchar>(y);
+		for (int x = 0; x < w; x++) { p[x] = cv::saturate_cast<uchar>(p[x] + noise(rng)); }
+	}
+	return img;
+}
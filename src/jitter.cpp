@@ -0,0 +1,177 @@
+// latency jitter of the real-time path with and without core pinning (see affinity.h).
+// runs Timm_two_stage on synthetic eye images at a fixed frame rate, first with floating threads, then pinned:
+//   jitter [-cpus list] [-fifo prio] [-frames n] [-fps f] [-size w h] [-threads n] [-simd n] [-load n]
+//     -cpus     cpus of the pinned run, e.g. 2-3 or 2,6. the detector thread runs on the first one, the objective function
+//               threads (-threads > 1) on the others (default: the last available cpu)
+//     -fifo     additionally run pinned with SCHED_FIFO of this priority (needs CAP_SYS_NICE or an rtprio limit)
+//     -frames   frames per run (default 2000)
+//     -fps      frame rate, 0 = back to back (default 250)
+//     -size     image size (default 320 x 240)
+//     -threads  threads of the objective function per stage (default 1)
+//     -simd     simd width (default: the widest CPU variant of this build up to 256)
+//     -load     threads that keep all cpus busy during the runs, to provoke migrations (default 0)
+// reports the computation time per frame and the start delay (how late the detector thread wakes up for a frame):
+// median, 99%, 99.9% and max, and the jitter (99% - median).
+
+#include <iostream>
+#include <iomanip>
+#include <thread>
+#include <vector>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <random>
+
+#include "timm_two_stage.h"
+#include "affinity.h"
+#include "helpers.h"
+
+using clock_type = std::chrono::steady_clock;
+
+struct run_config
+{
+	std::string name;
+	std::vector<int> cpus; // empty: not pinned
+	int realtime_priority = 0;
+};
+
+struct run_result
+{
+	std::vector<float> compute_us;
+	std::vector<float> delay_us;
+	bool pinned = true;   // pinning and priority were granted
+};
+
+run_result run(const run_config& c, std::vector<cv::Mat>& frames, int n_frames, float fps, enum_simd_variant simd, int n_threads)
+{
+	run_result rr;
+	rr.compute_us.reserve(n_frames);
+	rr.delay_us.reserve(n_frames);
+
+	// the detector is created and first used on the measured thread, so its buffers are allocated on its node
+	std::thread t([&]()
+	{
+		if (!c.cpus.empty()) { rr.pinned = pin_current_thread(c.cpus[0]); }
+		if (c.realtime_priority > 0) { rr.pinned = set_realtime_priority(c.realtime_priority) && rr.pinned; }
+
+		Timm_two_stage timm;
+		timm.setup(simd);
+		Timm_two_stage::options o;
+		o.stage1.down_scaling_width = 85;
+		o.stage2.down_scaling_width = 100;
+		timm.set_options(o);
+		for (Timm* stage : { (Timm*)&timm.stage1, (Timm*)&timm.stage2 })
+		{
+			stage->n_threads = n_threads;
+			// the objective function threads run on the remaining cpus, or all on the first if there are none
+			if (c.cpus.size() > 1) { stage->affinity.cpus.assign(c.cpus.begin() + 1, c.cpus.end()); }
+			else { stage->affinity.cpus = c.cpus; }
+			stage->affinity.realtime_priority = c.realtime_priority;
+		}
+
+		// warm up: allocation of all buffers
+		for (int i = 0; i < 20; i++) { timm.pupil_center(frames[i % frames.size()]); }
+
+		const auto period = std::chrono::nanoseconds(fps > 0 ? int64_t(1e9 / fps) : 0);
+		auto t_next = clock_type::now();
+		for (int i = 0; i < n_frames; i++)
+		{
+			if (fps > 0)
+			{
+				// sleep most of the period, spin the rest, so the wake up latency of the scheduler shows up in the delay
+				std::this_thread::sleep_until(t_next - std::chrono::microseconds(200));
+				while (clock_type::now() < t_next) {}
+			}
+			auto t0 = clock_type::now();
+			timm.pupil_center(frames[i % frames.size()]);
+			auto t1 = clock_type::now();
+			rr.compute_us.push_back(std::chrono::duration<float, std::micro>(t1 - t0).count());
+			rr.delay_us.push_back(fps > 0 ? std::chrono::duration<float, std::micro>(t0 - t_next).count() : 0.0f);
+			t_next += period;
+			if (fps > 0 && t_next < t1) { t_next = t1; } // overload: do not try to catch up
+		}
+	});
+	t.join();
+	return rr;
+}
+
+void print_row(const std::string& what, std::vector<float>& v)
+{
+	using namespace std;
+	const float p50 = percentile(v, 0.5f), p99 = percentile(v, 0.99f);
+	cout << "  " << left << setw(10) << what << right << fixed << setprecision(1)
+		<< setw(10) << p50 << setw(10) << p99 << setw(10) << percentile(v, 0.999f) << setw(10) << percentile(v, 1.0f)
+		<< setw(10) << p99 - p50 << "\n";
+}
+
+int main(int argc, char* argv[])
+{
+	using namespace std;
+
+	vector<int> cpus;
+	int fifo = 0, n_frames = 2000, w = 320, h = 240, n_threads = 1, simd = Timm::default_simd_width(), n_load = 0;
+	float fps = 250.0f;
+	for (int i = 1; i < argc; i++)
+	{
+		string a = argv[i];
+		if (a == "-cpus" && i + 1 < argc) { cpus = parse_cpu_list(argv[++i]); }
+		else if (a == "-fifo" && i + 1 < argc) { fifo = atoi(argv[++i]); }
+		else if (a == "-frames" && i + 1 < argc) { n_frames = max(1, atoi(argv[++i])); }
+		else if (a == "-fps" && i + 1 < argc) { fps = float(atof(argv[++i])); }
+		else if (a == "-size" && i + 2 < argc) { w = atoi(argv[i + 1]); h = atoi(argv[i + 2]); i += 2; }
+		else if (a == "-threads" && i + 1 < argc) { n_threads = max(1, atoi(argv[++i])); }
+		else if (a == "-simd" && i + 1 < argc) { simd = atoi(argv[++i]); }
+		else if (a == "-load" && i + 1 < argc) { n_load = atoi(argv[++i]); }
+		else { cerr << "unknown argument " << a << "\n"; return 1; }
+	}
+	if (simd >= USE_OPENCL) { cerr << "jitter measures the CPU variants only\n"; return 1; }
+
+	const auto available = available_cpus();
+	if (cpus.empty() && !available.empty()) { cpus = { available.back() }; }
+
+	std::mt19937 rng(1);
+	vector<cv::Mat> frames;
+	for (int i = 0; i < 16; i++)
+	{
+		cv::Point c;
+		frames.push_back(synthetic_eye(rng, w, h, c));
+	}
+
+	atomic<bool> stop_load{ false };
+	vector<thread> load;
+	for (int i = 0; i < n_load; i++)
+	{
+		load.emplace_back([&]()
+		{
+			volatile double x = 1.0;
+			while (!stop_load) { for (int k = 0; k < 10000; k++) { x = x * 1.0000001 + 1e-9; } }
+		});
+	}
+
+	vector<run_config> configs = { { "floating", {}, 0 } };
+	if (!cpus.empty())
+	{
+		configs.push_back({ "pinned to " + to_string(cpus[0]), cpus, 0 });
+		if (fifo > 0) { configs.push_back({ "pinned, SCHED_FIFO " + to_string(fifo), cpus, fifo }); }
+	}
+	else { cerr << "no cpus to pin to (none given, and the available cpus are unknown), only the floating run is measured\n"; }
+
+	cout << n_frames << " frames of " << w << " x " << h << " at " << (fps > 0 ? to_string(int(fps)) + " fps" : string("full speed"))
+		<< ", " << n_threads << " objective threads per stage, " << n_load << " load threads, " << available.size() << " cpus available\n";
+	for (auto& c : configs)
+	{
+		auto rr = run(c, frames, n_frames, fps, enum_simd_variant(simd), n_threads);
+		cout << c.name << (rr.pinned ? "" : " (NOT granted, running unpinned / with normal priority)") << "\n";
+		cout << "  [us]          median       99%     99.9%       max    jitter\n";
+		print_row("compute", rr.compute_us);
+		if (fps > 0) { print_row("delay", rr.delay_us); }
+	}
+
+	stop_load = true;
+	for (auto& t : load) { t.join(); }
+	return 0;
+}
+
+#ifdef OPENCL_ENABLED
+#include "opencl_kernel.cpp"
+#endif
@@ -0,0 +1,269 @@
+#pragma once
+
+#include "timm_two_stage.h"
+#include "coarse_detectors.h"
+
+#include <array>
+#include <vector>
+#include <string>
+#include <memory>
+#include <chrono>
+#include <iostream>
+
+// quality levels of Load_shedder, every level includes the degradations of the levels before it
+enum enum_shed_level
+{
+	SHED_NONE = 0,        // the options the detector was configured with
+	SHED_RESOLUTION = 1,  // smaller down_scaling_width of both stages
+	SHED_WINDOW = 2,      // smaller window of stage 2
+	SHED_COARSE_GRID = 3, // stage 1 on a coarse grid ("tiny Timm", see Coarse_timm) and candidate pruning in stage 2
+	SHED_TRACKING = 4,    // stage 1 is skipped while the pupil is tracked: stage 2 runs around the last estimate
+	SHED_DROP = 5,        // only every drop_interval-th frame is processed, the others return the last estimate
+	SHED_N_LEVELS = 6
+};
+
+inline const char* shed_level_name(int level)
+{
+	static const char* names[SHED_N_LEVELS] = { "full", "resolution", "window", "coarse grid", "tracking", "drop frames" };
+	return level >= 0 && level < SHED_N_LEVELS ? names[level] : "?";
+}
+
+// holds a live loop of Timm_two_stage on a target frame rate when the host is overloaded.
+//
+// the latency of every processed frame is smoothed (exponential moving average). if it stays above the budget
+// (budget_fraction of the frame period) for degrade_after frames, the next quality level is applied (see enum_shed_level).
+// going back up needs an estimate of the cost of the better level: when a level has settled, the ratio of the latency
+// before the degradation to the latency after it is stored, and a level is restored when the current latency times that
+// ratio stays below restore_fraction of the budget for restore_after frames.
+//
+// every level change is kept in history() and written to log (if set), so the quality loss of a session can be audited.
+class Load_shedder
+{
+public:
+	struct options
+	{
+		float target_fps = 60.0f;
+		float budget_fraction = 0.85f;   // of the frame period, the rest is left for capture and display
+		float ewma_alpha = 0.2f;         // smoothing of the latency
+		int settle_frames = 5;           // after a level change, no further change for this many processed frames
+		int degrade_after = 3;           // processed frames above the budget before degrading
+		int restore_after = 60;          // processed frames with headroom before restoring
+		float restore_fraction = 0.8f;   // headroom: predicted latency of the better level below this fraction of the budget
+		int max_level = SHED_DROP;
+
+		// SHED_RESOLUTION and SHED_WINDOW
+		float resolution_factor = 0.7f;  // of both down_scaling_widths
+		int min_down_scaling_width = 32;
+		float window_factor = 0.7f;      // of window_width
+		// SHED_COARSE_GRID
+		int coarse_grid_width = 32;      // down_scaling_width of stage 1
+		float candidate_fraction = 0.3f; // stage 2 evaluates the darkest centers only, see Timm::options
+		// SHED_TRACKING: stage 1 runs anyway if the last confidence of stage 2 is lower or after redetect_interval frames
+		float tracking_min_confidence = 0.1f;
+		int redetect_interval = 30;
+		// SHED_DROP
+		int drop_interval = 2;
+	};
+
+	struct result
+	{
+		cv::Point2f pupil_pos;
+		cv::Point2f pupil_pos_coarse;
+		int level = SHED_NONE;         // applied to this frame
+		bool processed = true;         // false: dropped, the position is the last estimate
+		bool stage1_skipped = false;
+		float latency_ms = 0.0f;       // of pupil_center, 0 if dropped
+	};
+
+	struct decision
+	{
+		uint64_t frame = 0;
+		int from = SHED_NONE;
+		int to = SHED_NONE;
+		float latency_ms = 0.0f;       // smoothed latency that triggered the decision
+		float predicted_ms = 0.0f;     // restore: predicted latency of the better level
+		float budget_ms = 0.0f;
+	};
+
+	// writes the decisions, if set
+	std::ostream* log = nullptr;
+
+	// the current options (and coarse_detector) of timm are the full quality level. timm must outlive the Load_shedder,
+	// which restores them when it is destroyed
+	Load_shedder(Timm_two_stage& timm, options o) : timm(timm), opt(o), base(timm.opt), base_coarse(timm.coarse_detector),
+		tracker(std::make_shared<Coarse_position>())
+	{
+		// nominal cost ratios until a level has been measured
+		cost_ratio.fill(1.0f / 0.7f);
+		cost_ratio[SHED_DROP] = 1.0f; // the latency of a processed frame does not change
+		n_frames_at_level.fill(0);
+		opt.max_level = clip<int>(opt.max_level, SHED_NONE, SHED_DROP);
+	}
+
+	~Load_shedder() { apply(SHED_NONE); }
+
+	Load_shedder(const Load_shedder&) = delete;
+	Load_shedder& operator=(const Load_shedder&) = delete;
+
+	// replaces Timm_two_stage::pupil_center in the live loop
+	result process(cv::Mat& frame_gray, uint64_t capture_timestamp_ns = 0)
+	{
+		using clock = std::chrono::steady_clock;
+		result r;
+		r.level = level;
+		n_frames++;
+		n_frames_at_level[level]++;
+
+		if (level >= SHED_DROP && has_last && (n_frames % std::max(1, opt.drop_interval)) != 0)
+		{
+			r.processed = false;
+			r.pupil_pos = last_pos;
+			r.pupil_pos_coarse = last_pos_coarse;
+			n_dropped++;
+			return r;
+		}
+
+		// tracking: stage 2 around the last estimate instead of stage 1
+		const bool track = level >= SHED_TRACKING && has_last && frames_since_detect < opt.redetect_interval
+			&& timm.stage2.confidence >= opt.tracking_min_confidence;
+		if (track)
+		{
+			tracker->pos = last_pos;
+			timm.coarse_detector = tracker;
+		}
+
+		auto t0 = clock::now();
+		std::tie(r.pupil_pos, r.pupil_pos_coarse) = timm.pupil_center(frame_gray, capture_timestamp_ns);
+		r.latency_ms = std::chrono::duration<float, std::milli>(clock::now() - t0).count();
+
+		if (track)
+		{
+			timm.coarse_detector = base_coarse;
+			r.stage1_skipped = true;
+			n_stage1_skipped++;
+			frames_since_detect++;
+		}
+		else { frames_since_detect = 0; }
+
+		last_pos = r.pupil_pos;
+		last_pos_coarse = r.pupil_pos_coarse;
+		has_last = true;
+
+		update(r.latency_ms);
+		return r;
+	}
+
+	int current_level() const { return level; }
+	float latency_ms() const { return ewma_ms; }
+	float budget_ms() const { return 1000.0f / std::max(1e-3f, opt.target_fps) * opt.budget_fraction; }
+	const std::vector<decision>& history() const { return decisions; }
+
+	void print_stats(std::ostream& os = std::cout) const
+	{
+		os << "load shedding: " << n_frames << " frames, " << decisions.size() << " level changes, " << n_dropped << " dropped, "
+			<< n_stage1_skipped << " without stage 1\n";
+		for (int l = 0; l <= opt.max_level; l++)
+		{
+			os << "  level " << l << " (" << shed_level_name(l) << "): " << n_frames_at_level[l] << " frames\n";
+		}
+	}
+
+private:
+	// stage 1 replacement while tracking: returns the last estimate
+	class Coarse_position : public Coarse_detector
+	{
+	public:
+		cv::Point2f pos;
+		cv::Point2f pupil_center(const cv::Mat&) override { return pos; }
+		std::string name() const override { return "last position"; }
+	};
+
+	Timm_two_stage& timm;
+	options opt;
+	const Timm_two_stage::options base;
+	const std::shared_ptr<Coarse_detector> base_coarse;
+	std::shared_ptr<Coarse_position> tracker;
+
+	int level = SHED_NONE;
+	float ewma_ms = 0.0f;
+	float ewma_before_change = 0.0f;
+	int n_since_change = 0;
+	int n_over = 0, n_under = 0;
+	// cost_ratio[l]: latency of level l - 1 / latency of level l
+	std::array<float, SHED_N_LEVELS> cost_ratio;
+	bool degraded_into = false; // the current level was reached by degrading, so its cost_ratio can be measured
+
+	uint64_t n_frames = 0, n_dropped = 0, n_stage1_skipped = 0;
+	std::array<uint64_t, SHED_N_LEVELS> n_frames_at_level;
+
+	cv::Point2f last_pos, last_pos_coarse;
+	bool has_last = false;
+	int frames_since_detect = 0;
+
+	std::vector<decision> decisions;
+
+	void update(float latency)
+	{
+		ewma_ms = n_since_change == 0 ? latency : ewma_ms + opt.ewma_alpha * (latency - ewma_ms);
+		n_since_change++;
+		if (n_since_change < opt.settle_frames) { return; }
+		if (n_since_change == opt.settle_frames && degraded_into && ewma_ms > 0.0f)
+		{
+			cost_ratio[level] = std::max(1.0f, ewma_before_change / ewma_ms);
+		}
+
+		const float budget = budget_ms();
+		n_over = ewma_ms > budget ? n_over + 1 : 0;
+		const float predicted = level > SHED_NONE ? ewma_ms * cost_ratio[level] : 0.0f;
+		n_under = level > SHED_NONE && predicted < opt.restore_fraction * budget ? n_under + 1 : 0;
+
+		if (n_over >= opt.degrade_after && level < opt.max_level) { change(level + 1, 0.0f, true); }
+		else if (n_under >= opt.restore_after) { change(level - 1, predicted, false); }
+	}
+
+	void change(int to, float predicted, bool degrade)
+	{
+		decision d;
+		d.frame = n_frames;
+		d.from = level;
+		d.to = to;
+		d.latency_ms = ewma_ms;
+		d.predicted_ms = predicted;
+		d.budget_ms = budget_ms();
+		decisions.push_back(d);
+		if (log)
+		{
+			*log << "frame " << d.frame << ": level " << d.from << " (" << shed_level_name(d.from) << ") -> " << d.to
+				<< " (" << shed_level_name(d.to) << "), latency " << d.latency_ms << " ms";
+			if (degrade) { *log << " > budget " << d.budget_ms << " ms\n"; }
+			else { *log << ", predicted " << d.predicted_ms << " ms < " << opt.restore_fraction * d.budget_ms << " ms\n"; }
+		}
+
+		ewma_before_change = ewma_ms;
+		degraded_into = degrade;
+		n_since_change = 0;
+		n_over = n_under = 0;
+		apply(to);
+	}
+
+	// derives the options of a level from the full quality options
+	void apply(int l)
+	{
+		level = l;
+		auto o = base;
+		auto shrink = [this](int w, float f) { return std::max(std::min(w, opt.min_down_scaling_width), int(round(w * f))); };
+		if (l >= SHED_RESOLUTION)
+		{
+			o.stage1.down_scaling_width = shrink(o.stage1.down_scaling_width, opt.resolution_factor);
+			o.stage2.down_scaling_width = shrink(o.stage2.down_scaling_width, opt.resolution_factor);
+		}
+		if (l >= SHED_WINDOW) { o.window_width = std::max(8, int(round(o.window_width * opt.window_factor))); }
+		if (l >= SHED_COARSE_GRID)
+		{
+			// like Coarse_timm, only the resolution changes
+			o.stage1.down_scaling_width = std::min(o.stage1.down_scaling_width, opt.coarse_grid_width);
+			o.stage2.candidate_fraction = std::min(o.stage2.candidate_fraction, opt.candidate_fraction);
+		}
+		timm.set_options(o);
+	}
+};
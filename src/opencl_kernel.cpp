@@ -1,4 +1,28 @@
 #include "opencl_kernel.h"
+#include "opencl_kernel_source.h"
+
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <filesystem>
+#include <thread>
+#include <cstdlib>
+
+#ifdef _WIN32
+#include <process.h>
+#else
+#include <unistd.h>
+#endif
+
+// for file names that must not collide between processes
+static long process_id()
+{
+	#ifdef _WIN32
+	return _getpid();
+	#else
+	return getpid();
+	#endif
+}
 
 void Opencl_kernel::setup()
 {
@@ -6,34 +30,25 @@ void Opencl_kernel::setup()
 	// init OpenCl, load and compile kernel 
 	try
 	{
-		// let the user select the OpenCL device
-		menu_select_device();
-
-		// Get default device and setup context
-		// gpu = compute::system::default_device();
-		// gpu = compute::system::find_device("Intel(R) HD Graphics 530");
-		// cout << "\nname of selected device: " << gpu.name() << endl;
+		if (opt.interactive)
+		{
+			// let the user select the OpenCL device
+			menu_select_device();
+		}
+		else
+		{
+			select_device();
+		}
 
 		context = compute::context(gpu);
-		queue = compute::command_queue(context, gpu);
-
-		print_device_info();
-		//cout << "press enter to continue..\n"; char c; cin.get(c);
+		// profiling is needed for the timings of the CPU / device split of Timm_opencl (USE_OPENCL_HYBRID)
+		queue = compute::command_queue(context, gpu, compute::command_queue::enable_profiling);
+		upload_queue = compute::command_queue(context, gpu, compute::command_queue::enable_profiling);
+		readback_queue = compute::command_queue(context, gpu, compute::command_queue::enable_profiling);
 
-		device_data = compute::vector<float>(context);
-		img_out_device1 = compute::image2d(context, 85, 85, compute::image_format(CL_R, CL_FLOAT), compute::image2d::write_only);
-		img_out_device2 = compute::image2d(context, 85, 85, compute::image_format(CL_R, CL_FLOAT), compute::image2d::write_only);
+		if (opt.verbose) { print_device_info(); }
 
-		//compute::program filter_program = compute::program::create_with_source(source1b, context);
-		compute::program filter_program;
-
-		auto const fname = "assets/kernel_inner_gradients_all.cl";
-		cout << "building opencl kernel: " << fname << endl;
-		kernel_code = compute::program::create_with_source_file(fname, context);
-		//kernel_code.build();
-		kernel_code.build("-cl-fast-relaxed-math -cl-finite-math-only -cl-unsafe-math-optimizations -cl-no-signed-zeros -cl-mad-enable");
-
-		cout << "building opencl kernel finished." << endl;
+		kernel_code = build_program();
 	}
 	catch (compute::opencl_error e)
 	{
@@ -44,24 +59,278 @@ void Opencl_kernel::setup()
 
 	// create fliter kernel and set arguments
 	kernel_opencl = compute::kernel(kernel_code, "kernel_inner_gradients");
+
+	// kernels of the full pipeline
+	k_resize = compute::kernel(kernel_code, "k_resize");
+	k_gradients = compute::kernel(kernel_code, "k_gradients");
+	k_threshold = compute::kernel(kernel_code, "k_threshold");
+	k_normalize_compact = compute::kernel(kernel_code, "k_normalize_compact");
+	k_weight = compute::kernel(kernel_code, "k_weight");
+	k_objective = compute::kernel(kernel_code, "k_objective");
+	k_postprocess = compute::kernel(kernel_code, "k_postprocess");
+
+	select_local_work_size();
 }
 
-void Opencl_kernel::prepare_data_tmp(compute::image2d& img_out_device, const cv::Mat& gradient_x, const cv::Mat& gradient_y)
+void Opencl_kernel::select_device()
+{
+	using namespace std;
+	auto devices_list = compute::system::devices();
+	if (devices_list.empty()) { throw std::runtime_error("Opencl_kernel: no OpenCL device found"); }
+
+	string sel = opt.device;
+	if (sel.empty() && getenv("TIMM_OPENCL_DEVICE")) { sel = getenv("TIMM_OPENCL_DEVICE"); }
+
+	if (sel.empty())
+	{
+		// default: the first GPU, or the first device if there is no GPU
+		gpu = devices_list[0];
+		for (auto& d : devices_list)
+		{
+			if (d.type() & compute::device::gpu) { gpu = d; break; }
+		}
+		return;
+	}
+
+	// an index into the device list
+	if (std::all_of(sel.begin(), sel.end(), [](char c) { return isdigit((unsigned char)c); }))
+	{
+		size_t idx = stoul(sel);
+		if (idx >= devices_list.size()) { throw std::invalid_argument("Opencl_kernel: OpenCL device index " + sel + " out of range"); }
+		gpu = devices_list[idx];
+		return;
+	}
+
+	// a case insensitive part of the device name
+	auto to_lower = [](string str) { std::transform(str.begin(), str.end(), str.begin(), [](char c) { return char(tolower((unsigned char)c)); }); return str; };
+	for (auto& d : devices_list)
+	{
+		if (to_lower(d.name()).find(to_lower(sel)) != string::npos)
+		{
+			gpu = d;
+			return;
+		}
+	}
+
+	string names;
+	for (auto& d : devices_list) { names += "\n  " + d.name(); }
+	throw std::invalid_argument("Opencl_kernel: no OpenCL device matches '" + sel + "'. available devices:" + names);
+}
+
+compute::program Opencl_kernel::build_program()
+{
+	using namespace std;
+	const string build_options = "-cl-fast-relaxed-math -cl-finite-math-only -cl-unsafe-math-optimizations -cl-no-signed-zeros -cl-mad-enable";
+
+	// the embedded source, or a file for kernel development
+	string source = kernel_inner_gradients_source;
+	if (getenv("TIMM_OPENCL_KERNEL_FILE"))
+	{
+		ifstream f(getenv("TIMM_OPENCL_KERNEL_FILE"));
+		if (!f) { throw std::runtime_error(string("Opencl_kernel: could not read ") + getenv("TIMM_OPENCL_KERNEL_FILE")); }
+		source.assign(istreambuf_iterator<char>(f), istreambuf_iterator<char>());
+	}
+
+	string cache_dir = opt.cache_dir;
+	if (cache_dir.empty() && getenv("TIMM_OPENCL_CACHE_DIR")) { cache_dir = getenv("TIMM_OPENCL_CACHE_DIR"); }
+	if (cache_dir.empty()) { cache_dir = "timm_cl_cache"; }
+	const bool use_cache = cache_dir != "-";
+
+	// the binary depends on the device, the driver, the options and of course the source
+	string cache_file;
+	if (use_cache)
+	{
+		const string key = gpu.name() + "|" + gpu.vendor() + "|" + gpu.driver_version() + "|" + build_options + "|" + source;
+		uint64_t hash = 14695981039346656037ull; // 64 bit FNV-1a, stable across compilers unlike std::hash
+		for (unsigned char c : key) { hash = (hash ^ c) * 1099511628211ull; }
+		stringstream ss; ss << cache_dir << "/" << hex << setw(16) << setfill('0') << hash << ".bin";
+		cache_file = ss.str();
+
+		ifstream f(cache_file, ios::binary);
+		if (f)
+		{
+			vector<unsigned char> binary((istreambuf_iterator<char>(f)), istreambuf_iterator<char>());
+			try
+			{
+				auto program = compute::program::create_with_binary(binary, context);
+				program.build(build_options);
+				if (opt.verbose) { cout << "loaded cached opencl kernel: " << cache_file << endl; }
+				return program;
+			}
+			catch (compute::opencl_error&)
+			{
+				// corrupt or incompatible binary, rebuild it below
+			}
+		}
+	}
+
+	if (opt.verbose) { cout << "building opencl kernel." << endl; }
+	auto program = compute::program::create_with_source(source, context);
+	program.build(build_options);
+	if (opt.verbose) { cout << "building opencl kernel finished." << endl; }
+
+	if (use_cache)
+	{
+		// write to a temporary file first, so that concurrently starting processes never read a partial binary
+		std::error_code ec;
+		std::filesystem::create_directories(cache_dir, ec);
+		// process and thread id: thread ids are only unique within a process
+		const string tmp_file = cache_file + ".tmp" + to_string(process_id()) + "_" + to_string(std::hash<std::thread::id>()(std::this_thread::get_id()));
+		{
+			auto binary = program.binary();
+			ofstream f(tmp_file, ios::binary);
+			f.write(reinterpret_cast<const char*>(binary.data()), binary.size());
+		}
+		std::filesystem::rename(tmp_file, cache_file, ec);
+		if (ec) { std::filesystem::remove(tmp_file, ec); }
+	}
+	return program;
+}
+
+void Opencl_kernel::select_local_work_size()
+{
+	// the reductions need a power of two, the local tiles hold at most TILE_SIZE (256) work-items
+	auto max_group = [this](std::initializer_list<compute::kernel*> kernels)
+	{
+		size_t max_size = 256;
+		for (auto k : kernels) { max_size = std::min(max_size, k->get_work_group_info<size_t>(gpu, CL_KERNEL_WORK_GROUP_SIZE)); }
+		return max_size;
+	};
+	auto square = [](size_t max_size)
+	{
+		size_t s = 16;
+		while (s > 1 && s * s > max_size) { s /= 2; }
+		return s;
+	};
+	auto power_of_two = [](size_t max_size)
+	{
+		size_t s = 256;
+		while (s > 1 && s > max_size) { s /= 2; }
+		return s;
+	};
+
+	const size_t s = square(max_group({ &kernel_opencl }));
+	local_work_size[0] = s;
+	local_work_size[1] = s;
+	const size_t f = square(max_group({ &k_resize, &k_gradients, &k_normalize_compact, &k_weight, &k_objective }));
+	full_local_size[0] = f;
+	full_local_size[1] = f;
+	threshold_group = power_of_two(max_group({ &k_threshold }));
+	postprocess_group = power_of_two(max_group({ &k_postprocess }));
+	if (opt.verbose)
+	{
+		std::cout << "OpenCL: local work size: " << s << " x " << s << ", full pipeline " << f << " x " << f
+			<< ", reductions " << threshold_group << " / " << postprocess_group << "\n";
+	}
+}
+
+Opencl_kernel::handle Opencl_kernel::compute_async(const cv::Mat& gradient_x, const cv::Mat& gradient_y, int stage, int row_begin, int row_end)
+{
+	if (row_end < 0) { row_end = gradient_x.rows; }
+	if (row_begin < 0 || row_begin >= row_end || row_end > gradient_x.rows) { throw std::invalid_argument("Opencl_kernel::compute_async: invalid row range"); }
+
+	slot_ring& ring = pool[std::make_tuple(stage, gradient_x.cols, gradient_x.rows)];
+	frame_slot& slot = ring.slots[ring.next_slot];
+	ring.next_slot = (ring.next_slot + 1) % n_slots;
+
+	handle h;
+	h.slot = &slot;
+
+	// the previous frame of this slot must be finished before its buffers are reused
+	if (slot.in_flight)
+	{
+		slot.done.wait();
+		slot.in_flight = false;
+	}
+	h.generation = ++slot.generation;
+
+	upload(slot, gradient_x, gradient_y);
+
+	slot.uploaded = upload_queue.enqueue_write_buffer_async(slot.device_data, 0, slot.data.size() * sizeof(float), slot.data.data());
+
+	// set kernel parameters. they are captured at enqueue time, so the kernel object can be reused right away.
+	// the kernel writes rows below its h argument only, so h = row_end limits a partial frame
+	const int w = gradient_x.cols;
+	kernel_opencl.set_arg(0, slot.img_out_device);
+	kernel_opencl.set_arg(1, slot.device_data);
+	kernel_opencl.set_arg(2, int(slot.data.size() / 4));
+	kernel_opencl.set_arg(3, w);
+	kernel_opencl.set_arg(4, row_end);
+
+	// a partial frame starts at the global offset row_begin
+	const size_t offset[2] = { 0, size_t(row_begin) };
+	const size_t region[2] = { slot.region[0], ((row_end - row_begin + local_work_size[1] - 1) / local_work_size[1]) * local_work_size[1] };
+	compute::event computed = queue.enqueue_nd_range_kernel(kernel_opencl, 2, offset, region, local_work_size, compute::wait_list(slot.uploaded));
+
+	// non-blocking readback. boost.compute only offers a blocking enqueue_read_image
+	const size_t origin3[3] = { 0, size_t(row_begin), 0 };
+	const size_t region3[3] = { size_t(w), size_t(row_end - row_begin), 1 };
+	cl_event ev_computed = computed.get();
+	cl_event ev_read;
+	cl_int err = clEnqueueReadImage(readback_queue.get(), slot.img_out_device.get(), CL_FALSE, origin3, region3, slot.img_out.step, 0, slot.img_out.ptr<float>(row_begin), 1, &ev_computed, &ev_read);
+	if (err != CL_SUCCESS) { throw compute::opencl_error(err); }
+	slot.done = compute::event(ev_read, false);
+	slot.in_flight = true;
+
+	// hand the commands to the device without waiting for them. every queue has to be flushed, a command that waits
+	// for an event of another queue may otherwise wait for a command that was never submitted
+	upload_queue.flush();
+	queue.flush();
+	readback_queue.flush();
+
+	return h;
+}
+
+bool Opencl_kernel::ready(const handle& h)
+{
+	const frame_slot& slot = *h.slot;
+	if (slot.generation != h.generation) { throw std::invalid_argument("Opencl_kernel::ready: the slot of this handle has been reused"); }
+	return !slot.in_flight || slot.done.status() == CL_COMPLETE;
+}
+
+const cv::Mat& Opencl_kernel::wait(const handle& h)
+{
+	frame_slot& slot = *h.slot;
+	if (slot.generation != h.generation) { throw std::invalid_argument("Opencl_kernel::wait: the slot of this handle has been reused"); }
+	if (slot.in_flight)
+	{
+		slot.done.wait();
+		slot.in_flight = false;
+	}
+	return slot.img_out;
+}
+
+float Opencl_kernel::elapsed_ms(const handle& h)
+{
+	frame_slot& slot = *h.slot;
+	if (slot.generation != h.generation) { throw std::invalid_argument("Opencl_kernel::elapsed_ms: the slot of this handle has been reused"); }
+	wait(h);
+	const cl_ulong t_start = slot.uploaded.get_profiling_info<cl_ulong>(CL_PROFILING_COMMAND_START);
+	const cl_ulong t_end = slot.done.get_profiling_info<cl_ulong>(CL_PROFILING_COMMAND_END);
+	return float(t_end - t_start) * 1e-6f;
+}
+
+void Opencl_kernel::upload(frame_slot& slot, const cv::Mat& gradient_x, const cv::Mat& gradient_y)
 {
 	const int w = gradient_x.cols;
 	const int h = gradient_x.rows;
 
-	region[0] = w;
-	region[1] = h;
+	// pad the global work size to a multiple of the local work size
+	slot.region[0] = ((w + local_work_size[0] - 1) / local_work_size[0]) * local_work_size[0];
+	slot.region[1] = ((h + local_work_size[1] - 1) / local_work_size[1]) * local_work_size[1];
 
-	// change output image if necessary
-	if (img_out_device.width() != w || img_out_device.height() != h)
+	// the size of a slot never changes, so the output images are allocated only once
+	if (slot.img_out_device.get() == nullptr)
 	{
-		img_out_device = compute::image2d(context, w, h, compute::image_format(CL_R, CL_FLOAT), compute::image2d::write_only);
+		slot.img_out_device = compute::image2d(context, w, h, compute::image_format(CL_R, CL_FLOAT), compute::image2d::write_only);
+		slot.img_out.create(h, w, CV_32F);
+		n_allocations++;
 	}
 
 
-	//////// prepare gradients and transfer them to the compute device /////////// 
+	//////// prepare gradients for the transfer to the compute device /////////// 
+	// only the non-zero gradients are uploaded (the same set Timm::prepare_data uses), as (x, y, gx, gy)
+	auto& data = slot.data;
 	data.clear();
 	auto cols = gradient_x.cols;
 	auto gx_p = gradient_x.ptr<float>(0);
@@ -75,23 +344,175 @@ void Opencl_kernel::prepare_data_tmp(compute::image2d& img_out_device, const cv:
 			float gx = gx_p[idx];
 			float gy = gy_p[idx];
 
-			// for kernel source 1b
-			data.push_back(gx);
-			data.push_back(gy);
+			if (gx != 0.0f || gy != 0.0f)
+			{
+				data.push_back(x);
+				data.push_back(y);
+				data.push_back(gx);
+				data.push_back(gy);
+			}
 		}
 	}
 
-	const int s = data.size();
-	device_data.resize(s);
-	compute::copy(data.begin(), data.end(), device_data.begin(), queue);
+	// OpenCL buffers must not be empty. a zero gradient contributes nothing
+	if (data.empty()) { data.resize(4, 0.0f); }
 
-	// set kernel parameters
-	kernel_opencl.set_arg(0, img_out_device);
-	kernel_opencl.set_arg(1, device_data); // after a resize, the internal pointer of device_data might have changed, so we need to set the parameter, again
-	kernel_opencl.set_arg(2, s);
-	kernel_opencl.set_arg(3, w);
-	kernel_opencl.set_arg(4, h);
+	// grow the device buffer if necessary (a resize of a compute::vector would block the queue).
+	// all w x h gradients fit into the first allocation, so it never has to grow again
+	const size_t bytes = data.size() * sizeof(float);
+	if (slot.device_data.get() == nullptr || slot.device_data.size() < bytes)
+	{
+		const size_t max_bytes = std::max(bytes, size_t(w) * h * 4 * sizeof(float));
+		slot.device_data = compute::buffer(context, max_bytes, compute::buffer::read_only);
+		n_allocations++;
+	}
+}
+
+cv::Point Opencl_kernel::pupil_center_full(const cv::Mat& eye_img, const full_params& p, int stage, cv::Mat* rows_around, int radius)
+{
+	full_buffers& b = full_pool[std::make_tuple(stage, eye_img.cols, eye_img.rows)];
+	const int w = p.width;
+	const int h = p.height;
+	const int n = w * h;
+	const auto rw = compute::buffer::read_write;
+
+	// buffers are only reallocated if the down scaled size of this stage changes
+	if (b.w != w || b.h != h)
+	{
+		const size_t fbytes = n * sizeof(float);
+		b.w = w;
+		b.h = h;
+		b.src = compute::buffer(context, eye_img.cols * eye_img.rows, compute::buffer::read_only);
+		b.scaled = compute::buffer(context, fbytes, rw);
+		b.gx = compute::buffer(context, fbytes, rw);
+		b.gy = compute::buffer(context, fbytes, rw);
+		b.mag = compute::buffer(context, fbytes, rw);
+		b.weight = compute::buffer(context, fbytes, rw);
+		b.out = compute::buffer(context, fbytes, rw);
+		b.flood = compute::buffer(context, fbytes, rw);
+		b.killed = compute::buffer(context, n * sizeof(int), rw);
+		b.threshold = compute::buffer(context, sizeof(float), rw);
+		b.data = compute::buffer(context, n * 4 * sizeof(float), rw);
+		b.count = compute::buffer(context, sizeof(int), rw);
+		b.result = compute::buffer(context, 2 * sizeof(int), rw);
+		n_allocations++;
+	}
+
+	// filter coefficients from OpenCV, so that the filters are the same as on the CPU
+	if (b.sobel != p.sobel || b.blur != p.blur)
+	{
+		cv::Mat k_deriv, k_smooth, k_gauss;
+		cv::getDerivKernels(k_deriv, k_smooth, 1, 0, p.sobel, false, CV_32F);
+		if (p.blur > 0) { k_gauss = cv::getGaussianKernel(p.blur, 0, CV_32F); }
+
+		b.n_deriv = k_deriv.total();
+		b.n_smooth = k_smooth.total();
+		b.n_gauss = k_gauss.total();
+		b.deriv = compute::buffer(context, b.n_deriv * sizeof(float), compute::buffer::read_only);
+		b.smooth = compute::buffer(context, b.n_smooth * sizeof(float), compute::buffer::read_only);
+		b.gauss = compute::buffer(context, std::max(1, b.n_gauss) * sizeof(float), compute::buffer::read_only);
+		queue.enqueue_write_buffer(b.deriv, 0, b.n_deriv * sizeof(float), k_deriv.ptr<float>());
+		queue.enqueue_write_buffer(b.smooth, 0, b.n_smooth * sizeof(float), k_smooth.ptr<float>());
+		if (b.n_gauss > 0) { queue.enqueue_write_buffer(b.gauss, 0, b.n_gauss * sizeof(float), k_gauss.ptr<float>()); }
+		b.sobel = p.sobel;
+		b.blur = p.blur;
+	}
 
+	// windowed images (stage 2) are not continuous
+	const cv::Mat* src = &eye_img;
+	if (!eye_img.isContinuous())
+	{
+		eye_img.copyTo(b.src_host);
+		src = &b.src_host;
+	}
+
+	// the queue is in-order and the result is read blocking at the end, so the host data stays valid for all commands
+	const int zero = 0;
+	queue.enqueue_write_buffer_async(b.src, 0, src->total(), src->data);
+	queue.enqueue_write_buffer_async(b.count, 0, sizeof(int), &zero);
+
+	const size_t* local = full_local_size;
+	const size_t global[2] = {
+		((w + local[0] - 1) / local[0]) * local[0],
+		((h + local[1] - 1) / local[1]) * local[1] };
+
+	// the reductions run in a single work-group
+	const size_t origin1[1] = { 0 };
+	const size_t group_threshold[1] = { threshold_group };
+	const size_t group_postprocess[1] = { postprocess_group };
+
+	k_resize.set_arg(0, b.src);
+	k_resize.set_arg(1, eye_img.cols);
+	k_resize.set_arg(2, eye_img.rows);
+	k_resize.set_arg(3, b.scaled);
+	k_resize.set_arg(4, w);
+	k_resize.set_arg(5, h);
+	queue.enqueue_nd_range_kernel(k_resize, 2, origin, global, local);
+
+	k_gradients.set_arg(0, b.scaled);
+	k_gradients.set_arg(1, w);
+	k_gradients.set_arg(2, h);
+	k_gradients.set_arg(3, b.deriv);
+	k_gradients.set_arg(4, b.n_deriv);
+	k_gradients.set_arg(5, b.smooth);
+	k_gradients.set_arg(6, b.n_smooth);
+	k_gradients.set_arg(7, b.gx);
+	k_gradients.set_arg(8, b.gy);
+	k_gradients.set_arg(9, b.mag);
+	queue.enqueue_nd_range_kernel(k_gradients, 2, origin, global, local);
+
+	k_threshold.set_arg(0, b.mag);
+	k_threshold.set_arg(1, n);
+	k_threshold.set_arg(2, p.gradient_threshold);
+	k_threshold.set_arg(3, b.threshold);
+	queue.enqueue_nd_range_kernel(k_threshold, 1, origin1, group_threshold, group_threshold);
+
+	k_normalize_compact.set_arg(0, b.gx);
+	k_normalize_compact.set_arg(1, b.gy);
+	k_normalize_compact.set_arg(2, b.mag);
+	k_normalize_compact.set_arg(3, b.threshold);
+	k_normalize_compact.set_arg(4, w);
+	k_normalize_compact.set_arg(5, h);
+	k_normalize_compact.set_arg(6, b.data);
+	k_normalize_compact.set_arg(7, b.count);
+	queue.enqueue_nd_range_kernel(k_normalize_compact, 2, origin, global, local);
+
+	k_weight.set_arg(0, b.scaled);
+	k_weight.set_arg(1, w);
+	k_weight.set_arg(2, h);
+	k_weight.set_arg(3, b.gauss);
+	k_weight.set_arg(4, b.n_gauss);
+	k_weight.set_arg(5, b.weight);
+	queue.enqueue_nd_range_kernel(k_weight, 2, origin, global, local);
+
+	k_objective.set_arg(0, b.data);
+	k_objective.set_arg(1, b.count);
+	k_objective.set_arg(2, b.weight);
+	k_objective.set_arg(3, w);
+	k_objective.set_arg(4, h);
+	k_objective.set_arg(5, b.out);
+	queue.enqueue_nd_range_kernel(k_objective, 2, origin, global, local);
+
+	k_postprocess.set_arg(0, b.out);
+	k_postprocess.set_arg(1, w);
+	k_postprocess.set_arg(2, h);
+	k_postprocess.set_arg(3, p.postprocess_threshold);
+	k_postprocess.set_arg(4, b.flood);
+	k_postprocess.set_arg(5, b.killed);
+	k_postprocess.set_arg(6, b.result);
+	queue.enqueue_nd_range_kernel(k_postprocess, 1, origin1, group_postprocess, group_postprocess);
+
+	int result[2] = { 0, 0 };
+	queue.enqueue_read_buffer(b.result, 0, sizeof(result), result);
+
+	if (rows_around)
+	{
+		const int y0 = std::max(0, result[1] - radius);
+		const int y1 = std::min(h - 1, result[1] + radius);
+		rows_around->create(y1 - y0 + 1, w, CV_32F);
+		queue.enqueue_read_buffer(b.out, y0 * w * sizeof(float), rows_around->total() * sizeof(float), rows_around->data);
+	}
+	return cv::Point(result[0], result[1]);
 }
 
 #ifdef USE_FLTK_GUI // if fltk is available, build a selection menu for the opencl device
@@ -6,6 +6,8 @@
 #include <boost/compute/interop/opencv/core.hpp>
 
 #include<vector>
+#include<map>
+#include<tuple>
 #include<iostream>
 
 // separate class for the kernel and device data
@@ -19,59 +21,153 @@ protected:
 	compute::device gpu;
 	compute::context context;
 	compute::command_queue queue;
+	// compute_async puts the transfers on queues of their own. all three are in-order, so on a single queue the upload of
+	// frame N+1 would wait for the kernel and the readback of frame N. the event chain keeps the order within a frame
+	compute::command_queue upload_queue;
+	compute::command_queue readback_queue;
 	compute::program kernel_code;
-	compute::vector<float> device_data;
 	compute::kernel kernel_opencl;
 
 	const size_t origin[2] = { 0, 0 };
-	const size_t local_work_size[2] = { 64, 64 }; // not used yet
-	size_t region[2] = { 0, 0 };
-	
-	std::vector<float> data;
-	compute::image2d img_out_device1;
-	compute::image2d img_out_device2;
 
-	void prepare_data_tmp(compute::image2d& img_out_device, const cv::Mat& gradient_x, const cv::Mat& gradient_y);
-	bool use_img_out_device1 = true;
+	// host and device buffers of one frame in flight.
+	// upload -> kernel -> readback are chained by events, so nothing blocks the host until wait()
+	struct frame_slot
+	{
+		std::vector<float> data;        // host copy of the gradients. must stay alive until the upload has finished
+		compute::buffer device_data;
+		compute::image2d img_out_device;
+		cv::Mat img_out;                // readback target
+		size_t region[2] = { 0, 0 };    // global work size, padded to a multiple of local_work_size
+		compute::event uploaded;        // start of the frame on the device, for elapsed_ms
+		compute::event done;            // readback finished
+		bool in_flight = false;
+		uint64_t generation = 0;        // detects handles of frames whose slot has been reused
+	};
+
+	// triple buffering: the upload of frame N+1 overlaps the kernel of frame N and the readback of frame N-1
+	// (if the device has a copy engine, see upload_queue)
+public:
+	static const int n_slots = 3;
+protected:
+	struct slot_ring
+	{
+		frame_slot slots[n_slots];
+		int next_slot = 0;
+	};
+
+	// one ring of slots per (stage, width, height), so frames of different stages and sizes never
+	// reallocate each other's device memory. rings are created on first use and never freed,
+	// gradient buffers only grow.
+	std::map<std::tuple<int, int, int>, slot_ring> pool;
+
+	void upload(frame_slot& slot, const cv::Mat& gradient_x, const cv::Mat& gradient_y);
 
+	// device buffers of the full pipeline of one stage and input size
+	struct full_buffers
+	{
+		int w = 0;
+		int h = 0;
+		compute::buffer src, scaled, gx, gy, mag, weight, threshold, data, count, out, flood, killed, result;
+
+		// filter coefficients
+		int sobel = 0;
+		int blur = -1;
+		int n_deriv = 0, n_smooth = 0, n_gauss = 0;
+		compute::buffer deriv, smooth, gauss;
+
+		cv::Mat src_host; // contiguous copy of a windowed input image
+	};
+	std::map<std::tuple<int, int, int>, full_buffers> full_pool;
+
+	compute::kernel k_resize, k_gradients, k_threshold, k_normalize_compact, k_weight, k_objective, k_postprocess;
+
+	// interactive device selection on the console (or with fltk)
 	void menu_select_device();
+
+	// non-interactive device selection, see options::device
+	void select_device();
+
+	// builds the kernel program, or loads it from the binary cache
+	compute::program build_program();
+
+	// work-group sizes of the full pipeline, see select_local_work_size
+	size_t full_local_size[2] = { 16, 16 }; // the 2d kernels
+	size_t threshold_group = 256;           // k_threshold and k_postprocess run in a single work-group
+	size_t postprocess_group = 256;
+
+	// picks the largest square work-group that fits the kernel on the selected device (at most 16x16, see TILE_SIZE in the kernel).
+	// every kernel has its own limit (registers, local memory), so each size is derived from the kernels it is used for
+	void select_local_work_size();
 public:
+	struct options
+	{
+		// OpenCL device: an index into compute::system::devices() or a part of the device name (case insensitive).
+		// if empty, the environment variable TIMM_OPENCL_DEVICE is used. if that is not set either: the first GPU, or the first device
+		std::string device;
+		bool interactive = false; // select the device with a menu instead
+
+		// directory of the compiled program binaries, keyed by device, driver version, build options and source.
+		// if empty, the environment variable TIMM_OPENCL_CACHE_DIR is used, otherwise "timm_cl_cache". "-" disables the cache
+		std::string cache_dir;
+
+		bool verbose = true; // print device info and build messages
+	} opt;
+
+	// work-group size of kernel_opencl (compute_async). set by setup, can be overwritten for tuning (x * y must not exceed 256)
+	size_t local_work_size[2] = { 16, 16 };
+
+	// number of device buffer / image allocations so far. stays constant once all shapes have been seen
+	size_t n_allocations = 0;
+
+	// future-style handle of a result computed by compute_async
+	struct handle
+	{
+		frame_slot* slot = nullptr;
+		uint64_t generation = 0;
+	};
+
 	void print_device_info();
 
-	// TODO: check the proper allocation of compute::image2d(context, 85, 85, ..
 	void setup();
 
-	void prepare_data(const cv::Mat& gradient_x, const cv::Mat& gradient_y)
-	{
-		if (gradient_x.cols == gradient_x.rows) //this is a bad hack. needs proper implementation
-		{
-			prepare_data_tmp(img_out_device1, gradient_x, gradient_y);
-			use_img_out_device1 = true;
-		}
-		else
-		{
-			prepare_data_tmp(img_out_device2, gradient_x, gradient_y);
-			use_img_out_device1 = false;
-		}
+	// enqueues upload, kernel and readback for the given gradients and returns immediately.
+	// stage identifies the caller (e.g. the stage of Timm_two_stage) and selects the buffer pool entry together with the image size.
+	// at most n_slots frames per stage and size can be in flight: the result of a handle is valid until n_slots further calls.
+	// only the rows [row_begin, row_end) of the result are computed and read back (row_end = -1: up to the last row),
+	// so that the CPU can compute the remaining rows at the same time
+	handle compute_async(const cv::Mat& gradient_x, const cv::Mat& gradient_y, int stage = 0, int row_begin = 0, int row_end = -1);
 
-	}
+	// true if the result of handle h has arrived on the host
+	bool ready(const handle& h);
 
+	// waits for the result of handle h
+	const cv::Mat& wait(const handle& h);
+
+	// device time of a finished handle in ms, from the start of the upload to the end of the readback
+	float elapsed_ms(const handle& h);
+
+	// parameters of the full pipeline (see Timm::options)
+	struct full_params
+	{
+		int width = 85;  // size of the down scaled image
+		int height = 85;
+		int blur = 5;
+		int sobel = 5;
+		float gradient_threshold = 50.0f;
+		float postprocess_threshold = 0.97f;
+	};
 
+	// full pipeline: down scaling, gradients, weights, objective function and post processing all run on the device.
+	// only the raw eye image is uploaded, and only the resulting point (in down scaled coordinates) is read back.
+	// if rows_around is given, the rows max.y - radius .. max.y + radius (clipped at the border) of the weighted
+	// objective function are read back as well, for the sub-pixel refinement on the host
+	cv::Point pupil_center_full(const cv::Mat& eye_img, const full_params& p, int stage = 0, cv::Mat* rows_around = nullptr, int radius = 1);
 
-	void compute(cv::Mat img_out)
+	// blocking version
+	void compute(const cv::Mat& gradient_x, const cv::Mat& gradient_y, cv::Mat& img_out, int stage = 0)
 	{
-		queue.enqueue_nd_range_kernel(kernel_opencl, 2, origin, region, nullptr);// local_work_size); // nullptr);//
-		queue.finish();
-
-		//cout << "Show GPU image" << endl;
-		if (use_img_out_device1)
-		{
-			compute::opencv_copy_image_to_mat(img_out_device1, img_out, queue);
-		}
-		else
-		{
-			compute::opencv_copy_image_to_mat(img_out_device2, img_out, queue);
-		}
+		wait(compute_async(gradient_x, gradient_y, stage)).copyTo(img_out);
 	}
 
 };
@@ -0,0 +1,323 @@
+#pragma once
+
+// OpenCL source of the objective function kernel, embedded so that the binary does not depend on the working directory.
+// for kernel development, Opencl_kernel can load a file instead (environment variable TIMM_OPENCL_KERNEL_FILE)
+static const char* const kernel_inner_gradients_source = R"CLC(
+// maximum number of work-items per work-group. the host never selects a larger local work size
+#define TILE_SIZE 256
+
+// sum of the objective function over all n gradients for center c.
+// data holds only the non-zero gradients, one float4 (x, y, gx, gy) per gradient.
+// all work-items of the work-group must call this, because the gradients are staged through local memory
+inline float objective_sum(const float2 c, __global const float4 * data, const int n, __local float4 * tile)
+{
+	const int lid = get_local_id(1) * get_local_size(0) + get_local_id(0);
+	const int lsize = get_local_size(0) * get_local_size(1);
+
+	float2 d;
+	float dp = 0.0f;
+	float sum = 0.0f;
+
+	for (int base = 0; base < n; base += lsize)
+	{
+		// cooperatively load the next tile of gradients
+		if (base + lid < n) { tile[lid] = data[base + lid]; }
+		barrier(CLK_LOCAL_MEM_FENCE);
+
+		const int m = min(lsize, n - base);
+		for (int i = 0; i < m; i++)
+		{
+			const float4 g = tile[i];
+			d = g.xy - c;
+			// the squared distance is clamped to 0.5, so that the gradient's own position contributes 0 instead of NaN
+			d = d * rsqrt(max(dot(d, d), 0.5f));
+			dp = dot(d, g.zw);
+			dp = max(0.0f, dp);
+			sum += dp*dp;
+		}
+		barrier(CLK_LOCAL_MEM_FENCE);
+	}
+	return sum;
+}
+
+// the global work size is padded to a multiple of the local work size, so work-items outside
+// of the w x h output still help loading the tiles but do not write.
+// for a partial frame, the rows start at the global offset and h is the end row.
+__kernel void kernel_inner_gradients(__write_only image2d_t  img_out, __global const float4 * data, const int n, const  int w, const int h)
+{
+	// gradients are staged through local memory, one per work-item and tile
+	__local float4 tile[TILE_SIZE];
+
+	// Store each work-item's unique row and column
+	const int x = get_global_id(0);
+	const int y = get_global_id(1);
+
+	// center positions
+	const float2 c = { x, y };
+	const float sum = objective_sum(c, data, n, tile);
+
+	if (x < w && y < h)
+	{
+		write_imagef(img_out, (int2)(x, y), sum);
+	}
+}
+
+
+/////////////////////// full pipeline (USE_OPENCL_FULL) ///////////////////////
+// the same steps as Timm::pre_process, Timm::pupil_center and Timm::post_process, but on the device.
+// all images are w x h float buffers, row major.
+
+// BORDER_REFLECT_101, the OpenCV default border of Sobel and GaussianBlur
+inline int reflect101(int i, const int n)
+{
+	if (n == 1) { return 0; }
+	while (i < 0 || i >= n)
+	{
+		if (i < 0) { i = -i; }
+		if (i >= n) { i = 2 * n - 2 - i; }
+	}
+	return i;
+}
+
+// bilinear down scaling like cv::resize with INTER_LINEAR. the result is rounded to 8 bit like the CPU version
+__kernel void k_resize(__global const uchar * src, const int src_w, const int src_h, __global float * dst, const int w, const int h)
+{
+	const int x = get_global_id(0);
+	const int y = get_global_id(1);
+	if (x >= w || y >= h) { return; }
+
+	float fx = (x + 0.5f) * ((float)src_w / w) - 0.5f;
+	float fy = (y + 0.5f) * ((float)src_h / h) - 0.5f;
+	int x0 = (int)floor(fx); fx -= x0;
+	int y0 = (int)floor(fy); fy -= y0;
+	if (x0 < 0) { x0 = 0; fx = 0.0f; }
+	if (y0 < 0) { y0 = 0; fy = 0.0f; }
+	if (x0 >= src_w - 1) { x0 = src_w - 1; fx = 0.0f; }
+	if (y0 >= src_h - 1) { y0 = src_h - 1; fy = 0.0f; }
+	const int x1 = min(x0 + 1, src_w - 1);
+	const int y1 = min(y0 + 1, src_h - 1);
+
+	const float v0 = (1.0f - fx) * src[y0 * src_w + x0] + fx * src[y0 * src_w + x1];
+	const float v1 = (1.0f - fx) * src[y1 * src_w + x0] + fx * src[y1 * src_w + x1];
+	dst[y * w + x] = clamp(rint((1.0f - fy) * v0 + fy * v1), 0.0f, 255.0f);
+}
+
+// separable Sobel filter (coefficients from cv::getDerivKernels) and gradient magnitudes.
+// deriv is applied along the derivative direction, smooth along the other one
+__kernel void k_gradients(__global const float * img, const int w, const int h,
+	__constant float * deriv, const int n_deriv, __constant float * smooth, const int n_smooth,
+	__global float * gx, __global float * gy, __global float * mag)
+{
+	const int x = get_global_id(0);
+	const int y = get_global_id(1);
+	if (x >= w || y >= h) { return; }
+
+	const int rd = n_deriv / 2;
+	const int rs = n_smooth / 2;
+	float sx = 0.0f;
+	float sy = 0.0f;
+	for (int i = 0; i < n_smooth; i++)
+	{
+		for (int j = 0; j < n_deriv; j++)
+		{
+			// d/dx: smooth vertically, derivative horizontally. d/dy: the other way round
+			sx += smooth[i] * deriv[j] * img[reflect101(y + i - rs, h) * w + reflect101(x + j - rd, w)];
+			sy += smooth[i] * deriv[j] * img[reflect101(y + j - rd, h) * w + reflect101(x + i - rs, w)];
+		}
+	}
+	const int idx = y * w + x;
+	gx[idx] = sx;
+	gy[idx] = sy;
+	mag[idx] = sqrt(sx * sx + sy * sy);
+}
+
+// dynamic gradient threshold like Timm::calc_dynamic_threshold. launched as a single work-group.
+// two passes: the mean first, then the squared deviations from it. E[x^2] - E[x]^2 cancels in float when the
+// magnitudes are large compared to their spread
+__kernel void k_threshold(__global const float * mag, const int n, const float std_dev_factor, __global float * threshold)
+{
+	__local float s1[TILE_SIZE];
+	__local float s2[TILE_SIZE];
+	const int lid = get_local_id(0);
+	const int lsize = get_local_size(0);
+
+	float a = 0.0f;
+	for (int i = lid; i < n; i += lsize) { a += mag[i]; }
+	s1[lid] = a;
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	for (int s = lsize / 2; s > 0; s /= 2)
+	{
+		if (lid < s) { s1[lid] += s1[lid + s]; }
+		barrier(CLK_LOCAL_MEM_FENCE);
+	}
+	const float mean = s1[0] / n;
+
+	float b = 0.0f;
+	for (int i = lid; i < n; i += lsize) { const float d = mag[i] - mean; b += d * d; }
+	s2[lid] = b;
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	for (int s = lsize / 2; s > 0; s /= 2)
+	{
+		if (lid < s) { s2[lid] += s2[lid + s]; }
+		barrier(CLK_LOCAL_MEM_FENCE);
+	}
+
+	if (lid == 0)
+	{
+		const float std_dev = sqrt(s2[0] / n);
+		threshold[0] = std_dev_factor * std_dev / sqrt((float)n) + mean;
+	}
+}
+
+// normalizes the gradients, drops the ones below the threshold and appends the others to the gradient list.
+// the order of the list does not matter for the objective function
+__kernel void k_normalize_compact(__global const float * gx, __global const float * gy, __global const float * mag,
+	__global const float * threshold, const int w, const int h, __global float4 * data, __global int * count)
+{
+	const int x = get_global_id(0);
+	const int y = get_global_id(1);
+	if (x >= w || y >= h) { return; }
+
+	const int idx = y * w + x;
+	const float m = mag[idx];
+	if (m < threshold[0] || m == 0.0f) { return; }
+
+	const float2 g = (float2)(gx[idx], gy[idx]) / m;
+	if (g.x != 0.0f || g.y != 0.0f)
+	{
+		data[atomic_inc(count)] = (float4)(x, y, g.x, g.y);
+	}
+}
+
+// blurred (kernel from cv::getGaussianKernel, rounded to 8 bit like the CPU version) and inverted image
+__kernel void k_weight(__global const float * img, const int w, const int h, __constant float * gauss, const int n_gauss, __global float * weight)
+{
+	const int x = get_global_id(0);
+	const int y = get_global_id(1);
+	if (x >= w || y >= h) { return; }
+
+	float v = img[y * w + x];
+	if (n_gauss > 0)
+	{
+		const int r = n_gauss / 2;
+		v = 0.0f;
+		for (int i = 0; i < n_gauss; i++)
+		{
+			for (int j = 0; j < n_gauss; j++)
+			{
+				v += gauss[i] * gauss[j] * img[reflect101(y + i - r, h) * w + reflect101(x + j - r, w)];
+			}
+		}
+		v = clamp(rint(v), 0.0f, 255.0f);
+	}
+	weight[y * w + x] = 255.0f - v;
+}
+
+// weighted objective function. the number of gradients is read from the device, so no host round trip is needed
+__kernel void k_objective(__global const float4 * data, __global const int * count, __global const float * weight, const int w, const int h, __global float * out)
+{
+	__local float4 tile[TILE_SIZE];
+	const int x = get_global_id(0);
+	const int y = get_global_id(1);
+	const float sum = objective_sum((float2)(x, y), data, count[0], tile);
+	if (x < w && y < h) { out[y * w + x] = sum * weight[y * w + x]; }
+}
+
+// index of the maximum of v where killed == 0 (killed may be 0). the first index wins ties, like cv::minMaxLoc.
+// returns n if no pixel is left. all work-items of the (single) work-group must call this
+inline int argmax(__global const float * v, __global const int * killed, const int n, __local float * bv, __local int * bi, float * max_val)
+{
+	const int lid = get_local_id(0);
+	const int lsize = get_local_size(0);
+
+	float best = -MAXFLOAT;
+	int best_i = n;
+	for (int i = lid; i < n; i += lsize)
+	{
+		if ((killed == 0 || killed[i] == 0) && (best_i == n || v[i] > best)) { best = v[i]; best_i = i; }
+	}
+	bv[lid] = best;
+	bi[lid] = best_i;
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	for (int s = lsize / 2; s > 0; s /= 2)
+	{
+		if (lid < s)
+		{
+			const float ov = bv[lid + s];
+			const int oi = bi[lid + s];
+			if (oi != n && (bi[lid] == n || ov > bv[lid] || (ov == bv[lid] && oi < bi[lid]))) { bv[lid] = ov; bi[lid] = oi; }
+		}
+		barrier(CLK_LOCAL_MEM_FENCE);
+	}
+	*max_val = bv[0];
+	const int result = bi[0];
+	barrier(CLK_LOCAL_MEM_FENCE);
+	return result;
+}
+
+// Timm::post_process launched as a single work-group: maximum, threshold, removal of the maxima connected to
+// the image border (flood fill from the top left corner over the non-zero pixels, like Timm::floodKillEdges)
+// and the maximum of the remaining pixels. result = (x, y), or (-1, -1) if nothing is left
+__kernel void k_postprocess(__global const float * out, const int w, const int h, const float postprocess_threshold,
+	__global float * flood, __global int * killed, __global int * result)
+{
+	__local float bv[TILE_SIZE];
+	__local int bi[TILE_SIZE];
+	__local int changed;
+
+	const int lid = get_local_id(0);
+	const int lsize = get_local_size(0);
+	const int n = w * h;
+
+	float max_val = 0.0f;
+	int idx = argmax(out, 0, n, bv, bi, &max_val);
+
+	if (postprocess_threshold < 1.0f)
+	{
+		// threshold to zero, and a border of 255 around the image like cv::rectangle in Timm::floodKillEdges
+		const float t = max_val * postprocess_threshold;
+		for (int i = lid; i < n; i += lsize)
+		{
+			const int x = i % w;
+			const int y = i / w;
+			const bool border = x == 0 || y == 0 || x == w - 1 || y == h - 1;
+			flood[i] = border ? 255.0f : (out[i] > t ? out[i] : 0.0f);
+			killed[i] = i == 0 ? 1 : 0;
+		}
+		barrier(CLK_GLOBAL_MEM_FENCE);
+
+		// grow the killed region over non-zero 4-neighbours until nothing changes
+		while (true)
+		{
+			if (lid == 0) { changed = 0; }
+			barrier(CLK_LOCAL_MEM_FENCE | CLK_GLOBAL_MEM_FENCE);
+
+			for (int i = lid; i < n; i += lsize)
+			{
+				if (killed[i] || flood[i] == 0.0f) { continue; }
+				const int x = i % w;
+				const int y = i / w;
+				if ((x > 0 && killed[i - 1]) || (x < w - 1 && killed[i + 1]) || (y > 0 && killed[i - w]) || (y < h - 1 && killed[i + w]))
+				{
+					killed[i] = 1;
+					changed = 1;
+				}
+			}
+			barrier(CLK_LOCAL_MEM_FENCE | CLK_GLOBAL_MEM_FENCE);
+			if (changed == 0) { break; }
+			barrier(CLK_LOCAL_MEM_FENCE);
+		}
+
+		idx = argmax(out, killed, n, bv, bi, &max_val);
+	}
+
+	if (lid == 0)
+	{
+		result[0] = idx < n ? idx % w : -1;
+		result[1] = idx < n ? idx / w : -1;
+	}
+}
+)CLC";
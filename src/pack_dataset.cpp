@@ -0,0 +1,92 @@
+// packs a recorded session into a .timmpack file (see packed_dataset.h), for replay without decoding.
+//   pack_dataset <video file | image sequence pattern | image folder> <out.timmpack> [options]
+//     -gt <file.csv>       ground truth pupil centers (frame index, x, y), stored with the frames
+//     -ts <file.csv>       timestamps in seconds (frame index, t)
+//     -crop <x> <y> <w> <h> stores only this region of every frame (the ground truth is shifted accordingly)
+// all frames must have the same size.
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <map>
+
+#include "replay_source.h"
+#include "packed_dataset.h"
+
+std::map<size_t, double> load_timestamps(const std::string& filename)
+{
+	std::ifstream f(filename);
+	if (!f) { throw std::runtime_error("could not read timestamp file " + filename); }
+
+	std::map<size_t, double> ts;
+	std::string line;
+	while (std::getline(f, line))
+	{
+		std::replace(line.begin(), line.end(), ',', ' ');
+		std::replace(line.begin(), line.end(), ';', ' ');
+		std::istringstream is(line);
+		long long index;
+		double t;
+		if ((is >> index >> t) && index >= 0) { ts[size_t(index)] = t; }
+	}
+	return ts;
+}
+
+int main(int argc, char* argv[])
+{
+	using namespace std;
+
+	if (argc < 3)
+	{
+		cerr << "usage: pack_dataset <video file | image sequence pattern | image folder> <out.timmpack> [-gt file.csv] [-ts file.csv] [-crop x y w h]\n";
+		return 1;
+	}
+
+	string gt_file, ts_file;
+	cv::Rect crop;
+	for (int i = 3; i < argc; i++)
+	{
+		string a = argv[i];
+		if (a == "-gt" && i + 1 < argc) { gt_file = argv[++i]; }
+		else if (a == "-ts" && i + 1 < argc) { ts_file = argv[++i]; }
+		else if (a == "-crop" && i + 4 < argc)
+		{
+			crop.x = atoi(argv[i + 1]); crop.y = atoi(argv[i + 2]); crop.width = atoi(argv[i + 3]); crop.height = atoi(argv[i + 4]);
+			i += 4;
+		}
+		else { cerr << "unknown argument " << a << "\n"; return 1; }
+	}
+
+	map<size_t, cv::Point2f> gt;
+	map<size_t, double> ts;
+	int flags = 0;
+	if (!gt_file.empty()) { gt = load_ground_truth(gt_file); flags |= PACKED_GROUND_TRUTH; }
+	if (!ts_file.empty()) { ts = load_timestamps(ts_file); flags |= PACKED_TIMESTAMPS; }
+
+	Replay_source source(argv[1], 4);
+	unique_ptr<Packed_dataset_writer> writer;
+	Replay_source::frame f;
+	size_t n = 0;
+	while (source.next(f))
+	{
+		cv::Mat frame = f.gray;
+		if (crop.area() > 0)
+		{
+			if ((crop & cv::Rect(0, 0, frame.cols, frame.rows)).area() != crop.area()) { cerr << "crop region is outside of frame " << f.index << "\n"; return 1; }
+			frame = frame(crop);
+		}
+		if (!writer) { writer = make_unique<Packed_dataset_writer>(argv[2], frame.cols, frame.rows, flags); }
+
+		cv::Point2f p(-1, -1);
+		auto it = gt.find(f.index);
+		if (it != gt.end()) { p = it->second - cv::Point2f(crop.x, crop.y); }
+		auto it_ts = ts.find(f.index);
+		writer->add(frame, p, it_ts != ts.end() ? it_ts->second : 0.0);
+		n++;
+	}
+
+	if (!writer) { cerr << "no frames in " << argv[1] << "\n"; return 1; }
+	writer->close();
+	cout << "packed " << n << " frames into " << argv[2] << "\n";
+	return 0;
+}
@@ -0,0 +1,249 @@
+#pragma once
+
+#include <opencv2/core.hpp>
+
+#include <cstdint>
+#include <climits>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <stdexcept>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+// packed eye crop dataset (.timmpack): uncompressed 8 bit gray frames of one size, optionally with ground truth
+// pupil centers and timestamps. all values are little endian.
+//
+//   header (64 bytes, see packed_header)
+//   frames:      n_frames * frame_stride bytes at frames_offset. frame i starts at frames_offset + i * frame_stride,
+//                rows are width bytes apart. frame_stride is width * height rounded up to 64 bytes
+//   gt:          n_frames * 2 floats (x, y) at gt_offset, if flags & PACKED_GROUND_TRUTH. negative = no ground truth
+//   timestamps:  n_frames doubles (seconds) at timestamps_offset, if flags & PACKED_TIMESTAMPS
+//
+// frames_offset is page aligned, so every frame is 64 byte aligned in memory when the file is mapped.
+enum enum_packed_flags
+{
+	PACKED_GROUND_TRUTH = 1,
+	PACKED_TIMESTAMPS = 2
+};
+
+struct packed_header
+{
+	char magic[8];              // "TIMMPACK"
+	uint32_t version;           // 1
+	uint32_t width;
+	uint32_t height;
+	uint32_t flags;             // enum_packed_flags
+	uint64_t n_frames;
+	uint64_t frame_stride;
+	uint64_t frames_offset;
+	uint64_t gt_offset;
+	uint64_t timestamps_offset;
+};
+static_assert(sizeof(packed_header) == 64, "packed_header must be 64 bytes");
+
+
+// writes a .timmpack file frame by frame. ground truth and timestamps are kept in memory and appended by close()
+class Packed_dataset_writer
+{
+private:
+	std::ofstream f;
+	packed_header h;
+	std::vector<float> gt;
+	std::vector<double> timestamps;
+	std::vector<char> padding;
+
+	static const uint64_t page_size = 4096;
+
+	static uint64_t align(uint64_t x, uint64_t a) { return (x + a - 1) / a * a; }
+
+public:
+	Packed_dataset_writer(const std::string& filename, int width, int height, int flags = 0)
+	{
+		f.open(filename, std::ios::binary | std::ios::trunc);
+		if (!f) { throw std::runtime_error("Packed_dataset_writer: could not create " + filename); }
+
+		std::memset(&h, 0, sizeof(h));
+		std::memcpy(h.magic, "TIMMPACK", 8);
+		h.version = 1;
+		h.width = width;
+		h.height = height;
+		h.flags = flags;
+		h.frame_stride = align(uint64_t(width) * height, 64);
+		h.frames_offset = page_size;
+
+		// the header is rewritten by close(), when the counts and offsets are known
+		std::vector<char> zeros(page_size, 0);
+		f.write(zeros.data(), zeros.size());
+		padding.assign(h.frame_stride - uint64_t(width) * height, 0);
+	}
+
+	// call close() to see write errors, the destructor can only drop them
+	~Packed_dataset_writer()
+	{
+		if (!f.is_open()) { return; }
+		try { close(); }
+		catch (const std::exception&) {}
+	}
+
+	// frame must be 8 bit gray with the size given to the constructor.
+	// ground truth and timestamp are ignored unless the corresponding flag is set
+	void add(const cv::Mat& frame, cv::Point2f ground_truth = cv::Point2f(-1, -1), double timestamp = 0.0)
+	{
+		if (frame.type() != CV_8U || frame.cols != int(h.width) || frame.rows != int(h.height))
+		{
+			throw std::invalid_argument("Packed_dataset_writer: all frames must be 8 bit gray and of the same size");
+		}
+		for (int y = 0; y < frame.rows; y++) { f.write(frame.ptr<char>(y), frame.cols); }
+		f.write(padding.data(), padding.size());
+		gt.push_back(ground_truth.x);
+		gt.push_back(ground_truth.y);
+		timestamps.push_back(timestamp);
+		h.n_frames++;
+	}
+
+	void close()
+	{
+		uint64_t pos = h.frames_offset + h.n_frames * h.frame_stride;
+		if (h.flags & PACKED_GROUND_TRUTH)
+		{
+			h.gt_offset = pos;
+			f.write(reinterpret_cast<const char*>(gt.data()), gt.size() * sizeof(float));
+			pos += gt.size() * sizeof(float);
+		}
+		if (h.flags & PACKED_TIMESTAMPS)
+		{
+			h.timestamps_offset = pos;
+			f.write(reinterpret_cast<const char*>(timestamps.data()), timestamps.size() * sizeof(double));
+		}
+		f.seekp(0);
+		f.write(reinterpret_cast<const char*>(&h), sizeof(h));
+		f.close();
+		if (!f) { throw std::runtime_error("Packed_dataset_writer: write error"); }
+	}
+};
+
+
+// read access to a .timmpack file through a memory mapping: frame(i) is a cv::Mat header over the mapped pages, nothing is copied.
+// the mapping is copy-on-write, so in-place processing (e.g. the blur of Timm_two_stage::pupil_center) works,
+// but never changes the file. the returned frames are valid as long as the Packed_dataset exists
+class Packed_dataset
+{
+private:
+	const uint8_t* base = nullptr;
+	size_t file_size = 0;
+	packed_header h;
+
+	#ifdef _WIN32
+	HANDLE file = INVALID_HANDLE_VALUE;
+	HANDLE mapping = NULL;
+	#endif
+
+public:
+	Packed_dataset(const std::string& filename)
+	{
+		#ifdef _WIN32
+		file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+		if (file == INVALID_HANDLE_VALUE) { throw std::runtime_error("Packed_dataset: could not open " + filename); }
+		LARGE_INTEGER size;
+		GetFileSizeEx(file, &size);
+		file_size = size_t(size.QuadPart);
+		mapping = CreateFileMappingA(file, NULL, PAGE_WRITECOPY, 0, 0, NULL);
+		if (mapping) { base = static_cast<const uint8_t*>(MapViewOfFile(mapping, FILE_MAP_COPY, 0, 0, 0)); }
+		#else
+		int fd = open(filename.c_str(), O_RDONLY);
+		if (fd < 0) { throw std::runtime_error("Packed_dataset: could not open " + filename); }
+		struct stat st;
+		fstat(fd, &st);
+		file_size = size_t(st.st_size);
+		void* p = file_size > 0 ? mmap(NULL, file_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+		::close(fd); // the mapping keeps the file open
+		if (p != MAP_FAILED)
+		{
+			base = static_cast<const uint8_t*>(p);
+			madvise(p, file_size, MADV_SEQUENTIAL);
+		}
+		#endif
+
+		if (base == nullptr) { unmap(); throw std::runtime_error("Packed_dataset: could not map " + filename); }
+		if (file_size < sizeof(h)) { unmap(); throw std::runtime_error("Packed_dataset: " + filename + " is too small"); }
+		std::memcpy(&h, base, sizeof(h));
+		if (std::memcmp(h.magic, "TIMMPACK", 8) != 0 || h.version != 1) { unmap(); throw std::runtime_error("Packed_dataset: " + filename + " is not a timmpack file (version 1)"); }
+
+		// frame(i) reads height rows of width bytes, so frames must not overlap
+		if (h.width > uint32_t(INT_MAX) || h.height > uint32_t(INT_MAX) || h.frame_stride < uint64_t(h.width) * h.height)
+		{
+			unmap(); throw std::runtime_error("Packed_dataset: " + filename + " has an invalid frame size");
+		}
+
+		// a truncated file would crash on access, better fail here. the header is not trusted: offset + n * size can overflow
+		bool complete = fits(h.frames_offset, h.n_frames, h.frame_stride);
+		if (h.flags & PACKED_GROUND_TRUTH) { complete = complete && fits(h.gt_offset, h.n_frames, 2 * sizeof(float)); }
+		if (h.flags & PACKED_TIMESTAMPS) { complete = complete && fits(h.timestamps_offset, h.n_frames, sizeof(double)); }
+		if (!complete) { unmap(); throw std::runtime_error("Packed_dataset: " + filename + " is truncated"); }
+	}
+
+	~Packed_dataset() { unmap(); }
+
+	Packed_dataset(const Packed_dataset&) = delete;
+	Packed_dataset& operator=(const Packed_dataset&) = delete;
+
+	size_t size() const { return size_t(h.n_frames); }
+	int width() const { return int(h.width); }
+	int height() const { return int(h.height); }
+	bool has_ground_truth() const { return (h.flags & PACKED_GROUND_TRUTH) != 0; }
+	bool has_timestamps() const { return (h.flags & PACKED_TIMESTAMPS) != 0; }
+
+	// zero-copy view of frame i
+	cv::Mat frame(size_t i) const
+	{
+		return cv::Mat(h.height, h.width, CV_8U, const_cast<uint8_t*>(base + h.frames_offset + i * h.frame_stride), h.width);
+	}
+
+	// ground truth of frame i, negative if unknown
+	cv::Point2f ground_truth(size_t i) const
+	{
+		if (!has_ground_truth()) { return cv::Point2f(-1, -1); }
+		const float* p = reinterpret_cast<const float*>(base + h.gt_offset) + 2 * i;
+		return cv::Point2f(p[0], p[1]);
+	}
+
+	double timestamp(size_t i) const
+	{
+		if (!has_timestamps()) { return 0.0; }
+		return reinterpret_cast<const double*>(base + h.timestamps_offset)[i];
+	}
+
+private:
+	// true if n elements of the given size at offset are within the file
+	bool fits(uint64_t offset, uint64_t n, uint64_t element_size) const
+	{
+		if (offset > file_size) { return false; }
+		return element_size == 0 || n <= (file_size - offset) / element_size;
+	}
+
+	void unmap()
+	{
+		#ifdef _WIN32
+		if (base) { UnmapViewOfFile(base); }
+		if (mapping) { CloseHandle(mapping); }
+		if (file != INVALID_HANDLE_VALUE) { CloseHandle(file); }
+		mapping = NULL;
+		file = INVALID_HANDLE_VALUE;
+		#else
+		if (base) { munmap(const_cast<uint8_t*>(base), file_size); }
+		#endif
+		base = nullptr;
+	}
+};
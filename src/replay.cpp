@@ -0,0 +1,174 @@
+// headless replay of recorded eye camera sessions through Timm_two_stage, as fast as possible.
+//   replay <video file | image sequence pattern | image folder | .timmpack file> [options]
+//     -gt <file.csv>     ground truth pupil centers (frame index, x, y). default for .timmpack: the ground truth stored in the file
+//     -simd <n>          32, 128, 256, 512, 4096 (OpenCL). default: the widest CPU variant of this build up to 256
+//     -threads <n>       prefetch (decoding) threads for image folders, default 2
+//     -o <file.csv>      per frame results
+//     -show              visualize every frame (with ground truth, if given)
+//     -target_fps <f>    run through Load_shedder with this target frame rate, to audit the quality loss of load shedding.
+//                        the level changes are printed, the per frame output gets the quality level
+// reports throughput, per frame latency of pupil_center and the pixel error against the ground truth.
+// .timmpack files (see pack_dataset) are memory mapped and not decoded at all, so the throughput is that of the detector alone.
+
+#include <iostream>
+#include <fstream>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#include "timm_two_stage.h"
+#include "replay_source.h"
+#include "packed_dataset.h"
+#include "load_shedder.h"
+
+int main(int argc, char* argv[])
+{
+	using namespace std;
+	using clock = chrono::steady_clock;
+
+	if (argc < 2)
+	{
+		cerr << "usage: replay <video file | image sequence pattern | image folder | .timmpack file> [-gt file.csv] [-simd n] [-threads n] [-o file.csv] [-show] [-target_fps f]\n";
+		return 1;
+	}
+
+	string source_path = argv[1], gt_file, out_file;
+	int simd = Timm::default_simd_width();
+	int n_threads = 2;
+	bool show = false;
+	float target_fps = 0.0f;
+	for (int i = 2; i < argc; i++)
+	{
+		string a = argv[i];
+		if (a == "-gt" && i + 1 < argc) { gt_file = argv[++i]; }
+		else if (a == "-simd" && i + 1 < argc) { simd = atoi(argv[++i]); }
+		else if (a == "-threads" && i + 1 < argc) { n_threads = atoi(argv[++i]); }
+		else if (a == "-o" && i + 1 < argc) { out_file = argv[++i]; }
+		else if (a == "-show") { show = true; }
+		else if (a == "-target_fps" && i + 1 < argc) { target_fps = float(atof(argv[++i])); }
+		else { cerr << "unknown argument " << a << "\n"; return 1; }
+	}
+
+	// packed datasets bypass Replay_source, the frames are views into the mapped file
+	unique_ptr<Packed_dataset> pack;
+	unique_ptr<Replay_source> source;
+	const string ext = ".timmpack";
+	if (source_path.size() > ext.size() && source_path.compare(source_path.size() - ext.size(), ext.size(), ext) == 0)
+	{
+		pack = make_unique<Packed_dataset>(source_path);
+	}
+	else { source = make_unique<Replay_source>(source_path, n_threads); }
+
+	map<size_t, cv::Point2f> gt;
+	if (!gt_file.empty()) { gt = load_ground_truth(gt_file); }
+	else if (pack && pack->has_ground_truth())
+	{
+		for (size_t i = 0; i < pack->size(); i++)
+		{
+			const cv::Point2f p = pack->ground_truth(i);
+			if (p.x >= 0.0f && p.y >= 0.0f) { gt[i] = p; }
+		}
+	}
+
+	Timm_two_stage timm;
+	timm.setup(enum_simd_variant(simd));
+	timm.set_options(timm.opt);
+
+	unique_ptr<Load_shedder> shedder;
+	if (target_fps > 0.0f)
+	{
+		Load_shedder::options o;
+		o.target_fps = target_fps;
+		shedder = make_unique<Load_shedder>(timm, o);
+		shedder->log = &cout;
+	}
+
+	ofstream out;
+	if (!out_file.empty())
+	{
+		out.open(out_file);
+		out << "frame,x,y,x_coarse,y_coarse,latency_ms,error_px" << (shedder ? ",level\n" : "\n");
+	}
+
+	auto next = [&](Replay_source::frame& f)
+	{
+		if (source) { return source->next(f); }
+		if (f.gray.data != nullptr) { f.index++; } // first call: index 0
+		if (f.index >= pack->size()) { return false; }
+		f.gray = pack->frame(f.index);
+		return true;
+	};
+
+	vector<float> latencies, errors;
+	latencies.reserve(pack ? pack->size() : source->size());
+
+	Replay_source::frame f;
+	cv::Mat frame_color;
+	auto t_start = clock::now();
+	while (next(f))
+	{
+		auto t0 = clock::now();
+		cv::Point2f pos, pos_coarse;
+		int level = SHED_NONE;
+		if (shedder)
+		{
+			auto r = shedder->process(f.gray);
+			pos = r.pupil_pos;
+			pos_coarse = r.pupil_pos_coarse;
+			level = r.level;
+		}
+		else { std::tie(pos, pos_coarse) = timm.pupil_center(f.gray); }
+		const float latency = chrono::duration<float, milli>(clock::now() - t0).count();
+		latencies.push_back(latency);
+
+		auto it = gt.find(f.index);
+		float error = -1.0f;
+		if (it != gt.end())
+		{
+			error = cv::norm(pos - it->second);
+			errors.push_back(error);
+		}
+
+		if (out.is_open())
+		{
+			out << f.index << "," << pos.x << "," << pos.y << "," << pos_coarse.x << "," << pos_coarse.y << "," << latency << "," << error;
+			if (shedder) { out << "," << level; }
+			out << "\n";
+		}
+
+		if (show)
+		{
+			cv::cvtColor(f.gray, frame_color, cv::COLOR_GRAY2BGR);
+			timm.visualize_frame(frame_color, pos, pos_coarse, it != gt.end() ? &it->second : nullptr);
+			cv::imshow("replay", frame_color);
+			if (cv::waitKey(1) == 27) { break; }
+		}
+	}
+	const double t_total = chrono::duration<double>(clock::now() - t_start).count();
+
+	const size_t n = latencies.size();
+	if (n == 0) { cerr << "no frames in " << source_path << "\n"; return 1; }
+
+	double latency_sum = 0.0;
+	for (float l : latencies) { latency_sum += l; }
+	cout << "frames: " << n << ", throughput: " << n / t_total << (pack ? " fps\n" : " fps (including decoding)\n");
+	cout << "latency of pupil_center: mean " << latency_sum / n << " ms, median " << percentile(latencies, 0.5f)
+		<< " ms, 95% " << percentile(latencies, 0.95f) << " ms, max " << percentile(latencies, 1.0f) << " ms\n";
+
+	if (!errors.empty())
+	{
+		double error_sum = 0.0;
+		size_t n_within_5 = 0;
+		for (float e : errors) { error_sum += e; n_within_5 += e <= 5.0f; }
+		cout << "pixel error (" << errors.size() << " frames with ground truth): mean " << error_sum / errors.size()
+			<< ", median " << percentile(errors, 0.5f) << ", 95% " << percentile(errors, 0.95f)
+			<< ", within 5 px: " << 100.0 * n_within_5 / errors.size() << " %\n";
+	}
+	if (shedder) { shedder->print_stats(); }
+	return 0;
+}
+
+#ifdef OPENCL_ENABLED
+#include "opencl_kernel.cpp"
+#endif
@@ -0,0 +1,192 @@
+#pragma once
+
+#include <opencv2/imgproc.hpp>
+#include <opencv2/imgcodecs.hpp>
+#include <opencv2/videoio.hpp>
+
+#include <string>
+#include <vector>
+#include <map>
+#include <fstream>
+#include <sstream>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <algorithm>
+#include <filesystem>
+#include <stdexcept>
+#include <limits>
+
+// reads recorded eye camera sessions as gray frames, decoded ahead of time on prefetch threads:
+//  - a folder of images (sorted by file name), decoded by n_threads threads in parallel
+//  - a video file or an image sequence pattern like "eye_%05d.png" (anything cv::VideoCapture opens), decoded by one thread
+// at most queue_size decoded frames are buffered. frames are returned in order.
+class Replay_source
+{
+public:
+	struct frame
+	{
+		size_t index = 0;
+		cv::Mat gray;
+	};
+
+	Replay_source(const std::string& path, int n_threads = 2, size_t queue_size = 16) : queue_size(std::max<size_t>(1, queue_size))
+	{
+		namespace fs = std::filesystem;
+		if (fs::is_directory(path))
+		{
+			for (auto& e : fs::directory_iterator(path))
+			{
+				std::string ext = e.path().extension().string();
+				std::transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+				if (ext == ".png" || ext == ".jpg" || ext == ".jpeg" || ext == ".bmp" || ext == ".pgm" || ext == ".tif" || ext == ".tiff")
+				{
+					files.push_back(e.path().string());
+				}
+			}
+			std::sort(files.begin(), files.end());
+			n_total = files.size();
+			for (int i = 0; i < std::max(1, n_threads); i++) { workers.emplace_back([this]() { decode_files(); }); }
+		}
+		else
+		{
+			capture.open(path);
+			if (!capture.isOpened()) { throw std::runtime_error("Replay_source: could not open " + path); }
+			const double n = capture.get(cv::CAP_PROP_FRAME_COUNT);
+			n_total = n > 0 ? size_t(n) : 0;
+			workers.emplace_back([this]() { decode_video(); });
+		}
+	}
+
+	~Replay_source()
+	{
+		{
+			std::lock_guard<std::mutex> lock(mtx);
+			stop = true;
+		}
+		cv_space.notify_all();
+		for (auto& t : workers) { t.join(); }
+	}
+
+	Replay_source(const Replay_source&) = delete;
+	Replay_source& operator=(const Replay_source&) = delete;
+
+	// number of frames, 0 if unknown (some video containers)
+	size_t size() const { return n_total; }
+
+	// blocks until the next frame is decoded. returns false at the end of the session
+	bool next(frame& f)
+	{
+		std::unique_lock<std::mutex> lock(mtx);
+		cv_ready.wait(lock, [this]() { return ready.count(next_out) > 0 || (n_done_workers == workers.size() && ready.empty()) || end_index <= next_out; });
+		auto it = ready.find(next_out);
+		if (it == ready.end()) { return false; }
+		f.index = next_out;
+		f.gray = it->second;
+		ready.erase(it);
+		next_out++;
+		lock.unlock();
+		cv_space.notify_all();
+		return true;
+	}
+
+private:
+	std::vector<std::string> files;
+	cv::VideoCapture capture;
+	size_t n_total = 0;
+
+	const size_t queue_size;
+	std::map<size_t, cv::Mat> ready; // decoded frames by index
+	size_t next_out = 0;
+	size_t end_index = std::numeric_limits<size_t>::max(); // first index after the last frame, once known
+	size_t n_done_workers = 0;
+	bool stop = false;
+	std::atomic<size_t> next_file{ 0 };
+
+	std::mutex mtx;
+	std::condition_variable cv_ready, cv_space;
+	std::vector<std::thread> workers;
+
+	// waits until frame index fits into the buffer. returns false if the source is being destroyed
+	bool wait_for_space(size_t index)
+	{
+		std::unique_lock<std::mutex> lock(mtx);
+		cv_space.wait(lock, [&]() { return stop || index < next_out + queue_size; });
+		return !stop;
+	}
+
+	void push(size_t index, cv::Mat gray)
+	{
+		{
+			std::lock_guard<std::mutex> lock(mtx);
+			ready[index] = gray;
+		}
+		cv_ready.notify_all();
+	}
+
+	void worker_done()
+	{
+		{
+			std::lock_guard<std::mutex> lock(mtx);
+			n_done_workers++;
+		}
+		cv_ready.notify_all();
+	}
+
+	void decode_files()
+	{
+		while (true)
+		{
+			const size_t i = next_file++;
+			if (i >= files.size() || !wait_for_space(i)) { break; }
+			cv::Mat img = cv::imread(files[i], cv::IMREAD_GRAYSCALE);
+			// an unreadable file ends the session, so that the frame indices stay aligned with the ground truth
+			if (img.empty())
+			{
+				std::lock_guard<std::mutex> lock(mtx);
+				end_index = std::min(end_index, i);
+				break;
+			}
+			push(i, img);
+		}
+		worker_done();
+	}
+
+	void decode_video()
+	{
+		cv::Mat frame_bgr;
+		for (size_t i = 0; wait_for_space(i); i++)
+		{
+			if (!capture.read(frame_bgr) || frame_bgr.empty()) { break; }
+			cv::Mat gray;
+			if (frame_bgr.channels() == 1) { gray = frame_bgr.clone(); }
+			else { cv::cvtColor(frame_bgr, gray, cv::COLOR_BGR2GRAY); }
+			push(i, gray);
+		}
+		worker_done();
+	}
+};
+
+
+// ground truth pupil centers from a CSV file with the columns frame index, x, y (in pixels of the frame).
+// lines that do not start with a number (e.g. a header) are skipped, as are frames with negative coordinates (e.g. blinks)
+inline std::map<size_t, cv::Point2f> load_ground_truth(const std::string& filename)
+{
+	std::ifstream f(filename);
+	if (!f) { throw std::runtime_error("could not read ground truth file " + filename); }
+
+	std::map<size_t, cv::Point2f> gt;
+	std::string line;
+	while (std::getline(f, line))
+	{
+		std::replace(line.begin(), line.end(), ',', ' ');
+		std::replace(line.begin(), line.end(), ';', ' ');
+		std::istringstream is(line);
+		long long index;
+		float x, y;
+		if (!(is >> index >> x >> y) || index < 0) { continue; }
+		if (x >= 0.0f && y >= 0.0f) { gt[size_t(index)] = cv::Point2f(x, y); }
+	}
+	return gt;
+}
@@ -0,0 +1,160 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <thread>
+#include <cstring>
+#include <type_traits>
+#include <cstdint>
+
+// what Timm_two_stage publishes per frame
+struct pupil_result
+{
+	uint64_t frame_id = 0;              // counts the frames of the detector
+	uint64_t capture_timestamp_ns = 0;  // as given to pupil_center, 0 if not given
+	uint64_t publish_timestamp_ns = 0;  // steady_clock, when the result was published
+	float x = 0, y = 0;                 // pupil center (plain floats: cv::Point2f is not trivially copyable in every OpenCV version)
+	float x_coarse = 0, y_coarse = 0;   // estimate of stage 1
+	float confidence = 0.0f;            // of stage 2, see Timm::confidence
+	float stage_ms[2] = { 0, 0 };       // computation time of stage 1 (coarse) and stage 2 (fine)
+};
+
+// broadcast ring buffer of the last N results: one or more producers, any number of readers, each with its own position.
+//
+// publishing never waits for readers: it claims a slot with one fetch_add and writes it under a per-slot sequence number
+// (a seqlock), and takes a mutex only to wake up readers blocked in reader::wait (if there are any).
+// readers copy a slot and check its sequence number before and after, so they never see a partially written result.
+// a reader that falls more than N results behind skips the overwritten ones and counts them in n_lost().
+// with one producer, publish is wait-free. with several, a producer that laps the ring waits until the producer of the
+// same slot one lap earlier has finished, so that a slot is never written by two producers at once and its sequence
+// numbers only grow; this only happens if a producer is preempted while N results are published by the others.
+template<class T, size_t N = 256>
+class Result_stream
+{
+	static_assert(std::is_trivially_copyable<T>::value, "results are copied with memcpy");
+	static_assert(N >= 2, "the ring needs at least two slots");
+
+	struct alignas(64) slot
+	{
+		// 2 * position + 1 while the result at position is written, 2 * position + 2 when it is complete
+		std::atomic<uint64_t> seq{ 0 };
+		T value;
+	};
+
+	std::array<slot, N> slots;
+	alignas(64) std::atomic<uint64_t> head{ 0 }; // next position to be claimed by a producer
+
+	// blocking readers
+	alignas(64) std::atomic<int> n_waiting{ 0 };
+	std::mutex mtx;
+	std::condition_variable cv_published;
+
+public:
+	Result_stream() {}
+	Result_stream(const Result_stream&) = delete;
+	Result_stream& operator=(const Result_stream&) = delete;
+
+	void publish(const T& value)
+	{
+		const uint64_t pos = head.fetch_add(1, std::memory_order_relaxed);
+		slot& s = slots[pos % N];
+		// the result of the previous lap must be complete. with one producer it always is
+		const uint64_t previous = pos >= N ? 2 * (pos - N) + 2 : 0;
+		while (s.seq.load(std::memory_order_acquire) != previous) { std::this_thread::yield(); }
+		s.seq.store(2 * pos + 1, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release);
+		std::memcpy(&s.value, &value, sizeof(T));
+		s.seq.store(2 * pos + 2, std::memory_order_release);
+
+		// pairs with the increment of n_waiting in reader::wait, so that a reader never sleeps on a published result
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		if (n_waiting.load(std::memory_order_relaxed) > 0)
+		{
+			std::lock_guard<std::mutex> lock(mtx);
+			cv_published.notify_all();
+		}
+	}
+
+	// number of results published (claimed) so far
+	uint64_t size() const { return head.load(std::memory_order_acquire); }
+
+	class reader
+	{
+	public:
+		// starts with the next result that is published
+		reader(Result_stream& stream) : stream(&stream), next(stream.size()) {}
+
+		// copies the next result into out. returns false if there is none yet
+		bool poll(T& out)
+		{
+			while (true)
+			{
+				const slot& s = stream->slots[next % N];
+				const uint64_t expected = 2 * next + 2;
+				const uint64_t seq1 = s.seq.load(std::memory_order_acquire);
+				if (seq1 < expected) { return false; } // not yet (completely) written
+				if (seq1 == expected)
+				{
+					std::memcpy(&out, &s.value, sizeof(T));
+					std::atomic_thread_fence(std::memory_order_acquire);
+					if (s.seq.load(std::memory_order_relaxed) == expected)
+					{
+						next++;
+						return true;
+					}
+				}
+				// overwritten by a newer result: continue with the oldest one that is still in the ring
+				const uint64_t h = stream->size();
+				const uint64_t oldest = h > N ? h - N + 1 : 0; // +1: the slot of h - N may already be rewritten
+				if (oldest > next)
+				{
+					lost += oldest - next;
+					next = oldest;
+				}
+			}
+		}
+
+		// like poll, but waits up to timeout for a result. returns false on timeout
+		template<class Rep, class Period> bool wait(T& out, std::chrono::duration<Rep, Period> timeout)
+		{
+			if (poll(out)) { return true; }
+			const auto t_end = std::chrono::steady_clock::now() + timeout;
+			std::unique_lock<std::mutex> lock(stream->mtx);
+			stream->n_waiting.fetch_add(1, std::memory_order_seq_cst);
+			bool found = false;
+			while (!(found = poll(out)))
+			{
+				if (stream->cv_published.wait_until(lock, t_end) == std::cv_status::timeout)
+				{
+					found = poll(out);
+					break;
+				}
+			}
+			stream->n_waiting.fetch_sub(1, std::memory_order_relaxed);
+			return found;
+		}
+
+		// skips everything up to the newest result and copies it into out. returns false if nothing new was published
+		bool latest(T& out)
+		{
+			const uint64_t h = stream->size();
+			if (h > next + 1)
+			{
+				lost += h - 1 - next;
+				next = h - 1;
+			}
+			return poll(out);
+		}
+
+		// results that were overwritten before this reader got to them (or skipped by latest)
+		uint64_t n_lost() const { return lost; }
+
+	private:
+		Result_stream* stream;
+		uint64_t next;
+		uint64_t lost = 0;
+	};
+};
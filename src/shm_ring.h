@@ -0,0 +1,367 @@
+#pragma once
+
+// shared memory transport between timm_daemon and its client processes on the same machine (Linux only).
+//
+// the daemon creates one POSIX shared memory segment: a control_block followed by the frame slots of all clients.
+// every client owns one client_block with two single producer / single consumer rings:
+//  - frames:  the client writes a frame into a free slot (Shm_client::next_slot returns a cv::Mat over it) and
+//             advances frame_head. the daemon processes it in place and advances frame_tail, which frees the slot.
+//  - results: the daemon appends to results and advances result_head, the client reads and advances result_tail.
+// waiting is done with futexes on 32 bit counters in the segment: the daemon sleeps on the doorbell (rung by clients
+// after publishing a frame), a client on result_futex (new results) or slot_futex (free slots).
+// timestamps are CLOCK_MONOTONIC nanoseconds, which are comparable between processes.
+
+#ifndef __linux__
+#error "shm_ring.h needs Linux (POSIX shared memory and futexes)"
+#endif
+
+#include <opencv2/core.hpp>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <signal.h>
+#include <ctime>
+#include <climits>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <atomic>
+#include <string>
+#include <stdexcept>
+
+namespace shm_ring
+{
+	const uint32_t magic = 0x4d4d4954; // "TIMM"
+	const uint32_t version = 1;
+	const int max_clients = 32;
+	const int n_frame_slots = 8;
+	const int n_results = 64;
+
+	static_assert(sizeof(std::atomic<uint32_t>) == 4 && std::atomic<uint32_t>::is_always_lock_free, "futexes need plain 32 bit atomics");
+	static_assert(std::atomic<uint64_t>::is_always_lock_free, "the rings need lock free 64 bit atomics");
+
+	inline uint64_t now_ns()
+	{
+		timespec t;
+		clock_gettime(CLOCK_MONOTONIC, &t);
+		return uint64_t(t.tv_sec) * 1000000000ull + uint64_t(t.tv_nsec);
+	}
+
+	// the futexes live in a shared mapping, so FUTEX_PRIVATE_FLAG must not be used.
+	// returns when f != expected, on a wake up or after timeout_ms (< 0: no timeout)
+	inline void futex_wait(std::atomic<uint32_t>& f, uint32_t expected, int timeout_ms)
+	{
+		timespec ts{ timeout_ms / 1000, (timeout_ms % 1000) * 1000000L };
+		syscall(SYS_futex, reinterpret_cast<uint32_t*>(&f), FUTEX_WAIT, expected, timeout_ms >= 0 ? &ts : nullptr, nullptr, 0);
+	}
+
+	inline void futex_wake(std::atomic<uint32_t>& f)
+	{
+		syscall(SYS_futex, reinterpret_cast<uint32_t*>(&f), FUTEX_WAKE, INT_MAX, nullptr, nullptr, 0);
+	}
+
+	enum enum_client_state
+	{
+		CLIENT_FREE = 0,
+		CLIENT_CONNECTING = 1, // claimed by a client that is still initializing the block
+		CLIENT_CONNECTED = 2,
+		CLIENT_CLOSING = 3     // the client has disconnected, the daemon frees the block once its frames are done
+	};
+
+	struct frame_slot
+	{
+		uint64_t frame_id;
+		uint64_t t_submit_ns;
+		int32_t width;
+		int32_t height; // rows are width bytes apart
+	};
+
+	struct result
+	{
+		uint64_t frame_id;
+		uint64_t t_submit_ns;
+		uint64_t t_done_ns;
+		float x, y;             // -1 if the frame could not be processed (invalid size or a detector error)
+		float x_coarse, y_coarse;
+	};
+
+	struct alignas(64) client_block
+	{
+		std::atomic<uint32_t> state;
+		int32_t pid;
+		alignas(64) std::atomic<uint64_t> frame_head;  // frames published by the client
+		alignas(64) std::atomic<uint64_t> frame_tail;  // frames done by the daemon, their slots are free again
+		std::atomic<uint32_t> slot_futex;              // incremented by the daemon whenever frame_tail advances
+		alignas(64) std::atomic<uint64_t> result_head; // results published by the daemon
+		std::atomic<uint32_t> result_futex;            // incremented by the daemon with every result
+		std::atomic<uint64_t> n_results_dropped;       // the result ring was full because the client did not read it
+		alignas(64) std::atomic<uint64_t> result_tail; // results read by the client
+		frame_slot slots[n_frame_slots];
+		result results[n_results];
+	};
+
+	struct alignas(64) control_block
+	{
+		uint32_t magic;
+		uint32_t version;
+		int32_t max_width;
+		int32_t max_height;
+		uint64_t slot_size;     // bytes per frame slot
+		uint64_t frames_offset; // of slot 0 of client 0
+		int32_t daemon_pid;
+		std::atomic<uint32_t> daemon_running;
+		alignas(64) std::atomic<uint32_t> doorbell; // incremented by the clients after publishing a frame
+		client_block clients[max_clients];
+	};
+
+	inline uint64_t page_align(uint64_t x) { return (x + 4095) / 4096 * 4096; }
+
+	// the frame slots are only backed by memory once they are written, so a generous max size costs little
+	inline uint64_t segment_size(int max_width, int max_height)
+	{
+		return page_align(sizeof(control_block)) + uint64_t(max_clients) * n_frame_slots * page_align(uint64_t(max_width) * max_height);
+	}
+
+	inline uint8_t* slot_data(control_block* c, int client, uint64_t seq)
+	{
+		return reinterpret_cast<uint8_t*>(c) + c->frames_offset + (uint64_t(client) * n_frame_slots + seq % n_frame_slots) * c->slot_size;
+	}
+
+	// mapping of the shared memory segment
+	class Segment
+	{
+	public:
+		control_block* ctl = nullptr;
+
+		Segment() {}
+
+		// daemon side: creates (or replaces a stale) segment. it is only accessible to the user of the daemon (0600),
+		// unless group is given: then it belongs to that group and is accessible to its members as well (0660)
+		Segment(const std::string& name, int max_width, int max_height, gid_t group = gid_t(-1)) : name(name), owner(true)
+		{
+			// a segment of a crashed daemon is replaced, one of a running daemon is not
+			if (open_existing())
+			{
+				const bool alive = ctl->daemon_running.load() && kill(ctl->daemon_pid, 0) == 0;
+				unmap();
+				if (alive) { throw std::runtime_error("a daemon is already running on " + name); }
+				shm_unlink(name.c_str());
+			}
+
+			size = segment_size(max_width, max_height);
+			const bool shared = group != gid_t(-1);
+			int fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+			if (fd < 0) { throw std::runtime_error("could not create shared memory " + name + ": " + strerror(errno)); }
+			// the mode is set after the group, so that the segment is never accessible to the wrong group
+			if (shared && (fchown(fd, uid_t(-1), group) != 0 || fchmod(fd, 0660) != 0))
+			{
+				const std::string error = strerror(errno);
+				::close(fd);
+				shm_unlink(name.c_str());
+				throw std::runtime_error("could not give shared memory " + name + " to group " + std::to_string(group) + ": " + error);
+			}
+			if (ftruncate(fd, off_t(size)) != 0) { ::close(fd); shm_unlink(name.c_str()); throw std::runtime_error("could not resize shared memory " + name); }
+			map(fd);
+
+			// the new segment is zero filled, i.e. all counters are 0 and all clients are CLIENT_FREE
+			ctl->max_width = max_width;
+			ctl->max_height = max_height;
+			ctl->slot_size = page_align(uint64_t(max_width) * max_height);
+			ctl->frames_offset = page_align(sizeof(control_block));
+			ctl->daemon_pid = getpid();
+			ctl->version = version;
+			ctl->daemon_running.store(1);
+			std::atomic_thread_fence(std::memory_order_release);
+			ctl->magic = magic;
+		}
+
+		// client side
+		static Segment open(const std::string& name)
+		{
+			Segment s;
+			s.name = name;
+			if (!s.open_existing()) { throw std::runtime_error("no daemon running on " + name); }
+			if (s.ctl->magic != magic || s.ctl->version != version || !s.ctl->daemon_running.load())
+			{
+				throw std::runtime_error("shared memory " + name + " is not a running timm daemon (version " + std::to_string(version) + ")");
+			}
+			return s;
+		}
+
+		Segment(Segment&& o) noexcept { *this = std::move(o); }
+		Segment& operator=(Segment&& o) noexcept
+		{
+			std::swap(ctl, o.ctl);
+			std::swap(size, o.size);
+			std::swap(name, o.name);
+			std::swap(owner, o.owner);
+			return *this;
+		}
+		Segment(const Segment&) = delete;
+		Segment& operator=(const Segment&) = delete;
+
+		~Segment()
+		{
+			if (ctl && owner)
+			{
+				ctl->daemon_running.store(0);
+				shm_unlink(name.c_str());
+			}
+			unmap();
+		}
+
+	private:
+		uint64_t size = 0;
+		std::string name;
+		bool owner = false;
+
+		bool open_existing()
+		{
+			int fd = shm_open(name.c_str(), O_RDWR, 0);
+			if (fd < 0) { return false; }
+			struct stat st;
+			if (fstat(fd, &st) != 0 || uint64_t(st.st_size) < sizeof(control_block)) { ::close(fd); return false; }
+			size = uint64_t(st.st_size);
+			map(fd);
+			return true;
+		}
+
+		void map(int fd)
+		{
+			void* p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+			::close(fd); // the mapping keeps the segment open
+			if (p == MAP_FAILED) { throw std::runtime_error("could not map shared memory " + name); }
+			ctl = static_cast<control_block*>(p);
+		}
+
+		void unmap()
+		{
+			if (ctl) { munmap(ctl, size); }
+			ctl = nullptr;
+		}
+	};
+}
+
+
+// client of timm_daemon: submits frames and receives the pupil centers. not thread safe, except that
+// submitting and receiving may happen on two different threads
+class Shm_client
+{
+public:
+	using result = shm_ring::result;
+
+	Shm_client(const std::string& name = "/timm") : seg(shm_ring::Segment::open(name))
+	{
+		using namespace shm_ring;
+		for (int i = 0; i < max_clients; i++)
+		{
+			uint32_t expected = CLIENT_FREE;
+			if (seg.ctl->clients[i].state.compare_exchange_strong(expected, CLIENT_CONNECTING))
+			{
+				index = i;
+				break;
+			}
+		}
+		if (index < 0) { throw std::runtime_error("timm daemon: all " + std::to_string(max_clients) + " client slots are in use"); }
+		cb = &seg.ctl->clients[index];
+		cb->pid = getpid();
+		cb->state.store(CLIENT_CONNECTED, std::memory_order_release);
+	}
+
+	~Shm_client()
+	{
+		cb->state.store(shm_ring::CLIENT_CLOSING, std::memory_order_release);
+		ring_doorbell();
+	}
+
+	Shm_client(const Shm_client&) = delete;
+	Shm_client& operator=(const Shm_client&) = delete;
+
+	int max_width() const { return seg.ctl->max_width; }
+	int max_height() const { return seg.ctl->max_height; }
+	uint64_t n_results_dropped() const { return cb->n_results_dropped.load(); }
+
+	// waits for a free frame slot and returns a view of it. write the frame into it and call publish.
+	// returns an empty Mat after timeout_ms (< 0: wait forever)
+	cv::Mat next_slot(int width, int height, int timeout_ms = -1)
+	{
+		using namespace shm_ring;
+		if (width <= 0 || height <= 0 || width > max_width() || height > max_height())
+		{
+			throw std::invalid_argument("Shm_client: frame size must be within the max size of the daemon");
+		}
+		const uint64_t head = cb->frame_head.load(std::memory_order_relaxed);
+		const uint64_t t_end = now_ns() + uint64_t(std::max(0, timeout_ms)) * 1000000ull;
+		while (true)
+		{
+			const uint32_t seen = cb->slot_futex.load(std::memory_order_acquire);
+			if (head - cb->frame_tail.load(std::memory_order_acquire) < uint64_t(n_frame_slots)) { break; }
+			if (timeout_ms >= 0 && now_ns() >= t_end) { return cv::Mat(); }
+			futex_wait(cb->slot_futex, seen, timeout_ms < 0 ? 100 : std::min(100, timeout_ms));
+		}
+		slot_width = width;
+		slot_height = height;
+		return cv::Mat(height, width, CV_8U, slot_data(seg.ctl, index, head), width);
+	}
+
+	// hands the frame in the slot of next_slot over to the daemon
+	void publish(uint64_t frame_id)
+	{
+		using namespace shm_ring;
+		const uint64_t head = cb->frame_head.load(std::memory_order_relaxed);
+		auto& slot = cb->slots[head % n_frame_slots];
+		slot.frame_id = frame_id;
+		slot.t_submit_ns = now_ns();
+		slot.width = slot_width;
+		slot.height = slot_height;
+		cb->frame_head.store(head + 1, std::memory_order_release);
+		ring_doorbell();
+	}
+
+	// copies frame (8 bit gray) into the next slot and publishes it. returns false after timeout_ms without a free slot
+	bool submit(const cv::Mat& frame, uint64_t frame_id, int timeout_ms = -1)
+	{
+		cv::Mat slot = next_slot(frame.cols, frame.rows, timeout_ms);
+		if (slot.empty()) { return false; }
+		frame.copyTo(slot);
+		publish(frame_id);
+		return true;
+	}
+
+	// next result. returns false after timeout_ms (< 0: wait forever) without one
+	bool receive(result& r, int timeout_ms = -1)
+	{
+		using namespace shm_ring;
+		const uint64_t tail = cb->result_tail.load(std::memory_order_relaxed);
+		const uint64_t t_end = now_ns() + uint64_t(std::max(0, timeout_ms)) * 1000000ull;
+		while (true)
+		{
+			const uint32_t seen = cb->result_futex.load(std::memory_order_acquire);
+			if (cb->result_head.load(std::memory_order_acquire) != tail) { break; }
+			if (timeout_ms >= 0 && now_ns() >= t_end) { return false; }
+			if (!seg.ctl->daemon_running.load()) { return false; }
+			futex_wait(cb->result_futex, seen, timeout_ms < 0 ? 100 : std::min(100, timeout_ms));
+		}
+		r = cb->results[tail % n_results];
+		cb->result_tail.store(tail + 1, std::memory_order_release);
+		return true;
+	}
+
+private:
+	shm_ring::Segment seg;
+	shm_ring::client_block* cb = nullptr;
+	int index = -1;
+	int slot_width = 0;
+	int slot_height = 0;
+
+	void ring_doorbell()
+	{
+		seg.ctl->doorbell.fetch_add(1, std::memory_order_release);
+		shm_ring::futex_wake(seg.ctl->doorbell);
+	}
+};
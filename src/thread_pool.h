@@ -0,0 +1,194 @@
+#pragma once
+
+#include <vector>
+#include <queue>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <memory>
+#include <exception>
+#include <algorithm>
+#include <cstdint>
+
+// minimal fixed size thread pool with a FIFO task queue
+class Thread_pool
+{
+private:
+	std::vector<std::thread> workers;
+	std::queue<std::function<void()>> tasks;
+	std::mutex mtx;
+	std::condition_variable cv_task;
+	bool stop = false;
+
+public:
+	// on_worker_start(i) is called by worker i before it takes tasks, e.g. to pin it to a cpu (see affinity.h)
+	Thread_pool(int n_threads = std::thread::hardware_concurrency(), std::function<void(int worker)> on_worker_start = nullptr)
+	{
+		n_threads = std::max(1, n_threads);
+		for (int i = 0; i < n_threads; i++)
+		{
+			workers.emplace_back([this, i, on_worker_start]()
+			{
+				if (on_worker_start) { on_worker_start(i); }
+				worker_loop();
+			});
+		}
+	}
+
+	~Thread_pool()
+	{
+		{
+			std::lock_guard<std::mutex> lock(mtx);
+			stop = true;
+		}
+		cv_task.notify_all();
+		for (auto& t : workers) { t.join(); }
+	}
+
+	Thread_pool(const Thread_pool&) = delete;
+	Thread_pool& operator=(const Thread_pool&) = delete;
+
+	int size() const { return int(workers.size()); }
+
+	void push(std::function<void()> task)
+	{
+		{
+			std::lock_guard<std::mutex> lock(mtx);
+			tasks.push(std::move(task));
+		}
+		cv_task.notify_one();
+	}
+
+	template<class F> auto submit(F f) -> std::future<decltype(f())>
+	{
+		auto task = std::make_shared<std::packaged_task<decltype(f())()>>(std::move(f));
+		auto result = task->get_future();
+		push([task]() { (*task)(); });
+		return result;
+	}
+
+private:
+	void worker_loop()
+	{
+		while (true)
+		{
+			std::function<void()> task;
+			{
+				std::unique_lock<std::mutex> lock(mtx);
+				cv_task.wait(lock, [this]() { return stop || !tasks.empty(); });
+				if (stop && tasks.empty()) { return; }
+				task = std::move(tasks.front());
+				tasks.pop();
+			}
+			task();
+		}
+	}
+};
+
+
+// fork-join team of persistent threads for the parallel loops of one caller (e.g. Timm::n_threads).
+// run(n, f) calls f(0) on the calling thread and f(i) on worker i for 0 < i < n, and returns when all of them are done.
+// unlike Thread_pool::submit, a run allocates nothing and starts no thread, the workers sleep in between.
+// run must not be called concurrently.
+class Worker_team
+{
+private:
+	std::vector<std::thread> workers;
+	std::mutex mtx;
+	std::condition_variable cv_start, cv_done;
+	uint64_t generation = 0;
+	int n_tasks = 0;
+	int n_running = 0;
+	void (*task)(void*, int) = nullptr;
+	void* context = nullptr;
+	std::exception_ptr error;
+	bool stop = false;
+
+public:
+	// n_workers threads besides the caller. on_worker_start(i) is called by worker i (1..n_workers) before its first task
+	Worker_team(int n_workers, std::function<void(int worker)> on_worker_start = nullptr)
+	{
+		for (int i = 1; i <= n_workers; i++)
+		{
+			workers.emplace_back([this, i, on_worker_start]()
+			{
+				if (on_worker_start) { on_worker_start(i); }
+				worker_loop(i);
+			});
+		}
+	}
+
+	~Worker_team()
+	{
+		{
+			std::lock_guard<std::mutex> lock(mtx);
+			stop = true;
+		}
+		cv_start.notify_all();
+		for (auto& t : workers) { t.join(); }
+	}
+
+	Worker_team(const Worker_team&) = delete;
+	Worker_team& operator=(const Worker_team&) = delete;
+
+	// including the calling thread
+	int size() const { return int(workers.size()) + 1; }
+
+	// n is limited to size(). the first exception of f is rethrown after all parts have finished
+	template<class F> void run(int n, F& f)
+	{
+		n = std::min(n, size());
+		if (n > 1)
+		{
+			{
+				std::lock_guard<std::mutex> lock(mtx);
+				task = [](void* c, int i) { (*static_cast<F*>(c))(i); };
+				context = &f;
+				n_tasks = n;
+				n_running = n - 1;
+				error = nullptr;
+				generation++;
+			}
+			cv_start.notify_all();
+		}
+
+		std::exception_ptr own_error;
+		try { f(0); }
+		catch (...) { own_error = std::current_exception(); }
+
+		if (n > 1)
+		{
+			// f lives on the stack of the caller, so the workers have to be finished in any case
+			std::unique_lock<std::mutex> lock(mtx);
+			cv_done.wait(lock, [this]() { return n_running == 0; });
+			if (!own_error) { own_error = error; }
+		}
+		if (own_error) { std::rethrow_exception(own_error); }
+	}
+
+private:
+	void worker_loop(int i)
+	{
+		uint64_t seen = 0;
+		std::unique_lock<std::mutex> lock(mtx);
+		while (true)
+		{
+			cv_start.wait(lock, [&]() { return stop || generation != seen; });
+			if (stop) { return; }
+			seen = generation;
+			if (i >= n_tasks) { continue; }
+
+			auto t = task;
+			auto c = context;
+			lock.unlock();
+			std::exception_ptr e;
+			try { t(c, i); }
+			catch (...) { e = std::current_exception(); }
+			lock.lock();
+			if (e && !error) { error = e; }
+			if (--n_running == 0) { cv_done.notify_one(); }
+		}
+	}
+};
@@ -1,15 +1,50 @@
 #include "timm.h"
 
-#include <queue>
 #include <iostream>
 #include <opencv2/highgui/highgui.hpp>
 
 
-cv::Point Timm::pupil_center(const cv::Mat& eye_img)
+cv::Point2f Timm::pupil_center(const cv::Mat& eye_img)
 {
-	using namespace std;
-
 	pre_process(eye_img);
+	return undo_scaling(find_center(), eye_img.cols);
+}
+
+
+void Timm_gradients::compute(const cv::Mat& frame, cv::Rect region_, float scale_, int sobel)
+{
+	region = region_ & cv::Rect(0, 0, frame.cols, frame.rows);
+	scale = scale_;
+	cv::resize(frame(region), img_scaled, cv::Size(std::max(1, int(round(region.width / scale))), std::max(1, int(round(region.height / scale)))));
+	cv::Sobel(img_scaled, gradient_x, CV_32F, 1, 0, sobel);
+	cv::Sobel(img_scaled, gradient_y, CV_32F, 0, 1, sobel);
+	cv::magnitude(gradient_x, gradient_y, mags);
+}
+
+
+cv::Point2f Timm::pupil_center_shared(const Timm_gradients& g, cv::Rect roi)
+{
+	// the roi in scaled pixels of g
+	cv::Rect r(int(round((roi.x - g.region.x) / g.scale)), int(round((roi.y - g.region.y) / g.scale)),
+		int(round(roi.width / g.scale)), int(round(roi.height / g.scale)));
+	r &= cv::Rect(0, 0, g.img_scaled.cols, g.img_scaled.rows);
+	if (r.area() == 0) { throw std::invalid_argument("Timm::pupil_center_shared: roi outside of the gradient region"); }
+
+	// copies: the normalization below works in place, and the buffers have to be continuous for prepare_data
+	g.img_scaled(r).copyTo(img_scaled);
+	g.gradient_x(r).copyTo(gradient_x);
+	g.gradient_y(r).copyTo(gradient_y);
+	g.mags(r).copyTo(mags);
+	normalize_gradients();
+
+	const cv::Point2f p = find_center();
+	return cv::Point2f(g.region.x + g.scale * (r.x + p.x + 0.5f) - 0.5f, g.region.y + g.scale * (r.y + p.y + 0.5f) - 0.5f);
+}
+
+
+cv::Point2f Timm::find_center()
+{
+	using namespace std;
 
 	/* // old timing code for the paper
 	timer2.tick(); 
@@ -20,48 +55,15 @@ cv::Point Timm::pupil_center(const cv::Mat& eye_img)
 
 	prepare_data();
 
-	// faster code using hand optimized objective function		
-	// todo: parallelize with std::async threadpools
-	//auto cols = outSum.cols;
-	auto data = out_sum.ptr<float>(0);
-	size_t idx = 0;
-
-	// https://docs.microsoft.com/en-us/cpp/parallel/auto-parallelization-and-auto-vectorization
-	// compiler switch must be enabled  /Qpar /Qpar-report:1 
-	// #pragma loop(hint_parallel(2))
+	select_candidates();
 
-	const size_t cols = out_sum.cols;
-	auto pixel_loop = [&](const int y1, const int y2)
+	if (use_gradient_major())
 	{
-		//for (size_t y = 0; y < out_sum.rows; y++)
-		for (size_t y = y1; y <= y2; y++)
-		{
-			for (size_t x = 0; x < out_sum.cols; x++)
-			{
-				//data[y*cols + x] = calc_objective_function(x, y, gradientX, gradientY); // 70.1 ms
-				//data[y*cols + x] = calc_objective_function_cache_friendly(x, y, gradients); // 11.5 ms
-				data[y*cols + x] = kernel(x, y, gradients);
-			}
-		}
-	};
-
-	if (n_threads > 1)
-	{
-		// create threads
-		threads.clear();
-		int block_size = ceil(float(out_sum.rows) / float(n_threads));
-		for (int i = 0; i < n_threads; i++)
-		{
-			int y1 = i * block_size;
-			int y2 = std::min((i + 1) * block_size - 1, out_sum.rows-1);
-			threads.emplace_back( thread(pixel_loop, y1, y2) );
-		}
-		// wait for completion of all threads
-		for (auto& t : threads) { t.join(); }
+		objective_gradient_major();
 	}
 	else
 	{
-		pixel_loop(0, out_sum.rows - 1);
+		objective_center_major();
 	}
 
 	cv::multiply(out_sum, weight_float, out);
@@ -94,11 +96,191 @@ cv::Point Timm::pupil_center(const cv::Mat& eye_img)
 	_ReadWriteBarrier(); measure_timings[1] = timer2.tock(false);
 	//*/
 
-	return undo_scaling(post_process(), eye_img.cols);
+	return post_process();
+}
+
+
+void Timm::objective_center_major()
+{
+	using namespace std;
+
+	// faster code using hand optimized objective function		
+	// todo: parallelize with std::async threadpools
+	//auto cols = outSum.cols;
+	auto data = out_sum.ptr<float>(0);
+
+	// https://docs.microsoft.com/en-us/cpp/parallel/auto-parallelization-and-auto-vectorization
+	// compiler switch must be enabled  /Qpar /Qpar-report:1 
+	// #pragma loop(hint_parallel(2))
+
+	// only the candidate centers are evaluated, all other entries of out_sum stay zero
+	const int cols = out_sum.cols;
+	auto pixel_loop = [&](const int i1, const int i2)
+	{
+		for (int i = i1; i <= i2; i++)
+		{
+			const int idx = candidates[i];
+			//data[y*cols + x] = calc_objective_function(x, y, gradientX, gradientY); // 70.1 ms
+			//data[y*cols + x] = calc_objective_function_cache_friendly(x, y, gradients); // 11.5 ms
+			data[idx] = kernel(idx % cols, idx / cols, gradients);
+		}
+	};
+
+	const int n_candidates = candidates.size();
+	if (n_threads > 1)
+	{
+		// one block of candidates per thread, the calling thread takes the first one
+		const int block_size = ceil(float(n_candidates) / float(n_threads));
+		auto block = [&](int i) { pixel_loop(i * block_size, std::min((i + 1) * block_size - 1, n_candidates - 1)); };
+		worker_team().run(n_threads, block);
+	}
+	else
+	{
+		pixel_loop(0, n_candidates - 1);
+	}
+}
+
+
+Worker_team& Timm::worker_team()
+{
+	if (!team || team->size() != n_threads || team_affinity.cpus != affinity.cpus || team_affinity.realtime_priority != affinity.realtime_priority)
+	{
+		team.reset();
+		team_affinity = affinity;
+		const worker_affinity a = affinity;
+		std::function<void(int)> on_start = nullptr;
+		if (a.enabled()) { on_start = [a](int i) { a.apply(i - 1); }; }
+		team = std::make_unique<Worker_team>(n_threads - 1, on_start);
+	}
+	return *team;
+}
+
+
+bool Timm::use_gradient_major()
+{
+	switch (opt.engine)
+	{
+	case ENGINE_CENTER_MAJOR: return false;
+	case ENGINE_GRADIENT_MAJOR: return true;
+	default:
+		{
+			// both layouts do n_gradients * n_centers kernel evaluations. the center-major loop pays a horizontal sum
+			// per center, the gradient-major loop a row setup per gradient and row, which wins if gradients are few.
+			return n_gradients < opt.gradient_major_ratio * candidates.size();
+		}
+	}
+}
+
+
+void Timm::objective_gradient_major()
+{
+	using namespace std;
+
+	const int cols = out_sum.cols;
+	const size_t n_floats = simd_width / (8 * sizeof(float));
+
+	// only the rows spanned by the candidates are accumulated
+	const int y1 = candidates.front() / cols;
+	const int y2 = candidates.back() / cols;
+	// the zero padding of the last chunk is skipped
+	const int n_gradients = this->n_gradients;
+	const int n_workers = std::max(1, std::min(n_threads, n_gradients));
+
+	// every thread accumulates into its own buffer, so no synchronisation is needed.
+	// the buffer is allocated and zeroed by its thread, so that its pages are first touched on the node of that thread.
+	// it has the size of out_sum, so it is only reallocated when the image size changes, not with the span of the candidates
+	thread_sums.resize(n_workers);
+
+	auto gradient_loop = [&](cv::Mat& acc, const int g1, const int g2)
+	{
+		acc.create(out_sum.rows, cols, CV_32F);
+		acc.rowRange(y1, y2 + 1).setTo(0.0f);
+		for (int g = g1; g <= g2; g++)
+		{
+			// gradients are stored in chunks of n_floats x, n_floats y, n_floats gx and n_floats gy
+			const float* sd = &gradients[(g / n_floats) * 4 * n_floats + g % n_floats];
+			for (int cy = y1; cy <= y2; cy++)
+			{
+				scatter_row(sd[0], sd[n_floats], sd[2 * n_floats], sd[3 * n_floats], cy, acc.ptr<float>(cy), cols);
+			}
+		}
+	};
+
+	if (n_workers > 1)
+	{
+		const int block_size = ceil(float(n_gradients) / float(n_workers));
+		auto block = [&](int i) { gradient_loop(thread_sums[i], i * block_size, std::min((i + 1) * block_size - 1, n_gradients - 1)); };
+		worker_team().run(n_workers, block);
+
+		// merge the per thread sums of the used rows (cv::add is vectorized)
+		cv::Mat sum = thread_sums[0].rowRange(y1, y2 + 1);
+		for (int i = 1; i < n_workers; i++) { cv::add(sum, thread_sums[i].rowRange(y1, y2 + 1), sum); }
+	}
+	else
+	{
+		gradient_loop(thread_sums[0], 0, n_gradients - 1);
+	}
+
+	// copy back the candidate centers only, all other entries of out_sum stay zero
+	auto data = out_sum.ptr<float>(0);
+	auto acc = thread_sums[0].ptr<float>(0);
+	for (int idx : candidates) { data[idx] = acc[idx]; }
+}
+
+
+void Timm::scatter_row(float x, float y, float gx, float gy, float cy, float* row, int cols)
+{
+	switch (rsqrt_precision())
+	{
+	case RSQRT_ESTIMATE: scatter_row_t<RSQRT_ESTIMATE>(x, y, gx, gy, cy, row, cols); break;
+	case RSQRT_NEWTON: scatter_row_t<RSQRT_NEWTON>(x, y, gx, gy, cy, row, cols); break;
+	case RSQRT_EXACT: scatter_row_t<RSQRT_EXACT>(x, y, gx, gy, cy, row, cols); break;
+	default: throw std::invalid_argument("wrong rsqrt_precision in Timm::scatter_row"); break;
+	}
+}
+
+template<int precision> void Timm::scatter_row_t(float x, float y, float gx, float gy, float cy, float* row, int cols)
+{
+	int cx = 0;
+	switch (simd_width)
+	{
+	case USE_NO_VEC: break;
+
+	#ifdef TIMM_X86_VEC128
+	case USE_VEC128: for (; cx + 4 <= cols; cx += 4) { scatter_op_sse<precision>(x, y, gx, gy, cx, cy, row + cx); } break;
+	#endif
+	#ifdef TIMM_X86_VEC256
+	case USE_VEC256: for (; cx + 8 <= cols; cx += 8) { scatter_op_avx2<precision>(x, y, gx, gy, cx, cy, row + cx); } break;
+	#endif
+	#ifdef TIMM_X86_VEC512
+	case USE_VEC512: for (; cx + 16 <= cols; cx += 16) { scatter_op_avx512<precision>(x, y, gx, gy, cx, cy, row + cx); } break;
+	#endif
+
+	#ifdef __arm__
+	case USE_VEC128: for (; cx + 4 <= cols; cx += 4) { scatter_op_arm128<precision>(x, y, gx, gy, cx, cy, row + cx); } break;
+	#endif
+
+	// like kernel_t. setup rejects these widths already
+	default: throw std::invalid_argument("wrong or unsupported vectorization width in Timm::scatter_row"); break;
+	}
+
+	// remaining columns (or all columns without vectorization)
+	for (; cx < cols; cx++) { row[cx] += scatter_op<precision>(x, y, gx, gy, cx, cy); }
 }
 
 
 float Timm::kernel(float cx, float cy, const std::vector<float>& gradients)
+{
+	switch (rsqrt_precision())
+	{
+	case RSQRT_ESTIMATE: return kernel_t<RSQRT_ESTIMATE>(cx, cy, gradients);
+	case RSQRT_NEWTON: return kernel_t<RSQRT_NEWTON>(cx, cy, gradients);
+	case RSQRT_EXACT: return kernel_t<RSQRT_EXACT>(cx, cy, gradients);
+	default: throw std::invalid_argument("wrong rsqrt_precision in Timm::kernel"); break;
+	}
+}
+
+template<int precision> float Timm::kernel_t(float cx, float cy, const std::vector<float>& gradients)
 {
 	using namespace std;
 
@@ -110,16 +292,20 @@ float Timm::kernel(float cx, float cy, const std::vector<float>& gradients)
 	// a bit of code duplication. just to make really sure there is zero overhead. (the switch could also be inside the for loop and normally the compiler should optimize that away because simd_width is const)
 	switch (simd_width)
 	{
-	case USE_NO_VEC: for (size_t i = 0; i < s; i += 4 * n_floats) { c_out += kernel_op(cx, cy, &gradients[i]); } break;
+	case USE_NO_VEC: for (size_t i = 0; i < s; i += 4 * n_floats) { c_out += kernel_op<precision>(cx, cy, &gradients[i]); } break;
 	
-	#ifdef _WIN32
-	case USE_VEC128: for (size_t i = 0; i < s; i += 4 * n_floats) { c_out += kernel_op_sse(cx, cy, &gradients[i]); } break;
-	case USE_VEC256: for (size_t i = 0; i < s; i += 4 * n_floats) { c_out += kernel_op_avx2(cx, cy, &gradients[i]); } break;
-	case USE_VEC512: for (size_t i = 0; i < s; i += 4 * n_floats) { c_out += kernel_op_avx512(cx, cy, &gradients[i]); } break;
+	#ifdef TIMM_X86_VEC128
+	case USE_VEC128: for (size_t i = 0; i < s; i += 4 * n_floats) { c_out += kernel_op_sse<precision>(cx, cy, &gradients[i]); } break;
+	#endif
+	#ifdef TIMM_X86_VEC256
+	case USE_VEC256: for (size_t i = 0; i < s; i += 4 * n_floats) { c_out += kernel_op_avx2<precision>(cx, cy, &gradients[i]); } break;
+	#endif
+	#ifdef TIMM_X86_VEC512
+	case USE_VEC512: for (size_t i = 0; i < s; i += 4 * n_floats) { c_out += kernel_op_avx512<precision>(cx, cy, &gradients[i]); } break;
 	#endif
 	
 	#ifdef __arm__
-	case USE_VEC128: for (size_t i = 0; i < s; i += 4 * n_floats) { c_out += kernel_op_arm128(cx, cy, &gradients[i]); } break;
+	case USE_VEC128: for (size_t i = 0; i < s; i += 4 * n_floats) { c_out += kernel_op_arm128<precision>(cx, cy, &gradients[i]); } break;
 	#endif
 
 	default: throw std::invalid_argument("wrong or unsupported vectorization width in Timm::kernel"); break;
@@ -183,8 +369,15 @@ void Timm::pre_process(const cv::Mat& img)
 	cv::Sobel(img_scaled, gradient_y, CV_32F, 0, 1, opt.sobel);
 
 	// compute all the magnitudes 0.01ms
-	mags = gradient_x.mul(gradient_x) + gradient_y.mul(gradient_y);
-	sqrt(mags, mags); // is sqrt really necessary ??
+	// all operations below write into member buffers, so after the first frame of a size nothing is allocated
+	cv::magnitude(gradient_x, gradient_y, mags);
+
+	normalize_gradients();
+}
+
+
+void Timm::normalize_gradients()
+{
 
 
 
@@ -197,16 +390,17 @@ void Timm::pre_process(const cv::Mat& img)
 
 
 	// normalize 0.007ms
-	gradient_x = gradient_x / mags;
-	gradient_y = gradient_y / mags;
+	cv::divide(gradient_x, mags, gradient_x);
+	cv::divide(gradient_y, mags, gradient_y);
 
 
 
 	// set all values smaller than the threshold to zero 0.02ms
 
-	auto tmp = mags < gradientThresh;
-	gradient_x.setTo(0.0f, tmp);
-	gradient_y.setTo(0.0f, tmp);
+	cv::compare(mags, gradientThresh, low_gradient, cv::CMP_LT);
+	gradient_x.setTo(0.0f, low_gradient);
+	gradient_y.setTo(0.0f, low_gradient);
+	n_strong_gradients = int(low_gradient.total()) - cv::countNonZero(low_gradient);
 
 
 
@@ -233,7 +427,7 @@ void Timm::pre_process(const cv::Mat& img)
 }
 
 
-cv::Point Timm::post_process()
+cv::Point2f Timm::post_process()
 {
 
 	
@@ -253,10 +447,8 @@ cv::Point Timm::post_process()
 		cv::threshold(out, floodClone, flood_threshold, 0.0f, cv::THRESH_TOZERO);
 
 
-		//if (mask.rows == 0)
-		{
-			mask = cv::Mat(floodClone.rows, floodClone.cols, CV_8U, 255);
-		}
+		mask.create(floodClone.rows, floodClone.cols, CV_8U);
+		mask = 255;
 		floodKillEdges(mask, floodClone);
 
 		
@@ -272,13 +464,87 @@ cv::Point Timm::post_process()
 	measure_timings[0] = timer1.tock(false);
 	*/
 
-	return max_point;
+	confidence = n_strong_gradients > 0 ? float(max_val / (255.0 * n_strong_gradients)) : 0.0f;
+
+	return refine_subpixel(out, max_point);
+}
+
+// vertex of the least squares parabola through f[-r..r]. returns false if there is no maximum
+static bool parabola_vertex(const float* f, int r, float& offset)
+{
+	float a, b;
+	if (r == 1)
+	{
+		a = 0.5f * (f[0] + f[2]) - f[1];
+		b = 0.5f * (f[2] - f[0]);
+	}
+	else
+	{
+		a = (2.0f * f[0] - f[1] - 2.0f * f[2] - f[3] + 2.0f * f[4]) / 14.0f;
+		b = (-2.0f * f[0] - f[1] + f[3] + 2.0f * f[4]) / 10.0f;
+	}
+	if (a >= 0.0f) { return false; }
+	offset = -b / (2.0f * a);
+	return true;
+}
+
+cv::Point2f Timm::refine_subpixel(const cv::Mat& m, cv::Point p)
+{
+	const int r = std::min(2, std::max(1, opt.subpixel_radius));
+	cv::Point2f result(p.x, p.y);
+	if (opt.subpixel == SUBPIXEL_NONE) { return result; }
+
+	if (opt.subpixel == SUBPIXEL_CENTROID)
+	{
+		// the smallest value of the neighbourhood is the base, so that a flat background does not pull the centroid
+		cv::Rect rect = cv::Rect(p.x - r, p.y - r, 2 * r + 1, 2 * r + 1) & cv::Rect(0, 0, m.cols, m.rows);
+		double v_min = 0.0;
+		cv::minMaxLoc(m(rect), &v_min);
+		double sum = 0.0, sx = 0.0, sy = 0.0;
+		for (int y = rect.y; y < rect.y + rect.height; y++)
+		{
+			auto m_p = m.ptr<float>(y);
+			for (int x = rect.x; x < rect.x + rect.width; x++)
+			{
+				const double v = m_p[x] - v_min;
+				sum += v; sx += v * x; sy += v * y;
+			}
+		}
+		if (sum > 0.0) { result = cv::Point2f(sx / sum, sy / sum); }
+		return result;
+	}
+
+	// separate 1d fits in x and y. at the border, the position stays an integer
+	const bool has_x = p.x - r >= 0 && p.x + r < m.cols;
+	const bool has_y = p.y - r >= 0 && p.y + r < m.rows;
+	float fx[5] = { 0 }, fy[5] = { 0 }, offset = 0.0f;
+	for (int i = -r; i <= r; i++)
+	{
+		if (has_x) { fx[i + r] = m.at<float>(p.y, p.x + i); }
+		if (has_y) { fy[i + r] = m.at<float>(p.y + i, p.x); }
+	}
+
+	if (opt.subpixel == SUBPIXEL_GAUSSIAN)
+	{
+		// the objective is positive. tiny values are clamped so that the logarithm stays finite
+		for (int i = 0; i <= 2 * r; i++)
+		{
+			fx[i] = log(std::max(fx[i], 1e-20f));
+			fy[i] = log(std::max(fy[i], 1e-20f));
+		}
+	}
+
+	// a fit further away than half a neighbourhood is not trusted
+	if (has_x && parabola_vertex(fx, r, offset)) { result.x += std::max(-0.5f * r, std::min(0.5f * r, offset)); }
+	if (has_y && parabola_vertex(fy, r, offset)) { result.y += std::max(-0.5f * r, std::min(0.5f * r, offset)); }
+	return result;
 }
 
 void Timm::prepare_data()
 {
 	//////// prepare gradients vector 0.025ms /////////// 
 	gradients.clear();
+	n_gradients = 0;
 
 	auto cols = gradient_x.cols;
 	auto gx_p = gradient_x.ptr<float>(0);
@@ -303,6 +569,7 @@ void Timm::prepare_data()
 				simd_data[k + 3 * n_floats] = gy;
 
 				k++;
+				n_gradients++;
 				if (k == n_floats)
 				{
 					for (float d : simd_data) { gradients.push_back(d); }
@@ -311,6 +578,66 @@ void Timm::prepare_data()
 			}
 		}
 	}
+
+	// the last, partial chunk is padded with zero gradients. they contribute 0 to every center,
+	// their position is far outside of the image so that the distance to any center is non-zero
+	if (k > 0)
+	{
+		for (; k < n_floats; k++)
+		{
+			simd_data[k + 0 * n_floats] = -1.0e4f;
+			simd_data[k + 1 * n_floats] = -1.0e4f;
+			simd_data[k + 2 * n_floats] = 0.0f;
+			simd_data[k + 3 * n_floats] = 0.0f;
+		}
+		for (float d : simd_data) { gradients.push_back(d); }
+	}
+}
+
+
+void Timm::select_candidates()
+{
+	candidates.clear();
+
+	// the weight is the blurred, inverted image: 255 = black
+	int min_weight = opt.candidate_min_weight;
+
+	if (opt.candidate_fraction < 1.0f)
+	{
+		// find the weight percentile with a histogram instead of sorting (weight is 8 bit)
+		std::array<int, 256> hist; hist.fill(0);
+		for (int y = 0; y < weight.rows; y++)
+		{
+			auto w_p = weight.ptr<uchar>(y);
+			for (int x = 0; x < weight.cols; x++) { hist[w_p[x]]++; }
+		}
+
+		const int n_keep = std::max(1, int(ceil(opt.candidate_fraction * weight.rows * weight.cols)));
+		int count = 0;
+		int w = 255;
+		for (; w > 0; w--)
+		{
+			count += hist[w];
+			if (count >= n_keep) { break; }
+		}
+		min_weight = std::max(min_weight, w);
+	}
+
+	for (int y = 0; y < weight.rows; y++)
+	{
+		auto w_p = weight.ptr<uchar>(y);
+		for (int x = 0; x < weight.cols; x++)
+		{
+			if (w_p[x] >= min_weight) { candidates.push_back(y * weight.cols + x); }
+		}
+	}
+
+	// a too strict threshold must not leave us without any center at all
+	if (candidates.empty())
+	{
+		candidates.resize(weight.rows * weight.cols);
+		for (size_t i = 0; i < candidates.size(); i++) { candidates[i] = i; }
+	}
 }
 
 
@@ -319,28 +646,30 @@ void Timm::floodKillEdges(cv::Mat& mask, cv::Mat &mat)
 	rectangle(mat, cv::Rect(0, 0, mat.cols, mat.rows), 255);
 
 
-	std::queue<cv::Point> todo;
-	todo.push(cv::Point(0, 0));
+	// the fill order does not matter, so a stack whose capacity is kept between frames will do
+	auto& todo = flood_todo;
+	todo.clear();
+	todo.push_back(cv::Point(0, 0));
 	while (!todo.empty())
 	{
-		cv::Point p = todo.front();
-		todo.pop();
+		cv::Point p = todo.back();
+		todo.pop_back();
 		if (mat.at<float>(p) == 0.0f)
 		{
 			continue;
 		}
 		// add in every direction
 		cv::Point np(p.x + 1, p.y); // right
-		if (inside_mat(np, mat)) todo.push(np);
+		if (inside_mat(np, mat)) todo.push_back(np);
 
 		np.x = p.x - 1; np.y = p.y; // left
-		if (inside_mat(np, mat)) todo.push(np);
+		if (inside_mat(np, mat)) todo.push_back(np);
 
 		np.x = p.x; np.y = p.y + 1; // down
-		if (inside_mat(np, mat)) todo.push(np);
+		if (inside_mat(np, mat)) todo.push_back(np);
 
 		np.x = p.x; np.y = p.y - 1; // up
-		if (inside_mat(np, mat)) todo.push(np);
+		if (inside_mat(np, mat)) todo.push_back(np);
 
 		// kill it
 		mat.at<float>(p) = 0.0f;
@@ -4,6 +4,8 @@
 #include <array>
 #include <vector>
 #include <thread>
+#include <string>
+#include <stdexcept>
 #include<algorithm>
 #include <opencv2/imgproc.hpp>
 
@@ -20,6 +22,20 @@
 #endif
 
 #include "fast_sqrt.h"
+#include "affinity.h"
+#include "thread_pool.h"
+
+// the x86 kernels compiled into this build. MSVC has no feature macros, there all of them are compiled (the CPU check is
+// left to the caller), gcc and clang compile the ones the target flags enable (-msse3, -mavx, -mavx512f or -march=native)
+#if defined(_WIN32) || defined(__SSE3__)
+#define TIMM_X86_VEC128
+#endif
+#if defined(_WIN32) || defined(__AVX__)
+#define TIMM_X86_VEC256
+#endif
+#if defined(_WIN32) || defined(__AVX512F__)
+#define TIMM_X86_VEC512
+#endif
 
 enum enum_simd_variant
 {
@@ -27,21 +43,59 @@ enum enum_simd_variant
 	USE_VEC128 =  128,
 	USE_VEC256 =  256,
 	USE_VEC512 =  512,
-	USE_OPENCL = 4096
+	USE_OPENCL = 4096,
+	USE_OPENCL_FULL = 8192, // pre- and post-processing on the OpenCL device, too
+	USE_OPENCL_HYBRID = 16384 // the rows of the objective function are split between the OpenCL device and the CPU
+};
+
+// loop order of the objective function
+enum enum_engine
+{
+	ENGINE_AUTO = 0,            // choose per call based on the gradient / center ratio
+	ENGINE_CENTER_MAJOR = 1,    // for each center, sum over all gradients (Timm::kernel)
+	ENGINE_GRADIENT_MAJOR = 2   // for each gradient, scatter into all center rows (like testPossibleCentersFormula)
+};
+
+// sub-pixel refinement of the maximum of the objective function
+enum enum_subpixel
+{
+	SUBPIXEL_NONE = 0,       // integer position of the maximum
+	SUBPIXEL_QUADRATIC = 1,  // parabola fit through the neighbourhood, separately in x and y
+	SUBPIXEL_GAUSSIAN = 2,   // parabola fit through the logarithm of the neighbourhood
+	SUBPIXEL_CENTROID = 3    // weighted centroid of the neighbourhood
 };
 
 
 
+// the scaled gradient field of a frame region, computed once and shared by the Timm::pupil_center_shared calls
+// of several regions of interest inside of it (see Timm_two_stage::pupil_centers). only read by them
+struct Timm_gradients
+{
+	cv::Rect region;    // in frame pixels
+	float scale = 1.0f; // frame pixels per scaled pixel
+	cv::Mat img_scaled;
+	cv::Mat gradient_x;
+	cv::Mat gradient_y;
+	cv::Mat mags;
+
+	// like Timm::pre_process up to the magnitudes. sobel: Timm::options::sobel
+	void compute(const cv::Mat& frame, cv::Rect region, float scale, int sobel);
+};
+
+
 // the template parameter simd_width specifies the vector register bit width
 // e.g. 512 for AVX512, 256 for AVX2 and 128 for SSE
 class Timm
 {
 protected:
 
-	int simd_width = USE_VEC256;
+	int simd_width = default_simd_width();
 	// optimised for SIMD: 
-	// this vector stores sequential chunks of floats for x,y,gx,gy
+	// this vector stores sequential chunks of floats for x,y,gx,gy.
+	// the last chunk is padded with zero gradients, so gradients.size() / 4 can be larger than n_gradients
 	std::vector<float> gradients;
+	size_t n_gradients = 0;
+	int n_strong_gradients = 0; // above the gradient threshold, counted by pre_process
 	std::vector<float> simd_data;
 
 	cv::Mat gradient_x;
@@ -54,27 +108,81 @@ protected:
 	cv::Mat out;
 	cv::Mat floodClone;
 	cv::Mat mask;
+	cv::Mat low_gradient;
+	std::vector<cv::Point> flood_todo;
+
+	// linear indices (y * cols + x) of the centers the objective function is evaluated for
+	std::vector<int> candidates;
 	cv::Mat debug_img1;
 	cv::Mat debug_img2;
 
 	// Timer timer1, timer2; // old timing code for the paper
 
-	// storage for threads used by pupil_center	
-	std::vector<std::thread> threads;
+	// the persistent threads of the objective function, see worker_team()
+	std::unique_ptr<Worker_team> team;
+	worker_affinity team_affinity; // the affinity the team was created with
+
+	// per thread accumulation buffers of the gradient-major engine
+	std::vector<cv::Mat> thread_sums;
 public:
 	int n_threads = 1;
+
+	// pinning and priority of the objective function threads. thread 0 is the thread calling pupil_center, which keeps its
+	// own pinning, the n_threads - 1 others are persistent workers: worker i runs on affinity.cpus[(i - 1) % size].
+	// they are pinned once when they start (after a change of n_threads or affinity, with the next frame).
+	// the scratch buffers (gradients, simd_data, out_sum ..) are first touched by the calling thread,
+	// so on NUMA systems it should be pinned to the same node
+	worker_affinity affinity;
 	
 	
 
 
 	// for timing measurements
 	float measure_timings[2] = { 0, 0 };
+
+	// of the last pupil_center: the maximum of the objective function relative to its upper bound (255 * number of gradients),
+	// i.e. about the weighted fraction of the gradients that point at the center. 0..1, -1 if unknown (USE_OPENCL_FULL)
+	float confidence = 0.0f;
 	
+	// throws std::invalid_argument for a CPU width whose kernels are not compiled into this build (see simd_width_supported)
 	void setup(enum_simd_variant simd_width_)
 	{
+		if (simd_width_ < USE_OPENCL && !simd_width_supported(simd_width_))
+		{
+			throw std::invalid_argument("Timm::setup: simd width " + std::to_string(int(simd_width_)) + " is not supported by this build");
+		}
 		simd_width = simd_width_;
 	}
 
+	// whether the CPU kernels of a simd width (USE_NO_VEC .. USE_VEC512) are compiled into this build
+	static bool simd_width_supported(int w)
+	{
+		switch (w)
+		{
+		case USE_NO_VEC: return true;
+		#ifdef TIMM_X86_VEC128
+		case USE_VEC128: return true;
+		#endif
+		#ifdef TIMM_X86_VEC256
+		case USE_VEC256: return true;
+		#endif
+		#ifdef TIMM_X86_VEC512
+		case USE_VEC512: return true;
+		#endif
+		#ifdef __arm__
+		case USE_VEC128: return true;
+		#endif
+		default: return false;
+		}
+	}
+
+	// the widest supported CPU width up to 256 bit. AVX512 has to be selected explicitly, it lowers the clock of many CPUs
+	static enum_simd_variant default_simd_width()
+	{
+		for (auto w : { USE_VEC256, USE_VEC128 }) { if (simd_width_supported(w)) { return w; } }
+		return USE_NO_VEC;
+	}
+
 	// for displaying debug images
 	void visualize(int x, int y, std::array<bool, 4> what = std::array<bool, 4>{ false, false, false , false }, std::string debug_window_name = "debug_window");
 
@@ -86,25 +194,57 @@ public:
 		int sobel = 5; // must be either -1, 1, 3, 5, 7
 		float gradient_threshold = 50.0f; //50.0f;
 		float postprocess_threshold = 0.97f;
+
+		// candidate center pruning: the objective is multiplied with the inverted image anyway,
+		// so centers on bright skin / sclera can be skipped before evaluating the kernel.
+		// a center is evaluated if its weight is among the darkest candidate_fraction of all pixels
+		// AND its weight (0..255, 255 = black) is >= candidate_min_weight.
+		// the defaults (1.0 and 0) evaluate all centers.
+		float candidate_fraction = 1.0f;
+		int candidate_min_weight = 0;
+
+		// objective function loop order, see enum_engine.
+		// ENGINE_AUTO uses the gradient-major loop if n_gradients < gradient_major_ratio * n_centers
+		int engine = ENGINE_AUTO;
+		float gradient_major_ratio = 0.25f;
+
+		// accuracy of the normalization of the distance vectors in the CPU kernels, see enum_rsqrt_precision in fast_sqrt.h.
+		// the default keeps USE_NO_VEC exact, the estimate only pays off together with the vector kernels
+		int rsqrt_precision = RSQRT_DEFAULT;
+
+		// sub-pixel refinement, see enum_subpixel. with it, a smaller down_scaling_width reaches the same accuracy.
+		// subpixel_radius 1 uses the 3x3, 2 the 5x5 neighbourhood of the maximum
+		int subpixel = SUBPIXEL_QUADRATIC;
+		int subpixel_radius = 1;
 	} opt;
 
 	// estimates the pupil center
 	// inputs: eye image, reagion of interest (rio) and an optional window name for debug output
-	cv::Point pupil_center(const cv::Mat& eye_img);
+	cv::Point2f pupil_center(const cv::Mat& eye_img);
+
+	// like pupil_center(frame(roi)), but on gradients computed once for a larger region of the frame (which contains roi),
+	// at the scale of g instead of down_scaling_width. returns frame pixels. g is not modified, so several Timm instances
+	// can evaluate different rois of one g concurrently
+	cv::Point2f pupil_center_shared(const Timm_gradients& g, cv::Rect roi);
 
 
 protected:
 
 	void pre_process(const cv::Mat& img);
-	cv::Point post_process();
+	// second part of pre_process: threshold and normalization of gradient_x, gradient_y (with mags), weight image
+	void normalize_gradients();
+	// objective function and post processing, returns the center in scaled pixels
+	cv::Point2f find_center();
+	cv::Point2f post_process();
 
+	// sub-pixel position of the maximum p of m, see options::subpixel. p must be a local maximum
+	cv::Point2f refine_subpixel(const cv::Mat& m, cv::Point p);
 
-	inline cv::Point undo_scaling(cv::Point p, float original_width)
+	// scaled pixel centers to original pixel centers (like cv::resize)
+	inline cv::Point2f undo_scaling(cv::Point2f p, float original_width)
 	{
 		float s = original_width / float(opt.down_scaling_width);
-		int x = round( s * p.x );
-		int y = round( s * p.y );
-		return cv::Point(x, y);
+		return cv::Point2f(s * (p.x + 0.5f) - 0.5f, s * (p.y + 0.5f) - 0.5f);
 	}
 
 
@@ -114,6 +254,17 @@ protected:
 
 	void prepare_data();
 
+	// fills the candidates list from the weight image
+	void select_candidates();
+
+	// the two layouts of the objective function loop. both fill out_sum at the candidate centers
+	bool use_gradient_major();
+	void objective_center_major();
+	void objective_gradient_major();
+
+	// the team of n_threads threads, (re)created if n_threads or affinity have changed
+	Worker_team& worker_team();
+
 	inline bool inside_mat(cv::Point p, const cv::Mat &mat)
 	{
 		return p.x >= 0 && p.x < mat.cols && p.y >= 0 && p.y < mat.rows;
@@ -130,8 +281,8 @@ protected:
 
 	float kernel_orig(float cx, float cy, const cv::Mat& gradientX, const cv::Mat& gradientY);
 
-	#ifdef _WIN32
-	inline float kernel_op_sse(float cx, float cy, const float* sd)
+	#ifdef TIMM_X86_VEC128
+	template<int precision> inline float kernel_op_sse(float cx, float cy, const float* sd)
 	{
 
 		// wenn das gut klappt, dann für raspi mal die sse2neon lib anschauen: https://github.com/jratcliff63367/sse2neon
@@ -155,7 +306,7 @@ protected:
 		tmp1 = _mm_add_ps(tmp1, tmp2);
 		
 		// now cals the reciprocal square root
-		tmp1 = _mm_rsqrt_ps(tmp1);
+		tmp1 = fast_rsqrt<precision>(tmp1);
 		
 		// now normalize by multiplying
 		dx_in = _mm_mul_ps(dx_in, tmp1);
@@ -179,8 +330,9 @@ protected:
 
 		return _mm_cvtss_f32(tmp1);
 	}
+	#endif
 
-
+	#ifdef TIMM_X86_VEC256
 	// https://stackoverflow.com/questions/13219146/how-to-sum-m256-horizontally#13222410
 	// x = ( x7, x6, x5, x4, x3, x2, x1, x0 )
 	inline float sum8(__m256 x)
@@ -215,7 +367,7 @@ protected:
 		return _mm256_cvtss_f32(x);
 	}
 
-	inline float kernel_op_avx2(float cx, float cy, const float* sd)
+	template<int precision> inline float kernel_op_avx2(float cx, float cy, const float* sd)
 	{
 
 		//__declspec(align(16)) float dx[4]; // no effect - compiler seems to automatically align code		
@@ -240,7 +392,7 @@ protected:
 		tmp1 = _mm256_add_ps(tmp1, tmp2);
 
 		// now cals the reciprocal square root
-		tmp1 = _mm256_rsqrt_ps(tmp1);
+		tmp1 = fast_rsqrt<precision>(tmp1);
 
 		// now normalize by multiplying
 		dx_in = _mm256_mul_ps(dx_in, tmp1);
@@ -260,8 +412,10 @@ protected:
 		return sum8(tmp1); // a tiny bit faster
 		//return sum8_alt(tmp1);
 	}
+	#endif
 
-	inline float kernel_op_avx512(float cx, float cy, const float* sd)
+	#ifdef TIMM_X86_VEC512
+	template<int precision> inline float kernel_op_avx512(float cx, float cy, const float* sd)
 	{
 
 		//__declspec(align(16)) float dx[4]; // no effect - compiler seems to automatically align code		
@@ -286,7 +440,7 @@ protected:
 		tmp1 = _mm512_add_ps(tmp1, tmp2);
 
 		// now cals the reciprocal square root
-		tmp1 = _mm512_rsqrt14_ps(tmp1);
+		tmp1 = fast_rsqrt<precision>(tmp1);
 
 		// now normalize by multiplying
 		dx_in = _mm512_mul_ps(dx_in, tmp1);
@@ -340,7 +494,7 @@ protected:
 	#endif
 
 	#ifdef __arm__
-	inline float kernel_op_arm128(float cx, float cy, const float* sd)
+	template<int precision> inline float kernel_op_arm128(float cx, float cy, const float* sd)
 	{
 		// is it faster with "static" ?
 		static const float32x4_t zero = vdupq_n_f32(0.0f); 
@@ -358,16 +512,20 @@ protected:
 		// calc the difference vector
 		//dx_in = vsubq_f32(dx_in, cx_4);
 		//dy_in = vsubq_f32(dy_in, cy_4);
-		dx_in = vmulq_n_f32(dx_in, cx);
-		dy_in = vmulq_n_f32(dy_in, cy);
+		dx_in = vsubq_f32(dx_in, vdupq_n_f32(cx));
+		dy_in = vsubq_f32(dy_in, vdupq_n_f32(cy));
 
 		// calc the dot product	
 		float32x4_t tmp1 = vmulq_f32(dx_in, dx_in);
 		float32x4_t tmp2 = vmulq_f32(dy_in, dy_in);
 		tmp1 = vaddq_f32(tmp1, tmp2);
 
+		// unlike the x86 max, vmaxq_f32 propagates the NaN of a zero length difference vector (center == gradient position).
+		// clamping the squared length to 0.5 (the smallest non-zero one is 1) makes that contribution 0, like on x86
+		tmp1 = vmaxq_f32(tmp1, vdupq_n_f32(0.5f));
+
 		// now cals the reciprocal square root
-		tmp1 = vrsqrteq_f32(tmp1);
+		tmp1 = fast_rsqrt<precision>(tmp1);
 
 		// now normalize by multiplying
 		dx_in = vmulq_f32(dx_in, tmp1);
@@ -394,7 +552,7 @@ protected:
 	}
 	#endif
 	
-	inline float kernel_op(float cx, float cy, const float* sd)	
+	template<int precision> inline float kernel_op(float cx, float cy, const float* sd)
 	{
 		
 		float x  = sd[0];
@@ -416,11 +574,7 @@ protected:
 		//magnitude = fast_inverse_sqrt_quake(magnitude); // with this: 26 ms.
 		//magnitude = fast_inverse_sqrt_around_one(magnitude); // not working .. 
 
-		#ifdef _WIN32 // currently fast_inverse_sqrt is only defined for win32
-		fast_inverse_sqrt(&magnitude, &magnitude); // MUCH FASTER !
-		#else
-		magnitude = 1.0f / sqrt(magnitude);
-		#endif
+		magnitude = fast_rsqrt<precision>(magnitude); // MUCH FASTER !
 		dx = dx * magnitude;
 		dy = dy * magnitude;
 
@@ -430,5 +584,115 @@ protected:
 		return dotProduct * dotProduct;
 	}
 
+	// opt.rsqrt_precision with RSQRT_DEFAULT resolved for simd_width
+	inline int rsqrt_precision() const
+	{
+		if (opt.rsqrt_precision != RSQRT_DEFAULT) { return opt.rsqrt_precision; }
+		return simd_width == USE_NO_VEC ? RSQRT_EXACT : RSQRT_ESTIMATE;
+	}
+
 	float kernel(float cx, float cy, const std::vector<float>& gradients);
+	template<int precision> float kernel_t(float cx, float cy, const std::vector<float>& gradients);
+
+
+	///////////////////// gradient-major (scatter) kernels ///////////////////// 
+	// these add the contribution of a single gradient at (x, y) to the consecutive centers cx, cx+1, .. of row cy.
+	// the squared distance is clamped to 0.5 (the smallest non-zero distance is 1) so that the gradient's own
+	// position contributes 0 instead of NaN, like in the center-major kernels.
+
+	template<int precision> inline float scatter_op(float x, float y, float gx, float gy, float cx, float cy)
+	{
+		float dx = x - cx;
+		float dy = y - cy;
+		float magnitude = std::max(0.5f, (dx * dx) + (dy * dy));
+		float dotProduct = (dx * gx + dy * gy) * fast_rsqrt<precision>(magnitude);
+		dotProduct = std::max(0.0f, dotProduct);
+		return dotProduct * dotProduct;
+	}
+
+	#ifdef TIMM_X86_VEC128
+	template<int precision> inline void scatter_op_sse(float x, float y, float gx, float gy, float cx, float cy, float* row)
+	{
+		const __m128 zero = _mm_setzero_ps();
+		const __m128 half = _mm_set1_ps(0.5f);
+
+		__m128 dx = _mm_sub_ps(_mm_set1_ps(x - cx), _mm_set_ps(3.0f, 2.0f, 1.0f, 0.0f));
+		__m128 dy = _mm_set1_ps(y - cy);
+
+		// reciprocal length of the difference vectors
+		__m128 m = _mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy));
+		m = fast_rsqrt<precision>(_mm_max_ps(m, half));
+
+		// normalized dot product with the gradient, clamped and squared
+		__m128 dp = _mm_add_ps(_mm_mul_ps(dx, _mm_set1_ps(gx)), _mm_mul_ps(dy, _mm_set1_ps(gy)));
+		dp = _mm_max_ps(_mm_mul_ps(dp, m), zero);
+		dp = _mm_mul_ps(dp, dp);
+
+		_mm_storeu_ps(row, _mm_add_ps(_mm_loadu_ps(row), dp));
+	}
+	#endif
+
+	#ifdef TIMM_X86_VEC256
+	template<int precision> inline void scatter_op_avx2(float x, float y, float gx, float gy, float cx, float cy, float* row)
+	{
+		const __m256 zero = _mm256_setzero_ps();
+		const __m256 half = _mm256_set1_ps(0.5f);
+
+		__m256 dx = _mm256_sub_ps(_mm256_set1_ps(x - cx), _mm256_set_ps(7.0f, 6.0f, 5.0f, 4.0f, 3.0f, 2.0f, 1.0f, 0.0f));
+		__m256 dy = _mm256_set1_ps(y - cy);
+
+		__m256 m = _mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_mul_ps(dy, dy));
+		m = fast_rsqrt<precision>(_mm256_max_ps(m, half));
+
+		__m256 dp = _mm256_add_ps(_mm256_mul_ps(dx, _mm256_set1_ps(gx)), _mm256_mul_ps(dy, _mm256_set1_ps(gy)));
+		dp = _mm256_max_ps(_mm256_mul_ps(dp, m), zero);
+		dp = _mm256_mul_ps(dp, dp);
+
+		_mm256_storeu_ps(row, _mm256_add_ps(_mm256_loadu_ps(row), dp));
+	}
+	#endif
+
+	#ifdef TIMM_X86_VEC512
+	template<int precision> inline void scatter_op_avx512(float x, float y, float gx, float gy, float cx, float cy, float* row)
+	{
+		const __m512 zero = _mm512_setzero_ps();
+		const __m512 half = _mm512_set1_ps(0.5f);
+
+		__m512 dx = _mm512_sub_ps(_mm512_set1_ps(x - cx), _mm512_set_ps(15.0f, 14.0f, 13.0f, 12.0f, 11.0f, 10.0f, 9.0f, 8.0f, 7.0f, 6.0f, 5.0f, 4.0f, 3.0f, 2.0f, 1.0f, 0.0f));
+		__m512 dy = _mm512_set1_ps(y - cy);
+
+		__m512 m = _mm512_add_ps(_mm512_mul_ps(dx, dx), _mm512_mul_ps(dy, dy));
+		m = fast_rsqrt<precision>(_mm512_max_ps(m, half));
+
+		__m512 dp = _mm512_add_ps(_mm512_mul_ps(dx, _mm512_set1_ps(gx)), _mm512_mul_ps(dy, _mm512_set1_ps(gy)));
+		dp = _mm512_max_ps(_mm512_mul_ps(dp, m), zero);
+		dp = _mm512_mul_ps(dp, dp);
+
+		_mm512_storeu_ps(row, _mm512_add_ps(_mm512_loadu_ps(row), dp));
+	}
+	#endif
+
+	#ifdef __arm__
+	template<int precision> inline void scatter_op_arm128(float x, float y, float gx, float gy, float cx, float cy, float* row)
+	{
+		static const float offsets[4] = { 0.0f, 1.0f, 2.0f, 3.0f };
+		const float32x4_t zero = vdupq_n_f32(0.0f);
+		const float32x4_t half = vdupq_n_f32(0.5f);
+
+		float32x4_t dx = vsubq_f32(vdupq_n_f32(x - cx), vld1q_f32(offsets));
+		float32x4_t dy = vdupq_n_f32(y - cy);
+
+		float32x4_t m = vaddq_f32(vmulq_f32(dx, dx), vmulq_f32(dy, dy));
+		m = fast_rsqrt<precision>(vmaxq_f32(m, half));
+
+		float32x4_t dp = vaddq_f32(vmulq_n_f32(dx, gx), vmulq_n_f32(dy, gy));
+		dp = vmaxq_f32(vmulq_f32(dp, m), zero);
+		dp = vmulq_f32(dp, dp);
+
+		vst1q_f32(row, vaddq_f32(vld1q_f32(row), dp));
+	}
+	#endif
+
+	void scatter_row(float x, float y, float gx, float gy, float cy, float* row, int cols);
+	template<int precision> void scatter_row_t(float x, float y, float gx, float gy, float cy, float* row, int cols);
 };
@@ -0,0 +1,257 @@
+#pragma once
+
+#include "timm_two_stage.h"
+#include "thread_pool.h"
+
+#include <deque>
+#include <future>
+#include <chrono>
+#include <atomic>
+#include <iostream>
+
+enum enum_async_status
+{
+	ASYNC_OK = 0,
+	ASYNC_DROPPED = 1, // replaced by a newer frame before it was processed (BACKPRESSURE_DROP_OLDEST)
+	ASYNC_FAILED = 2   // the detector threw an exception
+};
+
+// what happens to a submit when max_in_flight requests are queued or running
+enum enum_backpressure
+{
+	BACKPRESSURE_DROP_OLDEST = 0, // the oldest queued request is completed with ASYNC_DROPPED. if all are running, like REJECT
+	BACKPRESSURE_REJECT = 1,      // the new request is refused (submit returns an invalid future / false)
+	BACKPRESSURE_BLOCK = 2        // submit waits for a free place
+};
+
+// asynchronous front end of Timm_two_stage (or Timm): submit copies the frame and returns immediately with a future,
+// or invokes a callback on completion. requests run on an own Thread_pool, with one detector per worker, in submission order.
+// at most max_in_flight requests are queued or running, what happens beyond is set by the backpressure policy.
+// the frame copies are kept in a pool of buffers, so a steady stream of frames of one size does not allocate images.
+// an exception of a callback is reported to std::cerr, it does not stop the worker (or the submit that dropped a request).
+// see validate_async.cpp
+template<class Detector = Timm_two_stage>
+class Timm_async
+{
+public:
+	using clock = std::chrono::steady_clock;
+
+	struct result
+	{
+		int status = ASYNC_OK; // enum_async_status
+		uint64_t frame_id = 0;
+		cv::Point2f pupil_pos;
+		cv::Point2f pupil_pos_coarse; // equal to pupil_pos for Timm
+		float queue_ms = 0.0f;        // from submit to the start of the computation
+		float latency_ms = 0.0f;      // from submit to the end of the computation
+	};
+
+	using callback = std::function<void(const result&)>;
+
+	struct stats
+	{
+		size_t n_submitted = 0;
+		size_t n_completed = 0;
+		size_t n_rejected = 0;
+		size_t n_dropped = 0;
+		size_t n_failed = 0;
+	};
+
+	Timm_async(enum_simd_variant simd_width, typename Detector::options o, int n_workers = std::thread::hardware_concurrency(),
+		size_t max_in_flight = 0, int backpressure = BACKPRESSURE_DROP_OLDEST)
+		: n_workers(std::max(1, n_workers)), max_in_flight(max_in_flight > 0 ? max_in_flight : 2 * size_t(std::max(1, n_workers))),
+		backpressure(backpressure), pool(std::max(1, n_workers))
+	{
+		// the OpenCL stages of a detector share one kernel object, several detectors would compete for one device
+		if (simd_width >= USE_OPENCL && this->n_workers > 1) { throw std::invalid_argument("Timm_async supports OpenCL only with one worker"); }
+
+		for (int i = 0; i < this->n_workers; i++)
+		{
+			detectors.emplace_back();
+			detectors.back().setup(simd_width);
+			configure(detectors.back(), o);
+			free_detectors.push_back(i);
+		}
+	}
+
+	// waits for all requests
+	~Timm_async() { wait_idle(); }
+
+	Timm_async(const Timm_async&) = delete;
+	Timm_async& operator=(const Timm_async&) = delete;
+
+	// returns an invalid future (valid() == false) if the request was rejected
+	std::future<result> submit(const cv::Mat& frame, uint64_t frame_id)
+	{
+		std::promise<result> p;
+		auto f = p.get_future();
+		if (!enqueue(frame, frame_id, &p, nullptr)) { return std::future<result>(); }
+		return f;
+	}
+
+	// on_done is called from a worker thread. returns false if the request was rejected (on_done is not called then)
+	bool submit(const cv::Mat& frame, uint64_t frame_id, callback on_done)
+	{
+		return enqueue(frame, frame_id, nullptr, std::move(on_done));
+	}
+
+	// queued and running requests
+	size_t in_flight()
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		return n_in_flight;
+	}
+
+	void wait_idle()
+	{
+		std::unique_lock<std::mutex> lock(mtx);
+		cv_space.wait(lock, [this]() { return n_in_flight == 0; });
+	}
+
+	stats get_stats()
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		return st;
+	}
+
+private:
+	struct request
+	{
+		uint64_t frame_id = 0;
+		cv::Mat frame;
+		clock::time_point t_submit;
+		std::promise<result> promise;
+		bool has_promise = false;
+		callback on_done;
+	};
+
+	const int n_workers;
+	const size_t max_in_flight;
+	const int backpressure;
+
+	std::deque<Detector> detectors; // deque: detectors must not move (the OpenCL stages reference their kernel)
+	std::vector<int> free_detectors;
+	std::vector<cv::Mat> free_buffers;
+	std::deque<request> queue;
+	size_t n_in_flight = 0;
+	stats st;
+
+	std::mutex mtx;
+	std::condition_variable cv_space;
+	Thread_pool pool; // last member: its workers are joined before the rest is destroyed
+
+	static void configure(Timm_two_stage& d, const typename Timm_two_stage::options& o) { d.set_options(o); }
+	static void configure(Timm& d, const typename Timm::options& o) { d.opt = o; }
+
+	static void detect(Timm_two_stage& d, cv::Mat& frame, result& r) { std::tie(r.pupil_pos, r.pupil_pos_coarse) = d.pupil_center(frame); }
+	static void detect(Timm& d, cv::Mat& frame, result& r) { r.pupil_pos = r.pupil_pos_coarse = d.pupil_center(frame); }
+
+	static void complete(request& q, const result& r)
+	{
+		if (q.has_promise) { q.promise.set_value(r); }
+		// a throwing callback must not escape the pool task, that would terminate the process
+		if (q.on_done)
+		{
+			try { q.on_done(r); }
+			catch (const std::exception& e) { std::cerr << "Timm_async: callback of frame " << r.frame_id << ": " << e.what() << "\n"; }
+		}
+	}
+
+	bool enqueue(const cv::Mat& frame, uint64_t frame_id, std::promise<result>* p, callback on_done)
+	{
+		request dropped;
+		bool has_dropped = false;
+		{
+			std::unique_lock<std::mutex> lock(mtx);
+			st.n_submitted++;
+			if (n_in_flight >= max_in_flight)
+			{
+				if (backpressure == BACKPRESSURE_BLOCK)
+				{
+					cv_space.wait(lock, [this]() { return n_in_flight < max_in_flight; });
+				}
+				else if (backpressure == BACKPRESSURE_DROP_OLDEST && !queue.empty())
+				{
+					dropped = std::move(queue.front());
+					queue.pop_front();
+					n_in_flight--;
+					st.n_dropped++;
+					has_dropped = true;
+				}
+				else
+				{
+					st.n_rejected++;
+					return false;
+				}
+			}
+
+			queue.emplace_back();
+			auto& q = queue.back();
+			if (has_dropped) { q.frame = dropped.frame; }
+			else if (!free_buffers.empty())
+			{
+				q.frame = free_buffers.back();
+				free_buffers.pop_back();
+			}
+			frame.copyTo(q.frame); // reuses the buffer if the size is unchanged
+			q.frame_id = frame_id;
+			q.t_submit = clock::now();
+			if (p) { q.promise = std::move(*p); q.has_promise = true; }
+			q.on_done = std::move(on_done);
+			n_in_flight++;
+		}
+
+		// the dropped request is completed outside of the lock, its callback may submit again
+		if (has_dropped)
+		{
+			result r;
+			r.status = ASYNC_DROPPED;
+			r.frame_id = dropped.frame_id;
+			complete(dropped, r);
+		}
+
+		// one task per request. a task whose request has been dropped finds the queue shorter and may find nothing to do
+		pool.push([this]() { run_next(); });
+		return true;
+	}
+
+	// executed by a worker: processes the oldest queued request
+	void run_next()
+	{
+		request q;
+		int d = -1;
+		{
+			std::lock_guard<std::mutex> lock(mtx);
+			if (queue.empty()) { return; }
+			q = std::move(queue.front());
+			queue.pop_front();
+			// there are as many detectors as workers, so one is always free
+			d = free_detectors.back();
+			free_detectors.pop_back();
+		}
+
+		result r;
+		r.frame_id = q.frame_id;
+		auto t_start = clock::now();
+		r.queue_ms = std::chrono::duration<float, std::milli>(t_start - q.t_submit).count();
+		try { detect(detectors[d], q.frame, r); }
+		catch (const std::exception&) { r.status = ASYNC_FAILED; }
+		r.latency_ms = std::chrono::duration<float, std::milli>(clock::now() - q.t_submit).count();
+
+		{
+			std::lock_guard<std::mutex> lock(mtx);
+			free_detectors.push_back(d);
+			if (r.status == ASYNC_OK) { st.n_completed++; }
+			else { st.n_failed++; }
+		}
+
+		complete(q, r);
+
+		{
+			std::lock_guard<std::mutex> lock(mtx);
+			free_buffers.push_back(q.frame);
+			n_in_flight--;
+		}
+		cv_space.notify_all();
+	}
+};
@@ -0,0 +1,598 @@
+// C interface of Timm_two_stage and Timm_multi_stream, see timm_c.h
+
+#include "timm_c.h"
+
+#include "timm_two_stage.h"
+#include "timm_multi_stream.h"
+
+#include <deque>
+#include <memory>
+#include <string>
+#include <chrono>
+#include <atomic>
+#include <stdexcept>
+
+static thread_local std::string last_error;
+
+// converts exceptions into status codes, nothing may propagate through the C interface
+template<class F> static timm_status guarded(F f)
+{
+	try { return f(); }
+	catch (const std::invalid_argument& e) { last_error = e.what(); return TIMM_ERROR_INVALID_ARGUMENT; }
+	catch (const std::out_of_range& e) { last_error = e.what(); return TIMM_ERROR_INVALID_ARGUMENT; }
+	catch (const std::exception& e) { last_error = e.what(); return TIMM_ERROR_INTERNAL; }
+	catch (...) { last_error = "unknown error"; return TIMM_ERROR_INTERNAL; }
+}
+
+static timm_status fail(timm_status s, const char* message)
+{
+	last_error = message;
+	return s;
+}
+
+static timm_status check_simd_width(int32_t simd_width)
+{
+	switch (simd_width)
+	{
+	case USE_NO_VEC: case USE_VEC128: case USE_VEC256: case USE_VEC512:
+		if (Timm::simd_width_supported(simd_width)) { return TIMM_OK; }
+		return fail(TIMM_ERROR_UNSUPPORTED, "the library was built without the kernels of this simd_width, see timm_simd_width_supported");
+	case USE_OPENCL: case USE_OPENCL_FULL: case USE_OPENCL_HYBRID:
+		#ifdef __TIMM_OPENCL__
+		return TIMM_OK;
+		#else
+		return fail(TIMM_ERROR_UNSUPPORTED, "the library was built without OPENCL_ENABLED");
+		#endif
+	default:
+		return fail(TIMM_ERROR_INVALID_ARGUMENT, "invalid simd_width");
+	}
+}
+
+static bool valid_image(const uint8_t* data, int32_t width, int32_t height, ptrdiff_t stride)
+{
+	return data != nullptr && width > 0 && height > 0 && stride >= width;
+}
+
+// zero-copy view of a caller-owned image. the detectors only read it (the blur is done into a separate buffer)
+static cv::Mat wrap(const uint8_t* data, int32_t width, int32_t height, ptrdiff_t stride)
+{
+	return cv::Mat(height, width, CV_8U, const_cast<uint8_t*>(data), size_t(stride));
+}
+
+static Timm::options to_timm(const timm_stage_options& s)
+{
+	Timm::options o;
+	o.down_scaling_width = s.down_scaling_width;
+	o.blur = s.blur;
+	o.sobel = s.sobel;
+	o.gradient_threshold = s.gradient_threshold;
+	o.postprocess_threshold = s.postprocess_threshold;
+	o.candidate_fraction = s.candidate_fraction;
+	o.candidate_min_weight = s.candidate_min_weight;
+	o.engine = s.engine;
+	o.gradient_major_ratio = s.gradient_major_ratio;
+	o.rsqrt_precision = s.rsqrt_precision;
+	o.subpixel = s.subpixel;
+	o.subpixel_radius = s.subpixel_radius;
+	return o;
+}
+
+static timm_stage_options from_timm(const Timm::options& o)
+{
+	timm_stage_options s;
+	s.down_scaling_width = o.down_scaling_width;
+	s.blur = o.blur;
+	s.sobel = o.sobel;
+	s.gradient_threshold = o.gradient_threshold;
+	s.postprocess_threshold = o.postprocess_threshold;
+	s.candidate_fraction = o.candidate_fraction;
+	s.candidate_min_weight = o.candidate_min_weight;
+	s.engine = o.engine;
+	s.gradient_major_ratio = o.gradient_major_ratio;
+	s.rsqrt_precision = o.rsqrt_precision;
+	s.subpixel = o.subpixel;
+	s.subpixel_radius = o.subpixel_radius;
+	return s;
+}
+
+static bool valid_options(const timm_stage_options& s)
+{
+	const bool sobel_ok = s.sobel == -1 || s.sobel == 1 || s.sobel == 3 || s.sobel == 5 || s.sobel == 7;
+	return s.down_scaling_width > 0 && s.blur > 0 && s.blur % 2 == 1 && sobel_ok;
+}
+
+static bool valid_options(const timm_options& c)
+{
+	return valid_options(c.stage1) && valid_options(c.stage2) && c.window_width > 0 && c.blur >= 0 && (c.blur == 0 || c.blur % 2 == 1);
+}
+
+// the blur of the input frame is done by the C interface, so Timm_two_stage never writes into the caller's image
+static Timm_two_stage::options to_two_stage(const timm_options& c)
+{
+	Timm_two_stage::options o;
+	o.blur = 0;
+	o.window_width = c.window_width;
+	o.stage1 = to_timm(c.stage1);
+	o.stage2 = to_timm(c.stage2);
+	return o;
+}
+
+
+struct timm_detector
+{
+	timm_options options;
+	std::deque<Timm_two_stage> timm; // one per thread. deque: Timm_two_stage must not move (the OpenCL stages reference its kernel)
+	std::vector<cv::Mat> blurred;    // per thread
+
+	// batch processing: the calling thread and the workers take frames from the shards.
+	// the batch is split into one contiguous shard per NUMA node (one shard if the workers are not pinned), a worker
+	// takes the frames of the shard of its node first and then helps with the others
+	std::vector<std::thread> workers;
+	std::mutex mtx;
+	std::condition_variable cv_start, cv_done;
+	uint64_t generation = 0;
+	int n_running = 0;
+	bool stop = false;
+	const timm_image* batch_images = nullptr;
+	timm_result* batch_results = nullptr;
+	size_t batch_n = 0;
+	std::vector<int> worker_node{ 0 };            // shard of each worker
+	std::vector<int> node_workers{ 1 };           // number of workers per shard
+	std::vector<size_t> shard_begin{ 0, 0 };      // shard k is [shard_begin[k], shard_begin[k + 1])
+	std::unique_ptr<std::atomic<size_t>[]> shard_next{ new std::atomic<size_t>[1] };
+	std::string batch_error; // of the first failing frame
+
+	// thread i processes one frame
+	timm_status process(int i, const timm_image& img, timm_result& r, std::string& error)
+	{
+		using clock = std::chrono::steady_clock;
+		auto t0 = clock::now();
+		r.status = TIMM_ERROR_INVALID_ARGUMENT;
+		if (!valid_image(img.data, img.width, img.height, img.stride))
+		{
+			error = "invalid image (data, width, height or stride)";
+			return TIMM_ERROR_INVALID_ARGUMENT;
+		}
+
+		try
+		{
+			cv::Mat frame = wrap(img.data, img.width, img.height, img.stride);
+			if (options.blur > 0)
+			{
+				cv::GaussianBlur(frame, blurred[i], cv::Size(options.blur, options.blur), 0);
+				frame = blurred[i];
+			}
+			cv::Point2f p, p_coarse;
+			std::tie(p, p_coarse) = timm[i].pupil_center(frame);
+			r.x = p.x;
+			r.y = p.y;
+			r.x_coarse = p_coarse.x;
+			r.y_coarse = p_coarse.y;
+			r.latency_ms = std::chrono::duration<float, std::milli>(clock::now() - t0).count();
+			r.status = TIMM_OK;
+		}
+		catch (const std::exception& e) { error = e.what(); r.status = TIMM_ERROR_INTERNAL; }
+		return timm_status(r.status);
+	}
+
+	void run_batch(int i)
+	{
+		std::string error;
+		const int n_shards = int(node_workers.size());
+		for (int o = 0; o < n_shards; o++)
+		{
+			const int shard = (worker_node[i] + o) % n_shards;
+			for (size_t k = shard_next[shard]++; k < shard_begin[shard + 1]; k = shard_next[shard]++)
+			{
+				batch_results[k].frame_id = k;
+				if (process(i, batch_images[k], batch_results[k], error) != TIMM_OK)
+				{
+					std::lock_guard<std::mutex> lock(mtx);
+					if (batch_error.empty()) { batch_error = error; }
+				}
+			}
+		}
+	}
+
+	// splits a batch of n frames into the shards, proportional to the workers per node
+	void start_shards(size_t n)
+	{
+		const int n_shards = int(node_workers.size());
+		const size_t n_workers = worker_node.size();
+		size_t begin = 0, workers_before = 0;
+		for (int k = 0; k < n_shards; k++)
+		{
+			shard_begin[k] = begin;
+			shard_next[k] = begin;
+			workers_before += node_workers[k];
+			begin = n * workers_before / n_workers;
+		}
+		shard_begin[n_shards] = n;
+	}
+
+	void worker_loop(int i)
+	{
+		uint64_t seen = 0;
+		while (true)
+		{
+			{
+				std::unique_lock<std::mutex> lock(mtx);
+				cv_start.wait(lock, [&]() { return stop || generation != seen; });
+				if (stop) { return; }
+				seen = generation;
+			}
+			run_batch(i);
+			{
+				std::lock_guard<std::mutex> lock(mtx);
+				n_running--;
+			}
+			cv_done.notify_all();
+		}
+	}
+
+	~timm_detector()
+	{
+		{
+			std::lock_guard<std::mutex> lock(mtx);
+			stop = true;
+		}
+		cv_start.notify_all();
+		for (auto& t : workers) { t.join(); }
+	}
+};
+
+
+struct timm_stage
+{
+	#ifdef __TIMM_OPENCL__
+	Opencl_kernel kernel;
+	Timm_opencl timm;
+	timm_stage() : timm(kernel) {}
+	#else
+	Timm timm;
+	#endif
+};
+
+
+struct timm_multi_stream
+{
+	Timm_multi_stream ms;
+	timm_multi_stream(int n_threads) : ms(n_threads) {}
+	timm_multi_stream(const std::vector<int>& cpus, int realtime_priority) : ms(cpus, realtime_priority) {}
+};
+
+
+static void to_result(const Timm_multi_stream::result& in, timm_result& out)
+{
+	out.x = in.pupil_pos.x;
+	out.y = in.pupil_pos.y;
+	out.x_coarse = in.pupil_pos_coarse.x;
+	out.y_coarse = in.pupil_pos_coarse.y;
+	out.frame_id = in.frame_id;
+	out.latency_ms = in.latency_ms;
+	out.status = in.failed ? TIMM_ERROR_INTERNAL : TIMM_OK;
+}
+
+
+extern "C" {
+
+uint32_t timm_abi_version(void) { return TIMM_ABI_VERSION; }
+
+const char* timm_last_error(void) { return last_error.c_str(); }
+
+int32_t timm_simd_width_supported(int32_t simd_width)
+{
+	const timm_status s = check_simd_width(simd_width);
+	last_error.clear();
+	return s == TIMM_OK ? 1 : 0;
+}
+
+void timm_default_options(timm_options* options)
+{
+	if (options == nullptr) { return; }
+	Timm_two_stage::options o;
+	options->blur = o.blur;
+	options->window_width = o.window_width;
+	options->stage1 = from_timm(o.stage1);
+	options->stage2 = from_timm(o.stage2);
+}
+
+// cpus: empty, or one cpu per thread (cpus[0] is the calling thread, which is not pinned here)
+static timm_status create_detector(int32_t simd_width, int32_t n_threads, const std::vector<int>& cpus, int realtime_priority, timm_detector** detector)
+{
+	if (detector == nullptr) { return fail(TIMM_ERROR_INVALID_ARGUMENT, "detector is NULL"); }
+	*detector = nullptr;
+	auto s = check_simd_width(simd_width);
+	if (s != TIMM_OK) { return s; }
+	if (n_threads < 1) { return fail(TIMM_ERROR_INVALID_ARGUMENT, "n_threads must be >= 1"); }
+	// the OpenCL stages of all instances would share one device queue
+	if (simd_width >= USE_OPENCL && n_threads > 1) { return fail(TIMM_ERROR_UNSUPPORTED, "OpenCL variants support only n_threads = 1"); }
+
+	return guarded([&]()
+	{
+		auto d = std::make_unique<timm_detector>();
+		timm_default_options(&d->options);
+		d->blurred.resize(n_threads);
+		for (int i = 0; i < n_threads; i++)
+		{
+			d->timm.emplace_back();
+			d->timm.back().setup(enum_simd_variant(simd_width));
+			d->timm.back().set_options(to_two_stage(d->options));
+		}
+
+		if (!cpus.empty())
+		{
+			// one shard per NUMA node of the cpus, in the order of the nodes
+			std::vector<int> nodes;
+			for (int c : cpus) { nodes.push_back(numa_node_of_cpu(c)); }
+			std::vector<int> distinct = nodes;
+			std::sort(distinct.begin(), distinct.end());
+			distinct.erase(std::unique(distinct.begin(), distinct.end()), distinct.end());
+			d->worker_node.resize(n_threads);
+			d->node_workers.assign(distinct.size(), 0);
+			for (int i = 0; i < n_threads; i++)
+			{
+				d->worker_node[i] = int(std::lower_bound(distinct.begin(), distinct.end(), nodes[i]) - distinct.begin());
+				d->node_workers[d->worker_node[i]]++;
+			}
+			d->shard_begin.assign(distinct.size() + 1, 0);
+			d->shard_next.reset(new std::atomic<size_t>[distinct.size()]);
+		}
+		else
+		{
+			d->worker_node.assign(n_threads, 0);
+			d->node_workers[0] = n_threads;
+		}
+
+		for (int i = 1; i < n_threads; i++)
+		{
+			auto p = d.get();
+			// the worker pins itself before it first touches its detector state
+			worker_affinity a;
+			if (!cpus.empty()) { a.cpus = { cpus[i] }; }
+			a.realtime_priority = realtime_priority;
+			d->workers.emplace_back([p, i, a]()
+			{
+				a.apply(0);
+				p->worker_loop(i);
+			});
+		}
+		*detector = d.release();
+		return TIMM_OK;
+	});
+}
+
+timm_status timm_create(int32_t simd_width, int32_t n_threads, timm_detector** detector)
+{
+	return create_detector(simd_width, n_threads, std::vector<int>(), 0, detector);
+}
+
+timm_status timm_create_pinned(int32_t simd_width, const int32_t* cpus, int32_t n_cpus, int32_t realtime_priority, timm_detector** detector)
+{
+	if (cpus == nullptr || n_cpus < 1) { return fail(TIMM_ERROR_INVALID_ARGUMENT, "cpus is NULL or n_cpus < 1"); }
+	return create_detector(simd_width, n_cpus, std::vector<int>(cpus, cpus + n_cpus), realtime_priority, detector);
+}
+
+void timm_destroy(timm_detector* detector)
+{
+	delete detector;
+}
+
+timm_status timm_set_options(timm_detector* detector, const timm_options* options)
+{
+	if (detector == nullptr || options == nullptr) { return fail(TIMM_ERROR_INVALID_ARGUMENT, "detector or options is NULL"); }
+	if (!valid_options(*options)) { return fail(TIMM_ERROR_INVALID_ARGUMENT, "invalid options (down_scaling_width, blur, sobel or window_width)"); }
+	return guarded([&]()
+	{
+		detector->options = *options;
+		for (auto& t : detector->timm) { t.set_options(to_two_stage(*options)); }
+		return TIMM_OK;
+	});
+}
+
+timm_status timm_get_options(const timm_detector* detector, timm_options* options)
+{
+	if (detector == nullptr || options == nullptr) { return fail(TIMM_ERROR_INVALID_ARGUMENT, "detector or options is NULL"); }
+	*options = detector->options;
+	return TIMM_OK;
+}
+
+timm_status timm_process(timm_detector* detector, const uint8_t* data, int32_t width, int32_t height, ptrdiff_t stride, timm_result* result)
+{
+	if (detector == nullptr || result == nullptr) { return fail(TIMM_ERROR_INVALID_ARGUMENT, "detector or result is NULL"); }
+	timm_image img = { data, width, height, stride };
+	std::string error;
+	result->frame_id = 0;
+	auto s = detector->process(0, img, *result, error);
+	if (s != TIMM_OK) { last_error = error; }
+	return s;
+}
+
+timm_status timm_process_batch(timm_detector* detector, const timm_image* images, size_t n, timm_result* results)
+{
+	if (detector == nullptr || ((images == nullptr || results == nullptr) && n > 0)) { return fail(TIMM_ERROR_INVALID_ARGUMENT, "detector, images or results is NULL"); }
+	if (n == 0) { return TIMM_OK; }
+
+	auto d = detector;
+	{
+		std::lock_guard<std::mutex> lock(d->mtx);
+		d->batch_images = images;
+		d->batch_results = results;
+		d->batch_n = n;
+		d->start_shards(n);
+		d->batch_error.clear();
+		d->n_running = int(d->workers.size());
+		d->generation++;
+	}
+	d->cv_start.notify_all();
+	d->run_batch(0);
+	{
+		std::unique_lock<std::mutex> lock(d->mtx);
+		d->cv_done.wait(lock, [d]() { return d->n_running == 0; });
+	}
+
+	for (size_t k = 0; k < n; k++)
+	{
+		if (results[k].status != TIMM_OK)
+		{
+			last_error = "frame " + std::to_string(k) + ": " + d->batch_error;
+			return timm_status(results[k].status);
+		}
+	}
+	return TIMM_OK;
+}
+
+timm_status timm_stage_create(int32_t simd_width, int32_t n_threads, timm_stage** stage)
+{
+	if (stage == nullptr) { return fail(TIMM_ERROR_INVALID_ARGUMENT, "stage is NULL"); }
+	*stage = nullptr;
+	auto s = check_simd_width(simd_width);
+	if (s != TIMM_OK) { return s; }
+	if (n_threads < 1) { return fail(TIMM_ERROR_INVALID_ARGUMENT, "n_threads must be >= 1"); }
+
+	return guarded([&]()
+	{
+		auto st = std::make_unique<timm_stage>();
+		st->timm.setup(enum_simd_variant(simd_width));
+		st->timm.n_threads = n_threads;
+		#ifdef __TIMM_OPENCL__
+		if (simd_width >= USE_OPENCL) { st->kernel.setup(); }
+		#endif
+		*stage = st.release();
+		return TIMM_OK;
+	});
+}
+
+void timm_stage_destroy(timm_stage* stage)
+{
+	delete stage;
+}
+
+timm_status timm_stage_set_options(timm_stage* stage, const timm_stage_options* options)
+{
+	if (stage == nullptr || options == nullptr) { return fail(TIMM_ERROR_INVALID_ARGUMENT, "stage or options is NULL"); }
+	if (!valid_options(*options)) { return fail(TIMM_ERROR_INVALID_ARGUMENT, "invalid options (down_scaling_width, blur or sobel)"); }
+	stage->timm.opt = to_timm(*options);
+	return TIMM_OK;
+}
+
+timm_status timm_stage_get_options(const timm_stage* stage, timm_stage_options* options)
+{
+	if (stage == nullptr || options == nullptr) { return fail(TIMM_ERROR_INVALID_ARGUMENT, "stage or options is NULL"); }
+	*options = from_timm(stage->timm.opt);
+	return TIMM_OK;
+}
+
+timm_status timm_stage_process(timm_stage* stage, const uint8_t* data, int32_t width, int32_t height, ptrdiff_t stride, timm_result* result)
+{
+	if (stage == nullptr || result == nullptr) { return fail(TIMM_ERROR_INVALID_ARGUMENT, "stage or result is NULL"); }
+	if (!valid_image(data, width, height, stride)) { return fail(TIMM_ERROR_INVALID_ARGUMENT, "invalid image (data, width, height or stride)"); }
+	result->status = TIMM_ERROR_INTERNAL;
+	return guarded([&]()
+	{
+		using clock = std::chrono::steady_clock;
+		auto t0 = clock::now();
+		cv::Mat frame = wrap(data, width, height, stride);
+		const cv::Point2f p = stage->timm.pupil_center(frame);
+		result->x = result->x_coarse = p.x;
+		result->y = result->y_coarse = p.y;
+		result->frame_id = 0;
+		result->latency_ms = std::chrono::duration<float, std::milli>(clock::now() - t0).count();
+		result->status = TIMM_OK;
+		return TIMM_OK;
+	});
+}
+
+timm_status timm_multi_stream_create(int32_t n_threads, timm_multi_stream** ms)
+{
+	if (ms == nullptr) { return fail(TIMM_ERROR_INVALID_ARGUMENT, "ms is NULL"); }
+	*ms = nullptr;
+	if (n_threads < 1) { return fail(TIMM_ERROR_INVALID_ARGUMENT, "n_threads must be >= 1"); }
+	return guarded([&]()
+	{
+		*ms = new timm_multi_stream(n_threads);
+		return TIMM_OK;
+	});
+}
+
+timm_status timm_multi_stream_create_pinned(const int32_t* cpus, int32_t n_cpus, int32_t realtime_priority, timm_multi_stream** ms)
+{
+	if (ms == nullptr) { return fail(TIMM_ERROR_INVALID_ARGUMENT, "ms is NULL"); }
+	*ms = nullptr;
+	if (cpus == nullptr || n_cpus < 1) { return fail(TIMM_ERROR_INVALID_ARGUMENT, "cpus is NULL or n_cpus < 1"); }
+	return guarded([&]()
+	{
+		*ms = new timm_multi_stream(std::vector<int>(cpus, cpus + n_cpus), realtime_priority);
+		return TIMM_OK;
+	});
+}
+
+void timm_multi_stream_destroy(timm_multi_stream* ms)
+{
+	delete ms;
+}
+
+timm_status timm_multi_stream_add(timm_multi_stream* ms, int32_t simd_width, const timm_options* options,
+	timm_result_callback callback, void* user_data, int32_t* stream_id)
+{
+	if (ms == nullptr || stream_id == nullptr) { return fail(TIMM_ERROR_INVALID_ARGUMENT, "ms or stream_id is NULL"); }
+	// the OpenCL stages share one kernel object and cannot run concurrently
+	if (simd_width >= USE_OPENCL) { return fail(TIMM_ERROR_UNSUPPORTED, "multi streams support the CPU variants only"); }
+	auto s = check_simd_width(simd_width);
+	if (s != TIMM_OK) { return s; }
+
+	timm_options c;
+	if (options) { c = *options; }
+	else { timm_default_options(&c); }
+	if (!valid_options(c)) { return fail(TIMM_ERROR_INVALID_ARGUMENT, "invalid options (down_scaling_width, blur, sobel or window_width)"); }
+
+	return guarded([&]()
+	{
+		// the stream blurs its own copy of the frame, so Timm_two_stage may do it
+		auto o = to_two_stage(c);
+		o.blur = c.blur;
+
+		Timm_multi_stream::callback on_result;
+		if (callback)
+		{
+			on_result = [callback, user_data](int id, const Timm_multi_stream::result& r)
+			{
+				timm_result out;
+				to_result(r, out);
+				callback(id, &out, user_data);
+			};
+		}
+		*stream_id = ms->ms.add_stream(enum_simd_variant(simd_width), o, on_result);
+		return TIMM_OK;
+	});
+}
+
+timm_status timm_multi_stream_submit(timm_multi_stream* ms, int32_t stream_id, const uint8_t* data, int32_t width, int32_t height,
+	ptrdiff_t stride, uint64_t frame_id, int64_t deadline_us)
+{
+	if (ms == nullptr) { return fail(TIMM_ERROR_INVALID_ARGUMENT, "ms is NULL"); }
+	if (!valid_image(data, width, height, stride)) { return fail(TIMM_ERROR_INVALID_ARGUMENT, "invalid image (data, width, height or stride)"); }
+	return guarded([&]()
+	{
+		ms->ms.submit(stream_id, wrap(data, width, height, stride), frame_id, std::chrono::microseconds(std::max<int64_t>(0, deadline_us)));
+		return TIMM_OK;
+	});
+}
+
+timm_status timm_multi_stream_poll(timm_multi_stream* ms, int32_t stream_id, timm_result* result)
+{
+	if (ms == nullptr || result == nullptr) { return fail(TIMM_ERROR_INVALID_ARGUMENT, "ms or result is NULL"); }
+	return guarded([&]()
+	{
+		Timm_multi_stream::result r;
+		if (!ms->ms.poll(stream_id, r)) { return TIMM_NO_RESULT; }
+		to_result(r, *result);
+		return TIMM_OK;
+	});
+}
+
+} // extern "C"
+
+#ifdef OPENCL_ENABLED
+#include "opencl_kernel.cpp"
+#endif
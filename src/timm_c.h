@@ -0,0 +1,179 @@
+#pragma once
+
+/*
+ C interface of the two stage pupil center detector (Timm_two_stage), for use from other languages.
+ the target timm of CMakeLists.txt builds it as a shared library (libtimm.so, timm.dll) together with timm.cpp, with
+ TIMM_BUILD_LIBRARY defined and hidden visibility, so that only the TIMM_API functions are exported
+ (with OPENCL_ENABLED, timm_c.cpp includes the OpenCL kernel like the other tools).
+
+ - input images are 8 bit gray and passed as pointer, size and row stride. they are only read, never copied
+   (except by timm_multi_stream_submit, which is asynchronous).
+ - results are written into caller-provided structs. after the first frame of a given size, timm_process,
+   timm_process_batch and timm_stage_process reuse the buffers and threads of the detector, nothing is allocated per frame.
+ - a detector must not be used by two threads at the same time. different detectors are independent.
+ - functions return TIMM_OK or a negative timm_status. timm_last_error() describes the last error of the calling thread.
+*/
+
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(_WIN32)
+	#ifdef TIMM_BUILD_LIBRARY
+	#define TIMM_API __declspec(dllexport)
+	#else
+	#define TIMM_API __declspec(dllimport)
+	#endif
+#else
+	#define TIMM_API __attribute__((visibility("default")))
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// incremented whenever a struct or function signature changes
+#define TIMM_ABI_VERSION 1
+
+typedef enum timm_status
+{
+	TIMM_OK = 0,
+	TIMM_NO_RESULT = 1,                 // timm_multi_stream_poll: no frame of the stream has been processed yet
+	TIMM_ERROR_INVALID_ARGUMENT = -1,
+	TIMM_ERROR_UNSUPPORTED = -2,        // e.g. an OpenCL variant in a library built without OPENCL_ENABLED, or TIMM_VEC256 without AVX
+	TIMM_ERROR_INTERNAL = -3
+} timm_status;
+
+// values of timm_create's simd_width, see enum_simd_variant in timm.h
+typedef enum timm_simd_variant
+{
+	TIMM_NO_VEC = 32,
+	TIMM_VEC128 = 128,
+	TIMM_VEC256 = 256,
+	TIMM_VEC512 = 512,
+	TIMM_OPENCL = 4096,
+	TIMM_OPENCL_FULL = 8192,
+	TIMM_OPENCL_HYBRID = 16384
+} timm_simd_variant;
+
+// options of one stage, see Timm::options for the meaning and the enums of engine, rsqrt_precision and subpixel
+typedef struct timm_stage_options
+{
+	int32_t down_scaling_width;
+	int32_t blur;
+	int32_t sobel;
+	float gradient_threshold;
+	float postprocess_threshold;
+	float candidate_fraction;
+	int32_t candidate_min_weight;
+	int32_t engine;
+	float gradient_major_ratio;
+	int32_t rsqrt_precision;
+	int32_t subpixel;
+	int32_t subpixel_radius;
+} timm_stage_options;
+
+// see Timm_two_stage::options
+typedef struct timm_options
+{
+	int32_t blur;           // gaussian blur of the input frame, 0 = off. the blurred frame is kept by the detector, the input stays untouched
+	int32_t window_width;   // half width of the stage 2 window around the coarse estimate
+	timm_stage_options stage1;
+	timm_stage_options stage2;
+} timm_options;
+
+typedef struct timm_image
+{
+	const uint8_t* data;    // first pixel, 8 bit gray
+	int32_t width;
+	int32_t height;
+	ptrdiff_t stride;       // bytes between the starts of two rows, >= width
+} timm_image;
+
+typedef struct timm_result
+{
+	float x, y;               // pupil center in pixels of the input image
+	float x_coarse, y_coarse; // estimate of stage 1
+	uint64_t frame_id;        // multi stream: the id given to submit, otherwise the index in the batch (0 for timm_process)
+	float latency_ms;         // multi stream: from submit to the end of the computation, otherwise the computation time
+	int32_t status;           // timm_status of this frame. multi stream: TIMM_ERROR_INTERNAL if the detector failed on it
+} timm_result;
+
+typedef struct timm_detector timm_detector;
+typedef struct timm_stage timm_stage;
+typedef struct timm_multi_stream timm_multi_stream;
+
+// called from a worker thread of the multi stream pool after a frame has been processed
+typedef void (*timm_result_callback)(int32_t stream_id, const timm_result* result, void* user_data);
+
+TIMM_API uint32_t timm_abi_version(void);
+
+// message of the last error of the calling thread, empty if there was none. valid until the next failing call of this thread
+TIMM_API const char* timm_last_error(void);
+
+TIMM_API void timm_default_options(timm_options* options);
+
+// 1 if the library can create detectors with this simd_width, 0 if not (the create functions return TIMM_ERROR_UNSUPPORTED).
+// the x86 kernels are compiled in according to the build flags (e.g. -mavx2 for TIMM_VEC256), OpenCL with OPENCL_ENABLED
+TIMM_API int32_t timm_simd_width_supported(int32_t simd_width);
+
+
+////////////////////// single stream detector //////////////////////
+
+// n_threads: number of frames timm_process_batch processes in parallel (each thread has its own detector state).
+// OpenCL variants support only n_threads = 1
+TIMM_API timm_status timm_create(int32_t simd_width, int32_t n_threads, timm_detector** detector);
+
+// like timm_create with n_threads = n_cpus, but worker thread i (1 .. n_cpus-1) is pinned to cpus[i] and allocates its
+// detector state on the NUMA node of that cpu. the calling thread is worker 0, pin it to cpus[0] yourself if wanted.
+// timm_process_batch gives each node a contiguous share of the frames. realtime_priority > 0 runs the workers
+// with SCHED_FIFO of that priority (Windows: time critical priority), if permitted; 0 keeps normal scheduling
+TIMM_API timm_status timm_create_pinned(int32_t simd_width, const int32_t* cpus, int32_t n_cpus, int32_t realtime_priority,
+	timm_detector** detector);
+TIMM_API void timm_destroy(timm_detector* detector);
+
+TIMM_API timm_status timm_set_options(timm_detector* detector, const timm_options* options);
+TIMM_API timm_status timm_get_options(const timm_detector* detector, timm_options* options);
+
+TIMM_API timm_status timm_process(timm_detector* detector, const uint8_t* data, int32_t width, int32_t height, ptrdiff_t stride, timm_result* result);
+
+// processes n independent frames (e.g. both eyes or many recorded frames), results[i] belongs to images[i].
+// returns the first error of a frame, the status of every frame is in its result
+TIMM_API timm_status timm_process_batch(timm_detector* detector, const timm_image* images, size_t n, timm_result* results);
+
+
+////////////////////// single stage detector (Timm), without the windowed refinement //////////////////////
+
+// n_threads: threads that evaluate the objective function of one frame (Timm::n_threads)
+TIMM_API timm_status timm_stage_create(int32_t simd_width, int32_t n_threads, timm_stage** stage);
+TIMM_API void timm_stage_destroy(timm_stage* stage);
+
+TIMM_API timm_status timm_stage_set_options(timm_stage* stage, const timm_stage_options* options);
+TIMM_API timm_status timm_stage_get_options(const timm_stage* stage, timm_stage_options* options);
+
+// x_coarse and y_coarse of the result are equal to x and y
+TIMM_API timm_status timm_stage_process(timm_stage* stage, const uint8_t* data, int32_t width, int32_t height, ptrdiff_t stride, timm_result* result);
+
+
+////////////////////// many asynchronous streams on one thread pool (see Timm_multi_stream) //////////////////////
+
+TIMM_API timm_status timm_multi_stream_create(int32_t n_threads, timm_multi_stream** ms);
+// one worker pinned to each cpu, streams are bound round robin to the NUMA nodes of the cpus. realtime_priority as in timm_create_pinned
+TIMM_API timm_status timm_multi_stream_create_pinned(const int32_t* cpus, int32_t n_cpus, int32_t realtime_priority, timm_multi_stream** ms);
+TIMM_API void timm_multi_stream_destroy(timm_multi_stream* ms);
+
+// CPU variants only. callback may be NULL, then results are only available through timm_multi_stream_poll
+TIMM_API timm_status timm_multi_stream_add(timm_multi_stream* ms, int32_t simd_width, const timm_options* options,
+	timm_result_callback callback, void* user_data, int32_t* stream_id);
+
+// copies the frame into the buffer of the stream and returns immediately. an unprocessed older frame of the stream is dropped.
+// deadline_us is relative to now and only used for scheduling
+TIMM_API timm_status timm_multi_stream_submit(timm_multi_stream* ms, int32_t stream_id, const uint8_t* data, int32_t width, int32_t height,
+	ptrdiff_t stride, uint64_t frame_id, int64_t deadline_us);
+
+// latest result of a stream. returns TIMM_NO_RESULT if no frame has been processed yet. a frame the detector failed on
+// gives a result with status TIMM_ERROR_INTERNAL (and x, y = -1), the call itself returns TIMM_OK
+TIMM_API timm_status timm_multi_stream_poll(timm_multi_stream* ms, int32_t stream_id, timm_result* result);
+
+#ifdef __cplusplus
+}
+#endif
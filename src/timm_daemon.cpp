@@ -0,0 +1,370 @@
+// pupil center detection service for the processes of one machine (Linux only): clients publish frames into a shared
+// memory ring (see shm_ring.h, Shm_client), the daemon processes them on one worker pool and publishes the results back.
+//   timm_daemon [-name /timm] [-threads n] [-simd n] [-max_size w h] [-group name]
+//     runs until SIGINT / SIGTERM. prints per client statistics when a client disconnects.
+//     the segment is only accessible to the user of the daemon, or with -group to the members of that group as well.
+//     -simd defaults to the widest CPU variant of this build up to 256.
+//   timm_daemon -selftest [-clients n] [-frames n] [-fps f] [-size w h] [-threads n] [-simd n]
+//     starts the daemon and n client processes that submit synthetic eye images at f fps each (0 = as fast as possible),
+//     and reports the end-to-end latency (submit to receive) and the pixel error per client.
+//
+// the frames of one client are processed in order, by one worker at a time (like the streams of Timm_multi_stream),
+// so n_threads busy clients are processed in parallel.
+// a frame the detector fails on (it throws) gets the result -1, -1 like a frame of invalid size, the daemon keeps running.
+
+#include <iostream>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <thread>
+#include <atomic>
+#include <csignal>
+#include <sys/wait.h>
+#include <grp.h>
+
+#include "timm_two_stage.h"
+#include "thread_pool.h"
+#include "shm_ring.h"
+#include "helpers.h"
+
+class Shm_daemon
+{
+public:
+	struct client_stats
+	{
+		size_t n_frames = 0;
+		double latency_sum_ms = 0.0; // submit to result published, including the time in the ring
+		float latency_max_ms = 0.0f;
+	};
+
+	// creates the shared memory segment. the workers start with run(), so that client processes can be forked before
+	// group: see shm_ring::Segment
+	Shm_daemon(const std::string& name, int max_width, int max_height, enum_simd_variant simd_width, int n_threads, gid_t group = gid_t(-1))
+		: seg(name, max_width, max_height, group), simd_width(simd_width), n_threads(n_threads)
+	{
+		// the OpenCL stages share one kernel object and cannot run concurrently
+		if (simd_width >= USE_OPENCL) { throw std::invalid_argument("timm_daemon does not support OpenCL"); }
+		for (int i = 0; i < shm_ring::max_clients; i++) { clients.emplace_back(); }
+	}
+
+	// serves clients until stop()
+	void run()
+	{
+		using namespace shm_ring;
+		Thread_pool pool(n_threads);
+		auto ctl = seg.ctl;
+		uint64_t t_liveness = now_ns();
+		while (!stopped)
+		{
+			const uint32_t bell = ctl->doorbell.load(std::memory_order_acquire);
+
+			// dead clients are looked for about once per second
+			const bool check_alive = now_ns() - t_liveness > 1000000000ull;
+			if (check_alive) { t_liveness = now_ns(); }
+
+			for (int i = 0; i < max_clients; i++)
+			{
+				auto& cb = ctl->clients[i];
+				const uint32_t state = cb.state.load(std::memory_order_acquire);
+				const bool pending = cb.frame_head.load(std::memory_order_acquire) != cb.frame_tail.load(std::memory_order_relaxed);
+				if ((state == CLIENT_CONNECTED || state == CLIENT_CLOSING) && pending)
+				{
+					if (!clients[i].busy.exchange(true)) { pool.push([this, i]() { serve(i); }); }
+				}
+				else if (state == CLIENT_CLOSING || (state == CLIENT_CONNECTED && check_alive && kill(cb.pid, 0) != 0 && errno == ESRCH))
+				{
+					// a closing client is freed once no worker processes its frames
+					if (!clients[i].busy.exchange(true))
+					{
+						release(i);
+						clients[i].busy.store(false);
+					}
+				}
+			}
+			futex_wait(ctl->doorbell, bell, 100);
+		}
+	}
+
+	void stop()
+	{
+		stopped = true;
+		shm_ring::futex_wake(seg.ctl->doorbell);
+	}
+
+	// statistics of all clients that have disconnected so far, in order
+	std::vector<client_stats> finished()
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		return finished_stats;
+	}
+
+	typename Timm_two_stage::options opt;
+
+private:
+	struct client
+	{
+		std::atomic<bool> busy{ false };      // a worker (or release) owns the client
+		std::unique_ptr<Timm_two_stage> timm; // created with the first frame
+		client_stats stats;
+	};
+
+	shm_ring::Segment seg;
+	enum_simd_variant simd_width;
+	int n_threads;
+	std::deque<client> clients; // deque: client is not movable
+	std::atomic<bool> stopped{ false };
+	std::mutex mtx;
+	std::vector<client_stats> finished_stats;
+
+	// worker: processes the frames of client i until its ring is empty
+	void serve(int i)
+	{
+		auto& cb = seg.ctl->clients[i];
+		auto& c = clients[i];
+		while (true)
+		{
+			const uint64_t seq = cb.frame_tail.load(std::memory_order_relaxed);
+			if (seq == cb.frame_head.load(std::memory_order_acquire))
+			{
+				c.busy.store(false);
+				// a frame published between the check and the reset may have missed its doorbell
+				if (cb.frame_head.load(std::memory_order_acquire) != seq && !c.busy.exchange(true)) { continue; }
+				return;
+			}
+			process(i, seq);
+		}
+	}
+
+	void process(int i, uint64_t seq)
+	{
+		using namespace shm_ring;
+		auto& cb = seg.ctl->clients[i];
+		auto& c = clients[i];
+		const frame_slot slot = cb.slots[seq % n_frame_slots];
+
+		// processed in place: the slot belongs to the daemon until frame_tail is advanced (the blur writes into it)
+		result r;
+		r.frame_id = slot.frame_id;
+		r.t_submit_ns = slot.t_submit_ns;
+		r.x = r.y = r.x_coarse = r.y_coarse = -1.0f;
+		if (slot.width > 0 && slot.height > 0 && slot.width <= seg.ctl->max_width && slot.height <= seg.ctl->max_height)
+		{
+			// an exception must not escape the pool task (it would terminate the daemon with all its clients),
+			// and the frame must still be completed, otherwise the client waits for its slot forever
+			try
+			{
+				if (!c.timm)
+				{
+					c.timm = std::make_unique<Timm_two_stage>();
+					c.timm->setup(simd_width);
+					c.timm->set_options(opt);
+				}
+				cv::Mat frame(slot.height, slot.width, CV_8U, slot_data(seg.ctl, i, seq), slot.width);
+				cv::Point2f p, p_coarse;
+				std::tie(p, p_coarse) = c.timm->pupil_center(frame);
+				r.x = p.x; r.y = p.y;
+				r.x_coarse = p_coarse.x; r.y_coarse = p_coarse.y;
+			}
+			catch (const std::exception& e)
+			{
+				c.timm.reset(); // it may be left in an inconsistent state
+				std::cerr << "client " << i << ", frame " << slot.frame_id << ": " << e.what() << "\n";
+			}
+		}
+		r.t_done_ns = now_ns();
+
+		cb.frame_tail.store(seq + 1, std::memory_order_release);
+		cb.slot_futex.fetch_add(1, std::memory_order_release);
+		futex_wake(cb.slot_futex);
+
+		const uint64_t head = cb.result_head.load(std::memory_order_relaxed);
+		if (head - cb.result_tail.load(std::memory_order_acquire) >= uint64_t(n_results)) { cb.n_results_dropped++; }
+		else
+		{
+			cb.results[head % n_results] = r;
+			cb.result_head.store(head + 1, std::memory_order_release);
+		}
+		cb.result_futex.fetch_add(1, std::memory_order_release);
+		futex_wake(cb.result_futex);
+
+		const float latency = (r.t_done_ns - r.t_submit_ns) * 1e-6f;
+		c.stats.n_frames++;
+		c.stats.latency_sum_ms += latency;
+		c.stats.latency_max_ms = std::max(c.stats.latency_max_ms, latency);
+	}
+
+	// frees the block of a disconnected client. the caller owns clients[i]
+	void release(int i)
+	{
+		using namespace shm_ring;
+		auto& cb = seg.ctl->clients[i];
+		auto& c = clients[i];
+		auto& st = c.stats;
+		std::cout << "client " << i << " (pid " << cb.pid << ") disconnected: " << st.n_frames << " frames, latency mean "
+			<< (st.n_frames ? st.latency_sum_ms / st.n_frames : 0.0) << " ms, max " << st.latency_max_ms << " ms, results dropped "
+			<< cb.n_results_dropped.load() << "\n";
+		{
+			std::lock_guard<std::mutex> lock(mtx);
+			finished_stats.push_back(st);
+		}
+
+		st = client_stats();
+		c.timm.reset();
+		cb.pid = 0;
+		cb.frame_head.store(0);
+		cb.frame_tail.store(0);
+		cb.result_head.store(0);
+		cb.result_tail.store(0);
+		cb.n_results_dropped.store(0);
+		cb.state.store(CLIENT_FREE, std::memory_order_release);
+	}
+};
+
+
+// client stand-in of the self test: submits n_frames synthetic eye images at fps (0 = as fast as the ring allows)
+// and receives the results on a second thread. returns the process exit code
+int run_test_client(const std::string& name, int id, int n_frames, float fps, int w, int h)
+{
+	using namespace std;
+	try
+	{
+		Shm_client client(name);
+
+		// a few distinct frames, submitted round robin
+		mt19937 rng(1000 + id);
+		vector<cv::Mat> frames(16);
+		vector<cv::Point> centers(frames.size());
+		for (size_t i = 0; i < frames.size(); i++) { frames[i] = synthetic_eye(rng, w, h, centers[i]); }
+
+		vector<float> latencies, errors;
+		latencies.reserve(n_frames);
+		thread receiver([&]()
+		{
+			Shm_client::result r;
+			for (int n = 0; n < n_frames; n++)
+			{
+				if (!client.receive(r, 2000)) { break; }
+				latencies.push_back((shm_ring::now_ns() - r.t_submit_ns) * 1e-6f);
+				errors.push_back(cv::norm(cv::Point2f(r.x, r.y) - cv::Point2f(centers[r.frame_id % frames.size()])));
+				if (r.frame_id + 1 == uint64_t(n_frames)) { break; }
+			}
+		});
+
+		const auto period = chrono::nanoseconds(fps > 0 ? int64_t(1e9 / fps) : 0);
+		auto t_next = chrono::steady_clock::now();
+		for (int i = 0; i < n_frames; i++)
+		{
+			if (fps > 0)
+			{
+				this_thread::sleep_until(t_next);
+				t_next += period;
+			}
+			client.submit(frames[i % frames.size()], i);
+		}
+		receiver.join();
+
+		const size_t n = latencies.size();
+		double sum = 0.0, error_sum = 0.0;
+		for (float l : latencies) { sum += l; }
+		for (float e : errors) { error_sum += e; }
+		const uint64_t dropped = client.n_results_dropped();
+		cout << "client " << id << ": sent " << n_frames << ", received " << n << ", dropped " << dropped
+			<< ", end-to-end latency mean " << (n ? sum / n : 0.0) << " ms, median " << percentile(latencies, 0.5f)
+			<< " ms, 99% " << percentile(latencies, 0.99f) << " ms, max " << percentile(latencies, 1.0f)
+			<< " ms, mean error " << (n ? error_sum / n : 0.0) << " px\n" << flush;
+		return n + dropped == size_t(n_frames) ? 0 : 1;
+	}
+	catch (const exception& e)
+	{
+		cerr << "client " << id << ": " << e.what() << "\n";
+		return 1;
+	}
+}
+
+
+static Shm_daemon* running_daemon = nullptr;
+
+int main(int argc, char* argv[])
+{
+	using namespace std;
+
+	string name = "/timm";
+	int n_threads = max(1, int(thread::hardware_concurrency()) - 1);
+	int simd = Timm::default_simd_width();
+	int max_w = 640, max_h = 480;
+	gid_t gid = gid_t(-1);
+	bool selftest = false;
+	int n_clients = 4, n_frames = 500, w = 320, h = 240;
+	float fps = 120.0f;
+	for (int i = 1; i < argc; i++)
+	{
+		string a = argv[i];
+		if (a == "-name" && i + 1 < argc) { name = argv[++i]; }
+		else if (a == "-threads" && i + 1 < argc) { n_threads = atoi(argv[++i]); }
+		else if (a == "-simd" && i + 1 < argc) { simd = atoi(argv[++i]); }
+		else if (a == "-max_size" && i + 2 < argc) { max_w = atoi(argv[i + 1]); max_h = atoi(argv[i + 2]); i += 2; }
+		else if (a == "-group" && i + 1 < argc)
+		{
+			const group* g = getgrnam(argv[++i]);
+			if (!g) { cerr << "unknown group " << argv[i] << "\n"; return 1; }
+			gid = g->gr_gid;
+		}
+		else if (a == "-selftest") { selftest = true; }
+		else if (a == "-clients" && i + 1 < argc) { n_clients = atoi(argv[++i]); }
+		else if (a == "-frames" && i + 1 < argc) { n_frames = atoi(argv[++i]); }
+		else if (a == "-fps" && i + 1 < argc) { fps = float(atof(argv[++i])); }
+		else if (a == "-size" && i + 2 < argc) { w = atoi(argv[i + 1]); h = atoi(argv[i + 2]); i += 2; }
+		else { cerr << "unknown argument " << a << "\n"; return 1; }
+	}
+
+	if (selftest)
+	{
+		// the test gets its own segment, so that it does not collide with a running daemon
+		name += "_selftest_" + to_string(getpid());
+		max_w = max(max_w, w);
+		max_h = max(max_h, h);
+		n_clients = min(n_clients, shm_ring::max_clients);
+	}
+
+	Shm_daemon daemon(name, max_w, max_h, enum_simd_variant(simd), n_threads, gid);
+
+	if (!selftest)
+	{
+		running_daemon = &daemon;
+		signal(SIGINT, [](int) { running_daemon->stop(); });
+		signal(SIGTERM, [](int) { running_daemon->stop(); });
+		cout << "timm daemon on " << name << ", " << n_threads << " threads, max frame size " << max_w << " x " << max_h << "\n";
+		daemon.run();
+		return 0;
+	}
+
+	// the clients are forked before the daemon starts any thread
+	vector<pid_t> children;
+	for (int i = 0; i < n_clients; i++)
+	{
+		pid_t pid = fork();
+		if (pid == 0) { _exit(run_test_client(name, i, n_frames, fps, w, h)); }
+		if (pid < 0) { cerr << "fork failed\n"; break; }
+		children.push_back(pid);
+	}
+
+	thread server([&]() { daemon.run(); });
+	int n_failed = 0;
+	for (pid_t pid : children)
+	{
+		int status = 0;
+		waitpid(pid, &status, 0);
+		n_failed += !(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+	}
+	// let the daemon free the last client blocks (a client that failed to connect never shows up)
+	for (int i = 0; i < 300 && daemon.finished().size() < children.size(); i++) { this_thread::sleep_for(chrono::milliseconds(10)); }
+	daemon.stop();
+	server.join();
+
+	cout << "self test with " << children.size() << " clients: " << (n_failed ? "FAILED" : "ok") << "\n";
+	return n_failed ? 1 : 0;
+}
+
+#ifdef OPENCL_ENABLED
+#include "opencl_kernel.cpp"
+#endif
@@ -0,0 +1,240 @@
+#pragma once
+
+#include "timm_two_stage.h"
+#include "thread_pool.h"
+#include "affinity.h"
+
+#include <deque>
+#include <chrono>
+#include <atomic>
+#include <iostream>
+
+// runs many eye camera streams on one shared worker pool.
+//
+// every stream holds at most one pending frame: a newer frame replaces an unprocessed older one
+// (counted as dropped), and a stream is never processed by two workers at once.
+// a free worker always takes the pending frame with the earliest deadline. because a stream can
+// occupy at most one worker and one queue slot, a stream with tight deadlines cannot starve the others.
+//
+// per stream, only the two Timm stages (a few small float images) and one frame buffer are kept,
+// so dozens of streams stay small.
+//
+// a frame the detector throws on gets a result with failed set (and the position -1, -1), the stream goes on with
+// its next frame. an exception of a callback is reported to std::cerr and does not stop the worker either.
+//
+// pinned mode (constructed with a cpu list): there is one worker pool per NUMA node, each worker is pinned to one cpu of it,
+// and every stream is bound to a node (round robin). a stream is only processed by the workers of its node, so its
+// detector state is first touched there and stays in the caches and memory of that node.
+class Timm_multi_stream
+{
+public:
+	using clock = std::chrono::steady_clock;
+
+	struct result
+	{
+		uint64_t frame_id = 0;
+		cv::Point2f pupil_pos;
+		cv::Point2f pupil_pos_coarse;
+		float latency_ms = 0.0f; // from submit to end of computation
+		bool failed = false;     // the detector threw on this frame
+	};
+
+	// called from the worker thread after a frame of a stream has been processed
+	using callback = std::function<void(int stream_id, const result&)>;
+
+	struct stream_stats
+	{
+		size_t n_processed = 0;
+		size_t n_dropped = 0;          // replaced by a newer frame before they were processed
+		size_t n_deadline_misses = 0;  // finished after their deadline
+		size_t n_failed = 0;           // the detector threw, not included in n_processed and the latencies
+		float latency_mean_ms = 0.0f;
+		float latency_max_ms = 0.0f;
+	};
+
+private:
+	struct stream
+	{
+		Timm_two_stage timm;
+		cv::Mat frame;          // pending frame
+		cv::Mat frame_work;     // frame being processed
+		bool pending = false;
+		bool busy = false;
+		uint64_t frame_id = 0;
+		clock::time_point t_submit;
+		clock::time_point deadline;
+		callback on_result;
+		result last_result;
+		bool has_result = false;
+		stream_stats stats;
+		int node = 0; // index into pools
+	};
+
+	std::deque<stream> streams; // deque: references stay valid when streams are added
+	std::mutex mtx;
+	std::vector<std::unique_ptr<Thread_pool>> pools; // one per NUMA node in pinned mode. last member: joined first
+
+public:
+
+	Timm_multi_stream(int n_threads = std::thread::hardware_concurrency())
+	{
+		pools.emplace_back(std::make_unique<Thread_pool>(n_threads));
+	}
+
+	// pinned mode: one worker per cpu, pinned to it. realtime_priority > 0 runs the workers with SCHED_FIFO (see affinity.h)
+	Timm_multi_stream(const std::vector<int>& cpus, int realtime_priority = 0)
+	{
+		if (cpus.empty()) { throw std::invalid_argument("Timm_multi_stream: empty cpu list"); }
+		for (auto& node_cpus : cpus_by_numa_node(cpus))
+		{
+			worker_affinity a{ node_cpus, realtime_priority };
+			pools.emplace_back(std::make_unique<Thread_pool>(int(node_cpus.size()), [a](int i) { a.apply(i); }));
+		}
+	}
+
+	int n_nodes() const { return int(pools.size()); }
+
+	// returns the id of the new stream
+	int add_stream(enum_simd_variant simd_width, typename Timm_two_stage::options o, callback on_result = nullptr)
+	{
+		// the OpenCL stages share one kernel object and cannot run concurrently
+		if (simd_width >= USE_OPENCL) { throw std::invalid_argument("Timm_multi_stream does not support OpenCL"); }
+
+		std::lock_guard<std::mutex> lock(mtx);
+		streams.emplace_back();
+		auto& s = streams.back();
+		s.timm.setup(simd_width);
+		s.timm.set_options(o);
+		s.on_result = on_result;
+		s.node = int((streams.size() - 1) % pools.size());
+		return int(streams.size()) - 1;
+	}
+
+	// queues a frame of the given stream. the frame is copied, the call never blocks on computation.
+	// deadline is relative to now
+	void submit(int stream_id, const cv::Mat& frame, uint64_t frame_id, std::chrono::microseconds deadline)
+	{
+		int node = 0;
+		{
+			std::lock_guard<std::mutex> lock(mtx);
+			auto& s = streams.at(stream_id);
+			if (s.pending) { s.stats.n_dropped++; }
+			frame.copyTo(s.frame);
+			s.pending = true;
+			s.frame_id = frame_id;
+			s.t_submit = clock::now();
+			s.deadline = s.t_submit + deadline;
+			node = s.node;
+		}
+		pools[node]->push([this, node]() { run_next(node); });
+	}
+
+	// latest result of a stream. returns false if there is none yet
+	bool poll(int stream_id, result& r)
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		auto& s = streams.at(stream_id);
+		r = s.last_result;
+		return s.has_result;
+	}
+
+	stream_stats stats(int stream_id)
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		return streams.at(stream_id).stats;
+	}
+
+	int n_streams()
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		return int(streams.size());
+	}
+
+	void print_stats(std::ostream& os = std::cout)
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		for (size_t i = 0; i < streams.size(); i++)
+		{
+			auto& st = streams[i].stats;
+			os << "stream " << i << (pools.size() > 1 ? " (node " + std::to_string(streams[i].node) + ")" : std::string()) << ": processed " << st.n_processed << ", dropped " << st.n_dropped
+				<< ", deadline misses " << st.n_deadline_misses << ", failed " << st.n_failed << ", latency mean " << st.latency_mean_ms
+				<< " ms, max " << st.latency_max_ms << " ms\n";
+		}
+	}
+
+private:
+
+	// executed by a worker of the given node: processes the pending frame of the node with the earliest deadline (if any)
+	void run_next(int node)
+	{
+		stream* s = nullptr;
+		int stream_id = -1;
+		uint64_t frame_id = 0;
+		clock::time_point t_submit, deadline;
+		{
+			std::lock_guard<std::mutex> lock(mtx);
+			for (size_t i = 0; i < streams.size(); i++)
+			{
+				auto& c = streams[i];
+				if (c.node == node && c.pending && !c.busy && (s == nullptr || c.deadline < s->deadline))
+				{
+					s = &c;
+					stream_id = int(i);
+				}
+			}
+			// nothing to do: all pending frames are being processed by other workers. the worker that finishes
+			// a busy stream re-schedules it
+			if (s == nullptr) { return; }
+
+			std::swap(s->frame, s->frame_work);
+			s->pending = false;
+			s->busy = true;
+			frame_id = s->frame_id;
+			t_submit = s->t_submit;
+			deadline = s->deadline;
+		}
+
+		// an exception must not escape the pool task (it would terminate the process), and busy has to be reset below
+		result r;
+		r.frame_id = frame_id;
+		try { std::tie(r.pupil_pos, r.pupil_pos_coarse) = s->timm.pupil_center(s->frame_work); }
+		catch (const std::exception& e)
+		{
+			r.pupil_pos = r.pupil_pos_coarse = cv::Point2f(-1.0f, -1.0f);
+			r.failed = true;
+			std::cerr << "Timm_multi_stream: stream " << stream_id << ", frame " << frame_id << ": " << e.what() << "\n";
+		}
+		auto t_end = clock::now();
+		r.latency_ms = std::chrono::duration<float, std::milli>(t_end - t_submit).count();
+
+		bool reschedule = false;
+		callback on_result;
+		{
+			std::lock_guard<std::mutex> lock(mtx);
+			s->busy = false;
+			s->last_result = r;
+			s->has_result = true;
+
+			auto& st = s->stats;
+			if (r.failed) { st.n_failed++; }
+			else
+			{
+				st.n_processed++;
+				if (t_end > deadline) { st.n_deadline_misses++; }
+				st.latency_mean_ms += (r.latency_ms - st.latency_mean_ms) / st.n_processed;
+				st.latency_max_ms = std::max(st.latency_max_ms, r.latency_ms);
+			}
+
+			// a frame of this stream arrived while it was busy and its task may have found nothing to do
+			reschedule = s->pending;
+			on_result = s->on_result;
+		}
+
+		if (on_result)
+		{
+			try { on_result(stream_id, r); }
+			catch (const std::exception& e) { std::cerr << "Timm_multi_stream: callback of stream " << stream_id << ": " << e.what() << "\n"; }
+		}
+		if (reschedule) { pools[node]->push([this, node]() { run_next(node); }); }
+	}
+};
@@ -0,0 +1,181 @@
+#pragma once
+
+// here you can choose to include the version of timm.h with opencl support
+#ifdef OPENCL_ENABLED
+#include "timm_opencl.h"
+#else
+#include "timm.h"
+#endif
+
+#include "helpers.h"
+
+#include <vector>
+
+// generalisation of Timm_two_stage to an arbitrary number of stages.
+// every stage refines the previous estimate within a (usually shrinking) window.
+// all stages work on a gaussian image pyramid that is computed once per frame:
+// each stage picks the smallest pyramid level that still has at least down_scaling_width
+// pixels across its window, so the cost per stage stays nearly constant even for large
+// (e.g. 640x480) eye camera images.
+class Timm_n_stage
+{
+private:
+
+	// pyramid[0] is the input frame, pyramid[i] has half the resolution of pyramid[i-1]
+	std::vector<cv::Mat> pyramid;
+	cv::Mat frame_blurred;
+	enum_simd_variant simd_width = Timm::default_simd_width();
+
+public:
+	struct stage_options
+	{
+		// half width of the window around the previous estimate, in pixels of the input frame.
+		// 0 = use the whole frame (the first stage usually does that)
+		int window_width = 0;
+		// timm.down_scaling_width is the resolution of this stage
+		typename Timm::options timm;
+	};
+
+	struct options
+	{
+		int blur = 0;
+		std::vector<stage_options> stages;
+
+		// the default configuration is the same as Timm_two_stage
+		options()
+		{
+			stages.resize(2);
+			stages[1].window_width = 150;
+		}
+	} opt;
+
+	#ifdef __TIMM_OPENCL__
+	Opencl_kernel gradient_kernel;
+	std::vector<Timm_opencl> stages;
+	#else
+	std::vector<Timm> stages;
+	#endif
+
+	// estimates of all stages of the last frame, in pixels of the input frame
+	std::vector<cv::Point2f> stage_positions;
+
+	void setup(enum_simd_variant simd_width_)
+	{
+		simd_width = simd_width_;
+		for (auto& s : stages) { s.setup(simd_width); }
+
+		#ifdef __TIMM_OPENCL__
+		// only try to compile the opencl kernel if we actually use OpenCL.
+		if (simd_width == USE_OPENCL || simd_width == USE_OPENCL_FULL || simd_width == USE_OPENCL_HYBRID)
+		{
+			gradient_kernel.setup();
+		}
+		#endif
+	}
+
+	void set_options(options o)
+	{
+		opt = o;
+		while (stages.size() > opt.stages.size()) { stages.pop_back(); }
+		while (stages.size() < opt.stages.size())
+		{
+			#ifdef __TIMM_OPENCL__
+			stages.emplace_back(gradient_kernel);
+			#else
+			stages.emplace_back();
+			#endif
+			stages.back().setup(simd_width);
+		}
+		for (size_t i = 0; i < stages.size(); i++)
+		{
+			#ifdef __TIMM_OPENCL__
+			stages[i].stage = i;
+			#endif
+			stages[i].opt = opt.stages[i].timm;
+			// no need to compute more pixels than the window has (window_width is half of its width)
+			if (opt.stages[i].window_width > 0)
+			{
+				stages[i].opt.down_scaling_width = std::min(stages[i].opt.down_scaling_width, 2 * opt.stages[i].window_width);
+			}
+		}
+		stage_positions.resize(stages.size());
+	}
+
+	Timm_n_stage()
+	{
+		set_options(opt);
+	}
+
+	// runs all stages and returns the estimate of the last one
+	cv::Point2f pupil_center(cv::Mat& frame_gray)
+	{
+		cv::Mat frame = frame_gray;
+		if (opt.blur > 0)
+		{
+			GaussianBlur(frame_gray, frame_blurred, cv::Size(opt.blur, opt.blur), 0);
+			frame = frame_blurred;
+		}
+
+		build_pyramid(frame);
+
+		// without a previous estimate, a window is centered in the frame
+		cv::Point2f pos(frame.cols / 2, frame.rows / 2);
+		for (size_t i = 0; i < stages.size(); i++)
+		{
+			cv::Rect rect(0, 0, frame.cols, frame.rows);
+			if (opt.stages[i].window_width > 0)
+			{
+				rect = fit_rectangle(frame, pos, opt.stages[i].window_width);
+			}
+
+			// the window in pyramid level coordinates
+			const int level = select_level(rect.width, stages[i].opt.down_scaling_width);
+			const cv::Mat& img = pyramid[level];
+			cv::Rect rect_level(rect.x >> level, rect.y >> level, rect.width >> level, rect.height >> level);
+			rect_level &= cv::Rect(0, 0, img.cols, img.rows);
+
+			cv::Mat img_windowed = img(rect_level);
+			cv::Point2f p = stages[i].pupil_center(img_windowed);
+
+			// back to input frame coordinates. pyrDown centers pixel p of level l on input pixel p * 2^l
+			// (unlike cv::resize, which Timm undoes with (p + 0.5) * s - 0.5)
+			const float s = 1 << level;
+			pos.x = (p.x + rect_level.x) * s;
+			pos.y = (p.y + rect_level.y) * s;
+			stage_positions[i] = pos;
+		}
+		return pos;
+	}
+
+private:
+
+	// the smallest level that has at least min_width pixels across a window of width window_width
+	int select_level(int window_width, int min_width)
+	{
+		int level = 0;
+		while (level + 1 < int(pyramid.size()) && (window_width >> (level + 1)) >= min_width) { level++; }
+		return level;
+	}
+
+	// computes only the levels that one of the stages will use
+	void build_pyramid(const cv::Mat& frame)
+	{
+		int n_levels = 1;
+		for (size_t i = 0; i < stages.size(); i++)
+		{
+			int w = frame.cols;
+			if (opt.stages[i].window_width > 0) { w = std::min(w, 2 * opt.stages[i].window_width); }
+
+			int level = 0;
+			while ((w >> (level + 1)) >= stages[i].opt.down_scaling_width && (frame.rows >> (level + 1)) > 0) { level++; }
+			n_levels = std::max(n_levels, level + 1);
+		}
+
+		pyramid.resize(n_levels);
+		pyramid[0] = frame;
+		for (int l = 1; l < n_levels; l++)
+		{
+			cv::pyrDown(pyramid[l - 1], pyramid[l]);
+		}
+	}
+};
@@ -6,48 +6,193 @@
 
 #include "opencl_kernel.h"
 
+#include <chrono>
+
 
 class Timm_opencl : public Timm
 {
 private:
 	Opencl_kernel& kernel;
+
+	// the variant passed to setup. for USE_OPENCL_HYBRID, Timm::simd_width is the CPU variant
+	enum_simd_variant mode = Timm::default_simd_width();
 public:
-	
+	// selects the device buffers of this stage in the shared Opencl_kernel
+	int stage = 0;
+
+	// USE_OPENCL_HYBRID: the device computes the first rows of the objective function, the CPU threads (n_threads)
+	// the remaining rows. the fraction of rows on the device adapts to the measured speed of both sides.
+	struct hybrid_options
+	{
+		enum_simd_variant cpu_simd = Timm::default_simd_width();
+		float device_fraction = 0.5f;  // initial value, applied by setup
+		float adapt_rate = 0.2f;       // weight of the last frame in the moving average. 0 = fixed split
+		float min_fraction = 0.05f;    // both sides always get some rows, so that both are measured
+		float max_fraction = 0.95f;
+	} hybrid;
+
+	// current fraction of rows computed on the device
+	float device_fraction() const { return hybrid_fraction; }
+
 	Timm_opencl(Opencl_kernel& k) : kernel(k)
 	{
 
 	}
 
-	cv::Point pupil_center(cv::Mat& eye_img)
+	// hides Timm::setup
+	void setup(enum_simd_variant simd_width_)
 	{
+		mode = simd_width_;
+		hybrid_fraction = hybrid.device_fraction;
+		Timm::setup(mode == USE_OPENCL_HYBRID ? hybrid.cpu_simd : mode);
+	}
 
-		if (simd_width == USE_OPENCL)
-		{
-			pre_process(eye_img);
+	// future-style result of pupil_center_async
+	struct pending
+	{
+		Opencl_kernel::handle gpu;
+		int weight_slot = 0; // index into async_weights
+		int original_width = 0;
+		int n_strong_gradients = 0;
+	};
+
+	// pre-processes the eye image on the CPU and starts the objective function on the OpenCL device without waiting.
+	// while the device computes, the next frame can be pre-processed and submitted (up to Opencl_kernel::n_slots frames in flight)
+	pending pupil_center_async(const cv::Mat& eye_img)
+	{
+		pending p;
+		pre_process(eye_img);
+		p.gpu = kernel.compute_async(gradient_x, gradient_y, stage);
+		// the next pre_process overwrites weight_float and n_strong_gradients. the weights go into the buffer of the
+		// oldest request, which is reused without allocation once it has the size of the frame
+		p.weight_slot = next_weight_slot;
+		next_weight_slot = (next_weight_slot + 1) % Opencl_kernel::n_slots;
+		weight_float.copyTo(async_weights[p.weight_slot]);
+		p.n_strong_gradients = n_strong_gradients;
+		p.original_width = eye_img.cols;
+		return p;
+	}
+
+	// waits for the device and finishes the pupil center estimation of an async request
+	cv::Point2f get(const pending& p)
+	{
+		/*
+		timer2.tick(); 
+		#ifdef _WIN32
+		_ReadWriteBarrier();
+		#endif
+		*/
 
-			/*
-			timer2.tick(); 
-			#ifdef _WIN32
-			_ReadWriteBarrier();
-			#endif
-			*/
+		// copy, because the slot memory is overwritten by a later readback
+		kernel.wait(p.gpu).copyTo(out_sum);
+		cv::multiply(out_sum, async_weights[p.weight_slot], out);
+		n_strong_gradients = p.n_strong_gradients; // for the confidence
 
-			kernel.prepare_data(gradient_x, gradient_y);
-			kernel.compute(out_sum);
-			cv::multiply(out_sum, weight_float, out);
-			
-			/*
-			#ifdef _WIN32
-			_ReadWriteBarrier();
-			#endif
-			measure_timings[1] = timer2.tock(false);
-			*/
+		/*
+		#ifdef _WIN32
+		_ReadWriteBarrier();
+		#endif
+		measure_timings[1] = timer2.tock(false);
+		*/
 
+		return undo_scaling(post_process(), p.original_width);
+	}
+
+	cv::Point2f pupil_center(cv::Mat& eye_img)
+	{
+		if (mode == USE_OPENCL)
+		{
+			return get(pupil_center_async(eye_img));
+		}
+		else if (mode == USE_OPENCL_HYBRID)
+		{
+			pre_process(eye_img);
+			objective_hybrid();
+			cv::multiply(out_sum, weight_float, out);
 			return undo_scaling(post_process(), eye_img.cols);
 		}
+		else if (mode == USE_OPENCL_FULL)
+		{
+			// the maximum of the objective function stays on the device
+			confidence = -1.0f;
+			Opencl_kernel::full_params p;
+			p.width = opt.down_scaling_width;
+			p.height = eye_img.rows * float(opt.down_scaling_width) / eye_img.cols; // same size as in pre_process
+			p.blur = opt.blur;
+			p.sobel = opt.sobel;
+			p.gradient_threshold = opt.gradient_threshold;
+			p.postprocess_threshold = opt.postprocess_threshold;
+			if (opt.subpixel == SUBPIXEL_NONE)
+			{
+				return undo_scaling(kernel.pupil_center_full(eye_img, p, stage), eye_img.cols);
+			}
+
+			// the refinement runs on the rows around the maximum
+			const int r = std::min(2, std::max(1, opt.subpixel_radius));
+			cv::Point m = kernel.pupil_center_full(eye_img, p, stage, &rows_around, r);
+			const int y0 = std::max(0, m.y - r);
+			cv::Point2f q = refine_subpixel(rows_around, cv::Point(m.x, m.y - y0));
+			q.y += y0;
+			return undo_scaling(q, eye_img.cols);
+		}
 		else
 		{
 			return Timm::pupil_center(eye_img);
 		}
 	}
+
+private:
+	float hybrid_fraction = 0.5f;
+
+	// pupil_center_async: the weight images of the requests in flight, like the device slots of Opencl_kernel
+	cv::Mat async_weights[Opencl_kernel::n_slots];
+	int next_weight_slot = 0;
+
+	// USE_OPENCL_FULL: objective function rows around the maximum
+	cv::Mat rows_around;
+
+	// USE_OPENCL_HYBRID: the candidates of the device rows. a member, so that its capacity is kept between frames
+	std::vector<int> device_candidates;
+
+	// objective function with rows [0, r) on the device and rows [r, rows) on the CPU
+	void objective_hybrid()
+	{
+		using namespace std::chrono;
+
+		const int rows = out_sum.rows;
+		const int cols = out_sum.cols;
+		const int r = std::max(1, std::min(rows - 1, int(round(hybrid_fraction * rows))));
+
+		// the device part runs while the CPU prepares its gradients and evaluates its rows
+		auto h = kernel.compute_async(gradient_x, gradient_y, stage, 0, r);
+
+		auto t0 = steady_clock::now();
+		prepare_data();
+		select_candidates();
+
+		// candidates are sorted by index: the ones in the device rows are a prefix
+		auto split = std::lower_bound(candidates.begin(), candidates.end(), r * cols);
+		device_candidates.assign(candidates.begin(), split);
+		candidates.erase(candidates.begin(), split);
+		const int n_cpu = candidates.size();
+		if (n_cpu > 0) { objective_center_major(); }
+		const float t_cpu = duration<float, std::milli>(steady_clock::now() - t0).count();
+
+		// copy the candidates of the device rows only, like on the CPU all other entries stay zero
+		const cv::Mat& device_out = kernel.wait(h);
+		auto src = device_out.ptr<float>(0);
+		auto dst = out_sum.ptr<float>(0);
+		for (int idx : device_candidates) { dst[idx] = src[idx]; }
+
+		// rows per ms of both sides
+		const float t_device = kernel.elapsed_ms(h);
+		if (hybrid.adapt_rate > 0.0f && r < rows && t_cpu > 0.0f && t_device > 0.0f)
+		{
+			const float speed_device = float(r) / t_device;
+			const float speed_cpu = float(rows - r) / t_cpu;
+			const float f = speed_device / (speed_device + speed_cpu);
+			hybrid_fraction += hybrid.adapt_rate * (f - hybrid_fraction);
+			hybrid_fraction = std::max(hybrid.min_fraction, std::min(hybrid.max_fraction, hybrid_fraction));
+		}
+	}
 };
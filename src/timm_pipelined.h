@@ -0,0 +1,149 @@
+#pragma once
+
+#include "timm_two_stage.h"
+#include "thread_pool.h"
+
+// streaming variant of Timm_two_stage that runs both stages concurrently on two cores.
+//
+// pipelined mode (default): stage 1 of frame N+1 runs concurrently with stage 2 of frame N.
+// pupil_center therefore returns the result of the previous frame (one frame latency)
+// and roughly doubles the throughput.
+//
+// speculative mode: stage 2 of frame N runs concurrently with stage 1 of frame N, on the window
+// around the fine estimate of frame N-1. if stage 1 then disagrees by more than
+// speculation_tolerance pixels, the speculative result is discarded and stage 2 is re-run on the
+// correct window. no added latency, but the gain depends on how steady the pupil is.
+//
+// both stages always run on the CPU: the OpenCL stages of Timm_two_stage share one kernel object
+// and cannot run concurrently.
+class Timm_pipelined
+{
+private:
+	Timm stage1;
+	Timm stage2;
+
+	// frame whose stage 2 is still pending (pipelined mode)
+	cv::Mat frame_pending;
+	cv::Point2f pupil_pos_coarse_pending;
+	bool has_pending = false;
+
+	// frame of the current call, stage 1 runs on it in the background
+	cv::Mat frame_current;
+	cv::Mat frame_gray_windowed;
+
+	// last fine estimate, center of the speculative window
+	cv::Point2f pupil_pos_last;
+	bool has_last = false;
+
+	// one persistent thread for stage 1, the calling thread does stage 2
+	Worker_team stage1_worker{ 1 };
+
+public:
+	struct options
+	{
+		typename Timm_two_stage::options two_stage;
+		bool speculative = false;
+		int speculation_tolerance = 10;
+	} opt;
+
+	// counts how often the speculative stage 2 had to be re-run
+	size_t n_speculation_misses = 0;
+
+	void setup(enum_simd_variant simd_width)
+	{
+		if (simd_width >= USE_OPENCL) { throw std::invalid_argument("Timm_pipelined does not support OpenCL"); }
+		stage1.setup(simd_width);
+		stage2.setup(simd_width);
+	}
+
+	void set_options(options o)
+	{
+		opt = o;
+		stage1.opt = opt.two_stage.stage1;
+		stage2.opt = opt.two_stage.stage2;
+		stage2.opt.down_scaling_width = std::min(stage2.opt.down_scaling_width, opt.two_stage.window_width);
+	}
+
+	// processes the given frame. returns false if no result is available yet (first frame in pipelined mode).
+	// otherwise, pupil_pos and pupil_pos_coarse are set to the result of the previous frame (pipelined mode)
+	// or of this frame (speculative mode)
+	bool pupil_center(const cv::Mat& frame_gray, cv::Point2f& pupil_pos, cv::Point2f& pupil_pos_coarse)
+	{
+		// the caller may reuse its frame buffer, so the frame is copied
+		if (opt.two_stage.blur > 0)
+		{
+			GaussianBlur(frame_gray, frame_current, cv::Size(opt.two_stage.blur, opt.two_stage.blur), 0);
+		}
+		else
+		{
+			frame_gray.copyTo(frame_current);
+		}
+
+		cv::Point2f coarse;
+		if (opt.speculative)
+		{
+			cv::Point2f pos_speculative;
+			auto parts = [&](int i)
+			{
+				if (i == 1) { coarse = stage1.pupil_center(frame_current); }
+				else if (has_last) { pos_speculative = fine_stage(frame_current, pupil_pos_last); }
+			};
+			stage1_worker.run(2, parts);
+
+			pupil_pos_coarse = coarse;
+			if (has_last && std::abs(pupil_pos_coarse.x - pupil_pos_last.x) <= opt.speculation_tolerance
+				&& std::abs(pupil_pos_coarse.y - pupil_pos_last.y) <= opt.speculation_tolerance)
+			{
+				pupil_pos = pos_speculative;
+			}
+			else
+			{
+				if (has_last) { n_speculation_misses++; }
+				pupil_pos = fine_stage(frame_current, pupil_pos_coarse);
+			}
+			pupil_pos_last = pupil_pos;
+			has_last = true;
+			return true;
+		}
+
+		// pipelined: stage 2 of the previous frame while stage 1 of this frame runs
+		bool has_result = has_pending;
+		auto parts = [&](int i)
+		{
+			if (i == 1) { coarse = stage1.pupil_center(frame_current); }
+			else if (has_pending)
+			{
+				pupil_pos = fine_stage(frame_pending, pupil_pos_coarse_pending);
+				pupil_pos_coarse = pupil_pos_coarse_pending;
+			}
+		};
+		stage1_worker.run(2, parts);
+
+		pupil_pos_coarse_pending = coarse;
+		std::swap(frame_pending, frame_current);
+		has_pending = true;
+		return has_result;
+	}
+
+	// returns the result of the last frame still in the pipeline (pipelined mode), e.g. at the end of a video
+	bool flush(cv::Point2f& pupil_pos, cv::Point2f& pupil_pos_coarse)
+	{
+		if (!has_pending) { return false; }
+		pupil_pos = fine_stage(frame_pending, pupil_pos_coarse_pending);
+		pupil_pos_coarse = pupil_pos_coarse_pending;
+		has_pending = false;
+		return true;
+	}
+
+private:
+
+	cv::Point2f fine_stage(const cv::Mat& frame, cv::Point2f pos)
+	{
+		auto rect = fit_rectangle(frame, pos, opt.two_stage.window_width);
+		frame_gray_windowed = frame(rect);
+		cv::Point2f p = stage2.pupil_center(frame_gray_windowed);
+		p.x += rect.x;
+		p.y += rect.y;
+		return p;
+	}
+};
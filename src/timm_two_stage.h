@@ -7,7 +7,14 @@
 #include "timm.h"
 #endif
 
-// #include "helpers.h"
+#include "helpers.h"
+#include "coarse_detectors.h"
+#include "result_stream.h"
+
+#include <memory>
+#include <chrono>
+#include <deque>
+#include <thread>
 
 #include <opencv2/highgui/highgui.hpp>
 
@@ -16,9 +23,25 @@ class Timm_two_stage
 private:
 
 	cv::Mat frame_gray_windowed;
+	uint64_t n_frames = 0;
+
+	// pupil_centers: one pair of CPU stages per roi, the merged regions of the rois and the shared stage 1 gradients,
+	// one field per region and roi width
+	struct roi_stages
+	{
+		Timm stage1;
+		Timm stage2;
+		cv::Rect window;
+	};
+	std::deque<roi_stages> rois_state; // deque: the stages do not move when rois are added
+	std::vector<Timm_gradients> shared_gradients;
+	std::vector<cv::Rect> regions;
+	std::vector<int> roi_region;
+	std::vector<int> roi_gradients;         // index into shared_gradients per roi
+	std::unique_ptr<Worker_team> roi_team; // runs the rois in parallel, grows with the number of rois
 
 public:
-	int simd_width = USE_VEC256;
+	int simd_width = Timm::default_simd_width();
 	struct options
 	{
 		using timm_options = typename Timm::options;
@@ -30,12 +53,13 @@ public:
 
 	void setup(enum_simd_variant simd_width)
 	{
+		this->simd_width = simd_width;
 		stage1.setup(simd_width);
 		stage2.setup(simd_width);
 
 		#ifdef __TIMM_OPENCL__
 		// only try to compile the opencl kernel if we actually use OpenCL.
-		if (simd_width == USE_OPENCL)
+		if (simd_width == USE_OPENCL || simd_width == USE_OPENCL_FULL || simd_width == USE_OPENCL_HYBRID)
 		{
 			gradient_kernel.setup();
 		}
@@ -52,11 +76,21 @@ public:
 	Timm stage2;
 	#endif
 
+	// optional cheaper replacement of stage1, see coarse_detectors.h
+	std::shared_ptr<Coarse_detector> coarse_detector;
+
+	// optional: every result of pupil_center is published here, for consumers on other threads
+	std::shared_ptr<Result_stream<pupil_result>> result_stream;
+
 	Timm_two_stage() 
 	#ifdef __TIMM_OPENCL__
 	: stage1(gradient_kernel), stage2(gradient_kernel)
 	#endif
 	{
+		#ifdef __TIMM_OPENCL__
+		stage1.stage = 0;
+		stage2.stage = 1;
+		#endif
 		//stage1.debug_window_name = "Stage 1 (coarse)";
 		//stage2.debug_window_name = "Stage 2 (fine)";		
 	}
@@ -73,38 +107,195 @@ public:
 
 	// std::array<float, 4> get_timings() { return std::array<float, 4>{stage1.measure_timings[0], stage1.measure_timings[1], stage2.measure_timings[0], stage2.measure_timings[1]}; }
 
-	// two stages: coarse estimation and local refinement of pupil center
-	std::tuple<cv::Point, cv::Point> pupil_center(cv::Mat& frame_gray)
+	// two stages: coarse estimation and local refinement of pupil center.
+	// capture_timestamp_ns is only passed on to the result_stream
+	std::tuple<cv::Point2f, cv::Point2f> pupil_center(cv::Mat& frame_gray, uint64_t capture_timestamp_ns = 0)
 	{
+		using clock = std::chrono::steady_clock;
+		auto t0 = clock::now();
+
 		if (opt.blur > 0)
 		{
 			GaussianBlur(frame_gray, frame_gray, cv::Size(opt.blur, opt.blur), 0);
 		}
 
 		//-- Find Eye Centers
-		cv::Point pupil_pos_coarse = stage1.pupil_center(frame_gray);
+		cv::Point2f pupil_pos_coarse = coarse_detector ? coarse_detector->pupil_center(frame_gray) : stage1.pupil_center(frame_gray);
+		auto t1 = clock::now();
 		
 		auto rect = fit_rectangle(frame_gray, pupil_pos_coarse, opt.window_width);
 		frame_gray_windowed = frame_gray(rect);
-		cv::Point pupil_pos = stage2.pupil_center(frame_gray_windowed);
+		cv::Point2f pupil_pos = stage2.pupil_center(frame_gray_windowed);
 		
 		pupil_pos.x += rect.x;
 		pupil_pos.y += rect.y;
+
+		if (result_stream)
+		{
+			auto t2 = clock::now();
+			pupil_result r;
+			r.frame_id = n_frames;
+			r.capture_timestamp_ns = capture_timestamp_ns;
+			r.publish_timestamp_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(t2.time_since_epoch()).count();
+			r.x = pupil_pos.x;
+			r.y = pupil_pos.y;
+			r.x_coarse = pupil_pos_coarse.x;
+			r.y_coarse = pupil_pos_coarse.y;
+			r.confidence = stage2.confidence;
+			r.stage_ms[0] = std::chrono::duration<float, std::milli>(t1 - t0).count();
+			r.stage_ms[1] = std::chrono::duration<float, std::milli>(t2 - t1).count();
+			result_stream->publish(r);
+		}
+		n_frames++;
 		return std::tie(pupil_pos, pupil_pos_coarse);
 	}
 
+	struct roi_result
+	{
+		cv::Point2f pupil_pos;
+		cv::Point2f pupil_pos_coarse;
+		float confidence = 0.0f; // of stage 2, see Timm::confidence
+	};
+
+	// several regions of interest of one frame, e.g. both eyes cropped from a face camera. like pupil_center on every
+	// crop, except that stage 1 does not resize and filter each crop: overlapping or adjacent rois are merged into one
+	// region that is blurred once, and the rois of a region with the same width share one gradient field
+	// (Timm_gradients), scaled like pupil_center scales a crop of that width. then every roi runs the rest of stage 1
+	// and stage 2 in parallel. the scale is the same as per crop, but the results can still differ slightly near the
+	// roi borders: the blur, resize and Sobel of a region see the pixels around a roi, where the crop extrapolates
+	// its border, and the resampling grid starts at the region instead of the roi.
+	// results are in frame pixels and not published to result_stream.
+	// the OpenCL variants and coarse_detector fall back to pupil_center per roi, one after the other
+	void pupil_centers(cv::Mat& frame_gray, const std::vector<cv::Rect>& rois, std::vector<roi_result>& results)
+	{
+		results.resize(rois.size());
+		if (rois.empty()) { return; }
+
+		if (simd_width >= USE_OPENCL || coarse_detector)
+		{
+			for (size_t i = 0; i < rois.size(); i++)
+			{
+				const cv::Rect roi = rois[i] & cv::Rect(0, 0, frame_gray.cols, frame_gray.rows);
+				cv::Mat crop = frame_gray(roi);
+				auto& r = results[i];
+				std::tie(r.pupil_pos, r.pupil_pos_coarse) = pupil_center(crop);
+				r.pupil_pos += cv::Point2f(roi.tl());
+				r.pupil_pos_coarse += cv::Point2f(roi.tl());
+				r.confidence = stage2.confidence;
+			}
+			return;
+		}
+
+		group_rois(frame_gray, rois);
+		const cv::Rect frame_rect(0, 0, frame_gray.cols, frame_gray.rows);
+
+		// one blur per region
+		if (opt.blur > 0)
+		{
+			for (const auto& r : regions)
+			{
+				cv::Mat region = frame_gray(r);
+				GaussianBlur(region, region, cv::Size(opt.blur, opt.blur), 0);
+			}
+		}
+
+		// one gradient field per region and (clipped) roi width, over the bounding box of these rois
+		roi_gradients.assign(rois.size(), -1);
+		int n_fields = 0;
+		for (size_t i = 0; i < rois.size(); i++)
+		{
+			if (roi_gradients[i] >= 0) { continue; }
+			const cv::Rect roi = rois[i] & frame_rect;
+			cv::Rect box = roi;
+			for (size_t j = i + 1; j < rois.size(); j++)
+			{
+				const cv::Rect other = rois[j] & frame_rect;
+				if (roi_region[j] == roi_region[i] && other.width == roi.width)
+				{
+					box = box | other;
+					roi_gradients[j] = n_fields;
+				}
+			}
+			roi_gradients[i] = n_fields;
+			if (int(shared_gradients.size()) <= n_fields) { shared_gradients.emplace_back(); }
+			const float scale = float(std::max(1, roi.width)) / std::max(1, stage1.opt.down_scaling_width);
+			shared_gradients[n_fields++].compute(frame_gray, box, scale, stage1.opt.sobel);
+		}
+
+		while (rois_state.size() < rois.size())
+		{
+			rois_state.emplace_back();
+			rois_state.back().stage1.setup(enum_simd_variant(simd_width));
+			rois_state.back().stage2.setup(enum_simd_variant(simd_width));
+		}
+
+		auto run = [&](int i)
+		{
+			auto& st = rois_state[i];
+			st.stage1.opt = stage1.opt;
+			st.stage2.opt = stage2.opt;
+			st.stage1.n_threads = stage1.n_threads;
+			st.stage2.n_threads = stage2.n_threads;
+			st.stage1.affinity = stage1.affinity;
+			st.stage2.affinity = stage2.affinity;
+
+			const cv::Rect roi = rois[i] & cv::Rect(0, 0, frame_gray.cols, frame_gray.rows);
+			auto& r = results[i];
+			r.pupil_pos_coarse = st.stage1.pupil_center_shared(shared_gradients[roi_gradients[i]], roi);
+
+			// stage 2 like pupil_center on the crop: the window is fitted into the roi
+			const cv::Mat crop = frame_gray(roi);
+			st.window = fit_rectangle(crop, r.pupil_pos_coarse - cv::Point2f(roi.tl()), opt.window_width);
+			r.pupil_pos = st.stage2.pupil_center(crop(st.window));
+			r.pupil_pos += cv::Point2f(st.window.tl() + roi.tl());
+			r.confidence = st.stage2.confidence;
+		};
+
+		if (!roi_team || roi_team->size() < int(rois.size())) { roi_team = std::make_unique<Worker_team>(int(rois.size()) - 1); }
+		roi_team->run(int(rois.size()), run);
+		n_frames++;
+	}
+
 
 
 private:
 
-	// clip value x to range min..max
-	template<class T> inline T clip(T x, const T& min, const T& max)
+	// merges overlapping or adjacent rois (the bounding box is not larger than both rois) into regions
+	void group_rois(const cv::Mat& frame_gray, const std::vector<cv::Rect>& rois)
 	{
-		if (x < min)x = min;
-		if (x > max)x = max;
-		return x;
-	}
+		const cv::Rect frame_rect(0, 0, frame_gray.cols, frame_gray.rows);
+		regions.clear();
+		roi_region.resize(rois.size());
+		for (size_t i = 0; i < rois.size(); i++)
+		{
+			regions.push_back(rois[i] & frame_rect);
+			roi_region[i] = int(i);
+		}
 
+		bool merged = true;
+		while (merged)
+		{
+			merged = false;
+			for (size_t a = 0; a < regions.size() && !merged; a++)
+			{
+				for (size_t b = a + 1; b < regions.size() && !merged; b++)
+				{
+					const cv::Rect u = regions[a] | regions[b];
+					if ((regions[a] & regions[b]).area() > 0 || u.area() <= regions[a].area() + regions[b].area())
+					{
+						regions[a] = u;
+						regions.erase(regions.begin() + b);
+						for (auto& k : roi_region)
+						{
+							if (k == int(b)) { k = int(a); }
+							else if (k > int(b)) { k--; }
+						}
+						merged = true;
+					}
+				}
+			}
+		}
+	}
 
 	///////// visualisation stuff ///////////
 
@@ -116,18 +307,6 @@ private:
 	}
 
 
-	// fit a rectangle with center c and half-width w into a given image
-	cv::Rect fit_rectangle(cv::Mat frame, cv::Point2f c, int w)
-	{
-		int w2 = w; // half width of windows
-		w2 = clip<int>(w2, 0, round(0.5f*frame.cols));
-		w2 = clip<int>(w2, 0, round(0.5f*frame.rows));
-
-		int x = c.x; x = clip<int>(x, w2, frame.cols - w2);
-		int y = c.y; y = clip<int>(y, w2, frame.rows - w2);
-		return cv::Rect(x - w2, y - w2, 2 * w2, 2 * w2);
-	}
-
 
 public:
 	void visualize_frame(cv::Mat& frame, cv::Point2f pupil_pos, cv::Point2f pupil_pos_coarse, const cv::Point2f* ground_truth_pos = nullptr)
@@ -0,0 +1,177 @@
+// checks Timm_async with Timm_two_stage and with Timm on synthetic eye images:
+// submit with futures and with callbacks, the three backpressure policies and a throwing callback.
+//   validate_async [-frames n] [-size w h] [-workers n] [-simd n]
+//     -frames   frames per check (default 100)
+//     -size     image size (default 320 x 240)
+//     -workers  workers of the unbounded checks (default 4). the backpressure checks use one worker and two places
+//     -simd     default: the widest CPU variant of this build up to 256
+// every check prints PASS or FAIL with the stats of Timm_async. returns 1 if a check failed.
+
+#include <iostream>
+#include <vector>
+#include <atomic>
+#include <random>
+#include <string>
+
+#include "timm_async.h"
+#include "helpers.h"
+
+struct test_frames
+{
+	std::vector<cv::Mat> images;
+	std::vector<cv::Point> centers;
+	float tolerance = 0.0f; // pixels
+};
+
+static int n_failed_checks = 0;
+
+template<class Async> void report(const std::string& name, Async& a, bool ok)
+{
+	const auto st = a.get_stats();
+	std::cout << (ok ? "PASS " : "FAIL ") << name << ": submitted " << st.n_submitted << ", completed " << st.n_completed
+		<< ", rejected " << st.n_rejected << ", dropped " << st.n_dropped << ", failed " << st.n_failed << "\n";
+	n_failed_checks += !ok;
+}
+
+// the result belongs to the frame: the detector finds the pupil of a synthetic eye within a few pixels, much closer
+// than the pupils of the other frames are
+static bool close_to(const test_frames& f, uint64_t frame_id, cv::Point2f p)
+{
+	return cv::norm(p - cv::Point2f(f.centers[frame_id % f.images.size()])) < f.tolerance;
+}
+
+template<class Detector> void validate(const std::string& detector_name, enum_simd_variant simd, typename Detector::options o,
+	const test_frames& f, int n_frames, int n_workers)
+{
+	using async = Timm_async<Detector>;
+	using result = typename async::result;
+	auto frame = [&](int i) -> const cv::Mat& { return f.images[i % f.images.size()]; };
+
+	// futures: every request completes, in any order of the workers, with its own frame
+	{
+		async a(simd, o, n_workers, 0, BACKPRESSURE_BLOCK);
+		std::vector<std::future<result>> futures;
+		for (int i = 0; i < n_frames; i++) { futures.push_back(a.submit(frame(i), i)); }
+		bool ok = true;
+		for (int i = 0; i < n_frames; i++)
+		{
+			const result r = futures[i].get();
+			ok = ok && r.status == ASYNC_OK && r.frame_id == uint64_t(i) && close_to(f, r.frame_id, r.pupil_pos);
+		}
+		a.wait_idle();
+		const auto st = a.get_stats();
+		ok = ok && st.n_submitted == size_t(n_frames) && st.n_completed == size_t(n_frames) && st.n_rejected + st.n_dropped + st.n_failed == 0;
+		report(detector_name + ", futures", a, ok);
+	}
+
+	// callbacks
+	{
+		async a(simd, o, n_workers, 0, BACKPRESSURE_BLOCK);
+		std::atomic<int> n_ok{ 0 }, n_wrong{ 0 };
+		for (int i = 0; i < n_frames; i++)
+		{
+			a.submit(frame(i), i, [&](const result& r)
+			{
+				if (r.status == ASYNC_OK && close_to(f, r.frame_id, r.pupil_pos)) { n_ok++; }
+				else { n_wrong++; }
+			});
+		}
+		a.wait_idle();
+		const auto st = a.get_stats();
+		report(detector_name + ", callbacks", a, n_ok == n_frames && n_wrong == 0 && st.n_completed == size_t(n_frames));
+	}
+
+	// reject: a burst into two places. every accepted request completes, every refused one gets no callback
+	{
+		async a(simd, o, 1, 2, BACKPRESSURE_REJECT);
+		std::atomic<int> n_callbacks{ 0 };
+		int n_accepted = 0;
+		for (int i = 0; i < n_frames; i++) { n_accepted += a.submit(frame(i), i, [&](const result&) { n_callbacks++; }); }
+		a.wait_idle();
+		const auto st = a.get_stats();
+		report(detector_name + ", backpressure reject", a, n_callbacks == n_accepted && st.n_completed == size_t(n_accepted)
+			&& st.n_rejected == size_t(n_frames - n_accepted) && st.n_dropped == 0);
+	}
+
+	// drop oldest: every request completes, either processed or dropped, and the newest frame is always processed
+	{
+		async a(simd, o, 1, 2, BACKPRESSURE_DROP_OLDEST);
+		std::atomic<int> n_processed{ 0 }, n_dropped{ 0 };
+		std::atomic<bool> last_processed{ false };
+		for (int i = 0; i < n_frames; i++)
+		{
+			a.submit(frame(i), i, [&, i](const result& r)
+			{
+				if (r.status == ASYNC_OK) { n_processed++; }
+				else if (r.status == ASYNC_DROPPED) { n_dropped++; }
+				if (i == n_frames - 1) { last_processed = r.status == ASYNC_OK; }
+			});
+		}
+		a.wait_idle();
+		const auto st = a.get_stats();
+		report(detector_name + ", backpressure drop oldest", a, n_processed + n_dropped == n_frames && last_processed
+			&& st.n_completed == size_t(n_processed.load()) && st.n_dropped == size_t(n_dropped.load()) && st.n_rejected == 0);
+	}
+
+	// block: nothing is lost, submit waits instead
+	{
+		async a(simd, o, 1, 2, BACKPRESSURE_BLOCK);
+		std::atomic<int> n_ok{ 0 };
+		for (int i = 0; i < n_frames; i++) { a.submit(frame(i), i, [&](const result& r) { n_ok += r.status == ASYNC_OK; }); }
+		a.wait_idle();
+		const auto st = a.get_stats();
+		report(detector_name + ", backpressure block", a, n_ok == n_frames && st.n_completed == size_t(n_frames)
+			&& st.n_rejected + st.n_dropped + st.n_failed == 0);
+	}
+
+	// a throwing callback is reported and does not stop the workers
+	{
+		async a(simd, o, n_workers, 0, BACKPRESSURE_BLOCK);
+		std::atomic<int> n_callbacks{ 0 };
+		for (int i = 0; i < n_frames; i++)
+		{
+			a.submit(frame(i), i, [&, i](const result&)
+			{
+				n_callbacks++;
+				if (i == 0) { throw std::runtime_error("test exception (expected)"); }
+			});
+		}
+		a.wait_idle();
+		report(detector_name + ", throwing callback", a, n_callbacks == n_frames && a.get_stats().n_completed == size_t(n_frames));
+	}
+}
+
+int main(int argc, char* argv[])
+{
+	using namespace std;
+
+	int n_frames = 100, w = 320, h = 240, n_workers = 4, simd = Timm::default_simd_width();
+	for (int i = 1; i < argc; i++)
+	{
+		string a = argv[i];
+		if (a == "-frames" && i + 1 < argc) { n_frames = max(1, atoi(argv[++i])); }
+		else if (a == "-size" && i + 2 < argc) { w = atoi(argv[i + 1]); h = atoi(argv[i + 2]); i += 2; }
+		else if (a == "-workers" && i + 1 < argc) { n_workers = max(1, atoi(argv[++i])); }
+		else if (a == "-simd" && i + 1 < argc) { simd = atoi(argv[++i]); }
+		else { cerr << "unknown argument " << a << "\n"; return 1; }
+	}
+
+	mt19937 rng(3);
+	test_frames f;
+	f.tolerance = max(w, h) / 20.0f;
+	for (int i = 0; i < 16; i++)
+	{
+		f.centers.emplace_back();
+		f.images.push_back(synthetic_eye(rng, w, h, f.centers.back()));
+	}
+
+	validate<Timm_two_stage>("Timm_two_stage", enum_simd_variant(simd), Timm_two_stage().opt, f, n_frames, n_workers);
+	validate<Timm>("Timm", enum_simd_variant(simd), Timm().opt, f, n_frames, n_workers);
+
+	cout << (n_failed_checks ? to_string(n_failed_checks) + " checks FAILED\n" : string("all checks passed\n"));
+	return n_failed_checks ? 1 : 0;
+}
+
+#ifdef OPENCL_ENABLED
+#include "opencl_kernel.cpp"
+#endif
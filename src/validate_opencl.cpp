@@ -0,0 +1,93 @@
+// compares the OpenCL paths (USE_OPENCL, USE_OPENCL_FULL and USE_OPENCL_HYBRID) with the CPU path of Timm.
+// works with any OpenCL runtime, e.g. POCL on a machine without GPU:
+//   TIMM_OPENCL_DEVICE=pthread validate_opencl [eye images..]
+// without arguments, synthetic eye images (dark ellipse on a noisy, bright background) are used.
+// finally, USE_OPENCL runs once with one frame in flight (pupil_center) and once pipelined with two
+// (pupil_center_async / get), which must give the same results in less time.
+
+#include <iostream>
+#include <chrono>
+
+#define OPENCL_ENABLED
+#include "timm_opencl.h"
+#include "helpers.h"
+
+#include <opencv2/imgcodecs.hpp>
+
+int main(int argc, char* argv[])
+{
+	using namespace std;
+
+	Opencl_kernel kernel;
+	kernel.setup();
+
+	Timm timm_cpu;
+	Timm_opencl timm_cl(kernel), timm_cl_full(kernel), timm_cl_hybrid(kernel);
+	timm_cpu.setup(USE_NO_VEC);
+	timm_cl.setup(USE_OPENCL);
+	timm_cl_full.setup(USE_OPENCL_FULL);
+	timm_cl_full.stage = 1; // separate device buffers
+	timm_cl_hybrid.hybrid.cpu_simd = USE_NO_VEC;
+	timm_cl_hybrid.setup(USE_OPENCL_HYBRID);
+	timm_cl_hybrid.stage = 2;
+
+	vector<cv::Mat> images;
+	for (int i = 1; i < argc; i++)
+	{
+		auto img = cv::imread(argv[i], cv::IMREAD_GRAYSCALE);
+		if (img.empty()) { cerr << "could not read " << argv[i] << "\n"; return 1; }
+		images.push_back(img);
+	}
+	if (images.empty())
+	{
+		mt19937 rng(42);
+		cv::Point c;
+		for (int i = 0; i < 50; i++) { images.push_back(synthetic_eye(rng, 320, 240, c)); }
+	}
+
+	// deviation in pixels of the original image
+	double max_dev[3] = { 0, 0, 0 }, mean_dev[3] = { 0, 0, 0 };
+	for (auto& img : images)
+	{
+		cv::Point2f p_cpu = timm_cpu.pupil_center(img);
+		cv::Point2f p[3] = { timm_cl.pupil_center(img), timm_cl_full.pupil_center(img), timm_cl_hybrid.pupil_center(img) };
+		for (int k = 0; k < 3; k++)
+		{
+			double d = cv::norm(p[k] - p_cpu);
+			max_dev[k] = std::max(max_dev[k], d);
+			mean_dev[k] += d / images.size();
+		}
+	}
+
+	cout << "images: " << images.size() << "\n";
+	cout << "USE_OPENCL      vs CPU: mean deviation " << mean_dev[0] << " px, max " << max_dev[0] << " px\n";
+	cout << "USE_OPENCL_FULL vs CPU: mean deviation " << mean_dev[1] << " px, max " << max_dev[1] << " px\n";
+	cout << "USE_OPENCL_HYBRID vs CPU: mean deviation " << mean_dev[2] << " px, max " << max_dev[2] << " px"
+		<< " (device rows: " << 100.0f * timm_cl_hybrid.device_fraction() << " %)\n";
+
+	// pipelined: frame i + 1 is pre-processed and uploaded while the device computes frame i
+	using clock = chrono::steady_clock;
+	const int rounds = 4;
+	vector<cv::Point2f> p_single, p_pipelined;
+	auto t0 = clock::now();
+	for (int r = 0; r < rounds; r++) { for (auto& img : images) { p_single.push_back(timm_cl.pupil_center(img)); } }
+	auto t1 = clock::now();
+	const size_t n = rounds * images.size();
+	Timm_opencl::pending in_flight = timm_cl.pupil_center_async(images[0]);
+	for (size_t i = 1; i <= n; i++)
+	{
+		Timm_opencl::pending next;
+		if (i < n) { next = timm_cl.pupil_center_async(images[i % images.size()]); }
+		p_pipelined.push_back(timm_cl.get(in_flight));
+		in_flight = next;
+	}
+	auto t2 = clock::now();
+
+	double max_diff = 0.0;
+	for (size_t i = 0; i < n; i++) { max_diff = std::max(max_diff, double(cv::norm(p_single[i] - p_pipelined[i]))); }
+	cout << "USE_OPENCL one frame in flight: " << chrono::duration<double, milli>(t1 - t0).count() / n << " ms per frame, two: "
+		<< chrono::duration<double, milli>(t2 - t1).count() / n << " ms per frame, max difference " << max_diff << " px\n";
+	return 0;
+}
+
+#include "opencl_kernel.cpp"